@@ -1,23 +1,43 @@
 #ifndef BUFFER
 #define BUFFER
 
+#include <atomic>
 #include <cstddef>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <vector>
 
 #include "dtypes.h"
 #include "string_utils.h"
 
 class Buffer {
+    // views share the version of the buffer they view
+    friend class GraphBuffer;
+    friend class BroadcastedBuffer;
+
    protected:
     // number of elements of type dtype_
     // does NOT represent the number of bits/bytes
     size_t size_;
     void* data_;
 
+    // elements addressable from data_
+    // more than size_ for views that skip over some of the data they sit in, see GraphBuffer
+    size_t span_;
+
     DTYPE dtype_;
 
+    // how many times the data may have been written, shared with the views of the same data
+    // getData counts once per call, element writes only raise `written_`, which the next `version` folds into the
+    // count, so a kernel writing every element doesn't contend on the count
+    struct Version {
+        std::atomic<size_t> count_{0};
+        std::atomic<bool> written_{false};
+    };
+
+    std::shared_ptr<Version> version_;
+
    public:
     Buffer();
 
@@ -29,23 +49,39 @@ class Buffer {
 
     DTYPE dtype();
 
+    // counts as a write, see `version`
     void* getData();
 
+    // the data for reading only, which doesn't count as a write
+    const void* readData();
+
+    // changes whenever the data may have been written, through `getData` or `setIndex` on this buffer or any view of
+    // its data, so whatever's derived from the data (e.g. packing::Cache) can tell when it's stale
+    size_t version();
+
+    size_t span();
+
+    // the strides are the row-major ones for the shape, i.e. the data can be read front to back as a flat array
+    // only views can be anything else, see views.h
+    bool contiguous();
+
     void print();
 
     // this assumes the entirety of data_ is a 1-D array
     // for N-D arrays you'll need to convert
     // e.g. 4-D array of shape [x, y, z, w] at [i, j, k, l] means index == i * y * z * w + j * z * w + k * w + l
     // TODO: this disclaimer can probably be abstracted more easily
+    //
+    // `value` points to an element of the buffer's dtype
     void setIndex(size_t index, void* value);
 
     void setIndex(const std::vector<int>& index, void* value);
 
     template <typename T>
     T getIndex(size_t index) {
-        if (index > size_) {
+        if (index > span_) {
             std::cerr << strings::error("Buffer::getIndex error: ") << "index " << strings::info(std::to_string(index))
-                      << " out of range " << strings::info(std::to_string(size_)) << std::endl;
+                      << " out of range " << strings::info(std::to_string(span_)) << std::endl;
             exit(-1);
         }
 
@@ -62,6 +98,21 @@ class Buffer {
         return getIndex<T>(flat_index);
     }
 
+    // element `index` converted to `T`, whatever the buffer's dtype
+    // meant for cold paths like loading inputs and printing, kernels dispatch on the dtype instead
+    template <typename T>
+    T getValue(size_t index) {
+        return dtypes::dispatch(dtype_, [&]<typename U>() { return (T)getIndex<U>(index); });
+    }
+
+    template <typename T>
+    void setValue(size_t index, T value) {
+        dtypes::dispatch(dtype_, [&]<typename U>() {
+            U converted = (U)value;
+            setIndex(index, (void*)(&converted));
+        });
+    }
+
     std::vector<int> shape_;
 
     std::vector<int> strides_;
@@ -71,7 +122,20 @@ class GraphBuffer : public Buffer {
    public:
     GraphBuffer(std::vector<int> shape, DTYPE dtype);
     GraphBuffer(std::shared_ptr<GraphBuffer> buf);
+
+    // a view of `base`'s data starting `offset` elements in, nothing is copied
+    // `strides` are in elements, with a stride of 0 repeating the same data along its dimension
+    GraphBuffer(std::shared_ptr<Buffer> base, const std::vector<int>& shape, const std::vector<int>& strides,
+                size_t offset);
+
     ~GraphBuffer();
+
+    bool isView();
+
+   private:
+    // the buffer whose data this one views, kept alive for as long as the view is
+    // nullptr if the data is this buffer's own
+    std::shared_ptr<Buffer> base_;
 };
 
 class BroadcastedBuffer : public Buffer {
@@ -4,6 +4,7 @@
 #include <memory>
 
 #include "buffer.h"
+#include "gemm.h"
 
 namespace buffer_ops {
 
@@ -44,7 +45,27 @@ void transpose(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, const std
 void matmul(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
             const std::vector<int>& shape_a, const std::vector<int>& shape_b, const std::vector<int>& shape_out);
 
-float reduceSum(std::shared_ptr<Buffer> a);
+// applies `epilogue` to each output matrix as it's computed, see gemm.h
+void matmul(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
+            const std::vector<int>& shape_a, const std::vector<int>& shape_b, const std::vector<int>& shape_out,
+            const gemm::Epilogue& epilogue);
+
+// alpha * op(a) @ op(b) + beta * out, see the transposing gemm::sgemm
+// op() swaps the last two dimensions of its operand when its flag is set, `shape_a` and `shape_b` are as stored
+// the shapes only have to agree with the buffers' sizes, e.g. a batch can be folded into the rows by passing
+// [batch * m, k] for a [batch, m, k] buffer
+void matmul(std::shared_ptr<Buffer> a, bool trans_a, std::shared_ptr<Buffer> b, bool trans_b,
+            std::shared_ptr<Buffer> out, const std::vector<int>& shape_a, const std::vector<int>& shape_b,
+            const std::vector<int>& shape_out, float alpha, float beta);
+
+// `b` already packed (see gemm::pack) is one matrix for every product in the batch,
+// so the batch is folded into the rows of a single product; float32 only
+void matmul(std::shared_ptr<Buffer> a, const gemm::PackedB& b, std::shared_ptr<Buffer> out,
+            const gemm::Epilogue& epilogue);
+
+double reduceSum(std::shared_ptr<Buffer> a);
+
+// sums `a` over `indices` onto what's already in `out`, see reduction.h
 void reduceSum(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, const std::vector<int>& indices);
 
 void set(std::shared_ptr<Buffer> a, float value);
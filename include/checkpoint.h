@@ -0,0 +1,71 @@
+#ifndef CHECKPOINT
+#define CHECKPOINT
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <set>
+
+#include "graph.h"
+
+// activation checkpointing
+//
+// with checkpointing on, the forward pass frees an activation as soon as everything consuming it has been computed,
+// unless it's a checkpoint; parameters, inputs and the loss are always kept
+//
+// the backward pass splits the topological order into segments ending at each checkpoint and walks them last to first,
+// recomputing a segment's activations from the checkpoints before it, backpropagating through it, then freeing it again
+// so at most one segment's activations are alive at a time on top of the checkpoints
+//
+// checkpoints come from `checkpoint <variable>` statements in the .nn file (see nn_parser.h)
+// or from `automatic`, which keeps every ~sqrt(N)th of the graph's N activations:
+// O(sqrt(N)) memory for roughly one extra forward pass
+//
+// the forward pass follows Graph::executionOrder when one is set, see memory_order.h
+namespace checkpoint {
+
+struct Report {
+    // activations the loss depends on
+    int nodes_;
+
+    int checkpoints_;
+    int segments_;
+
+    // every activation, i.e. the memory needed without checkpointing
+    size_t full_bytes_;
+
+    // activations alive through the whole step: checkpoints, the loss, anything without a consumer
+    size_t kept_bytes_;
+
+    // the largest segment, all of which is alive at once while backpropagating through it
+    size_t peak_segment_bytes_;
+
+    // work spent recomputing activations, as a fraction of a forward pass
+    double recompute_;
+};
+
+// checkpoints every ~sqrt(N)th activation on top of any already marked and turns checkpointing on
+Report automatic(std::shared_ptr<Graph> graph);
+
+// what the graph's current checkpoints come to
+// shapes are taken from the nodes, so the graph should be allocated first
+Report report(std::shared_ptr<Graph> graph);
+
+void printReport(const Report& report);
+
+// the passes behind Graph::evaluate and Graph::calculateGradient while checkpointing is on
+// `visit` computes a node going forward and backpropagates through it going backward
+void forward(Graph& graph, std::function<void(std::shared_ptr<Node>)> visit);
+
+// the forward pass over `subgraph` alone, for a partial Graph::evaluate
+// only consumers inside the subgraph count, so the requested outputs are kept
+void forward(Graph& graph, std::function<void(std::shared_ptr<Node>)> visit, const std::set<int>& subgraph);
+
+void backward(Graph& graph, std::function<void(std::shared_ptr<Node>)> visit);
+
+// ids of the activations the forward pass frees once their last consumer is computed
+std::set<int> releasable(Graph& graph);
+
+}  // namespace checkpoint
+
+#endif
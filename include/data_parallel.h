@@ -0,0 +1,54 @@
+#ifndef DATA_PARALLEL
+#define DATA_PARALLEL
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "graph.h"
+
+// synchronous data-parallel training
+//
+// the graph is replicated once per worker (see Graph::replicate), each replica owning the activations and gradients
+// for its slice of the batch while every replica reads the same parameter buffers
+//
+// a step shards the batch along its leading dimension, runs the forward and backward pass of every replica
+// concurrently, tree-reduces the replicas' parameter gradients pairwise into the original graph and applies them there
+// parameters are only written after every replica is done with them, so the step matches training on the whole batch
+// up to float summation order
+namespace data_parallel {
+
+class Trainer {
+   public:
+    // `graph` must be allocated with its loss node set
+    // its inputs' leading dimension is the batch, which must split evenly between `replicas`
+    Trainer(std::shared_ptr<Graph> graph, int replicas);
+
+    // one SGD step over `batch`, laid out the same way Graph::evaluate takes it
+    // returns the loss over the whole batch
+    float step(const std::unordered_map<std::string, std::vector<float>>& batch, float learning_rate);
+
+    int replicas();
+
+    int batchSize();
+
+   private:
+    std::shared_ptr<Graph> graph_;
+
+    std::vector<std::shared_ptr<Graph>> replicas_;
+
+    // ids of the trainable nodes with gradients to reduce
+    std::vector<int> parameters_;
+
+    int batch_size_;
+    int shard_size_;
+};
+
+// replica `index` of `replicas`' slice of `batch`, each value split evenly along its leading dimension
+std::unordered_map<std::string, std::vector<float>> shard(
+    const std::unordered_map<std::string, std::vector<float>>& batch, int index, int replicas);
+
+}  // namespace data_parallel
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef DENSE
+#define DENSE
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "graph.h"
+
+// dense layer fusion
+//
+// `matmul(x, w)` followed by a bias `add`, optionally followed by a `relu` or `sigmoid`,
+// is rewritten into a single `dense`, `dense_relu` or `dense_sigmoid` node taking (x, w, bias)
+//
+// the bias add and activation are applied as the GEMM epilogue, on each output tile while it's still in registers,
+// so neither the product nor the pre-activation is ever written out as a tensor of its own
+// `dense_relu` keeps the relu mask from the forward pass to mask the gradient on the way back
+//
+// the bias must be one value per output column, e.g. [N] or [1, N] for an [M, N] product
+// run this before `fusion::run`, which would otherwise claim the add and activation
+namespace dense {
+
+struct Report {
+    int layers_;
+    int nodes_fused_;
+};
+
+// names in `keep` are never fused away
+Report run(std::shared_ptr<Graph> graph, const std::vector<std::string>& keep);
+
+Report run(std::shared_ptr<Graph> graph);
+
+void printReport(const Report& report);
+
+// kernels behind the dense operations
+void forward(std::shared_ptr<Node> node);
+
+void backward(std::shared_ptr<Node> node);
+
+}  // namespace dense
+
+#endif
@@ -2,8 +2,15 @@
 #define DTYPES
 
 #include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <type_traits>
 
-enum class DTYPE { float32, float64 };
+#include "half.h"
+#include "string_utils.h"
+
+enum class DTYPE { float32, float64, bfloat16, float16 };
 
 namespace dtypes {
 
@@ -13,16 +20,74 @@ static size_t dtypeSize(DTYPE dtype) {
     }
 
     if (dtype == DTYPE::float64) {
-        return sizeof(float);
+        return sizeof(double);
+    }
+
+    if (dtype == DTYPE::bfloat16) {
+        return sizeof(bfloat16);
+    }
+
+    if (dtype == DTYPE::float16) {
+        return sizeof(float16);
     }
 
     return 0;
 }
 
+static std::string name(DTYPE dtype) {
+    if (dtype == DTYPE::float32) {
+        return "float32";
+    }
+
+    if (dtype == DTYPE::float64) {
+        return "float64";
+    }
+
+    if (dtype == DTYPE::bfloat16) {
+        return "bfloat16";
+    }
+
+    if (dtype == DTYPE::float16) {
+        return "float16";
+    }
+
+    return "unknown";
+}
+
+static bool isHalf(DTYPE dtype) {
+    return dtype == DTYPE::bfloat16 || dtype == DTYPE::float16;
+}
+
 static float* toFloat32(void* ptr) {
     return (float*)ptr;
 }
 
+// what values of type `T` are summed and multiplied in
+// half precision is only ever a storage format, see half.h
+template <typename T>
+using Accumulate = std::conditional_t<std::is_same_v<T, double>, double, float>;
+
+// calls `f.template operator()<T>()` with `T` the element type behind `dtype`
+// kernels are written once as a templated lambda and dispatched once per node, e.g.
+//
+//     dtypes::dispatch(buffer->dtype(), [&]<typename T>() { T* data = (T*)buffer->getData(); ... });
+template <typename F>
+decltype(auto) dispatch(DTYPE dtype, F&& f) {
+    switch (dtype) {
+        case DTYPE::float32:
+            return f.template operator()<float>();
+        case DTYPE::float64:
+            return f.template operator()<double>();
+        case DTYPE::bfloat16:
+            return f.template operator()<bfloat16>();
+        case DTYPE::float16:
+            return f.template operator()<float16>();
+    }
+
+    std::cerr << strings::error("dtypes::dispatch error: ") << "unsupported dtype" << std::endl;
+    exit(-1);
+}
+
 }  // namespace dtypes
 
 #endif
@@ -0,0 +1,66 @@
+#ifndef FUSION
+#define FUSION
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "graph.h"
+
+// element-wise operator fusion
+//
+// chains of single-consumer element-wise nodes, e.g. `relu(add(matmul(x, b), bb))`'s add and relu,
+// are collapsed into a single `fused` node carrying a small program for the whole expression
+//
+// the fused kernel runs the program a tile at a time, so the intermediates only ever live in a tile-sized scratch
+// space and never get output or gradient buffers of their own
+//
+// the backward pass re-runs the forward program per tile and walks it in reverse,
+// broadcasted inputs have their gradients reduced back down to their own shape
+namespace fusion {
+
+enum class Opcode { add, subtract, multiply, divide, relu, sigmoid, exp, ln, sqrt, pow };
+
+// operands index into the program's values: [0, leaves_) are the fused node's inputs in `arg_order_` order,
+// [leaves_ + i] is the result of instruction i
+struct Instruction {
+    Opcode op_;
+
+    int a_;
+    int b_;  // -1 for unary instructions
+
+    // exponent for pow, which is only fused with a constant exponent
+    float scalar_;
+};
+
+struct Program {
+    int leaves_;
+
+    // the result of the last instruction is the node's output
+    std::vector<Instruction> instructions_;
+
+    std::string toString();
+};
+
+struct Report {
+    int groups_;
+    int nodes_fused_;
+};
+
+bool fusible(std::shared_ptr<Node> node);
+
+// names in `keep` are never fused away, e.g. outputs that need fetched after evaluation
+Report run(std::shared_ptr<Graph> graph, const std::vector<std::string>& keep);
+
+Report run(std::shared_ptr<Graph> graph);
+
+void printReport(const Report& report);
+
+// kernels behind the `fused` operation
+void forward(std::shared_ptr<Node> node);
+
+void backward(std::shared_ptr<Node> node);
+
+}  // namespace fusion
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef GEMM
+#define GEMM
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "half.h"
+
+// single precision matrix multiplication
+//
+// C[m x n] = A[m x k] @ B[k x n], all row-major
+//
+// blocked the usual way: B is packed a [KC x NC] panel at a time and A a [MC x KC] block at a time,
+// both into contiguous micro-panels so the micro-kernel streams through memory in order
+// the micro-kernel keeps an [MR x NR] tile of C in registers for the whole k loop
+//
+// an epilogue can be applied to each output tile on its way out of the registers,
+// saving a separate pass over C for the bias add and activation of a dense layer
+namespace gemm {
+
+enum class Activation { none, relu, sigmoid };
+
+struct Epilogue {
+    // multiplies the product before anything else
+    float scale_;
+
+    // [n], broadcast across the rows of C; nullptr for none
+    const float* bias_;
+
+    Activation activation_;
+
+    // [m x n] with C's row stride, set to 1 where the pre-activation is > 0 and 0 elsewhere
+    // only written for relu, nullptr to skip
+    float* mask_;
+};
+
+Epilogue none();
+
+void sgemm(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc);
+
+// B packed ahead of time into the panels sgemm would otherwise pack on every call,
+// for operands that are multiplied over and over, e.g. weights
+struct PackedB {
+    int k_;
+    int n_;
+
+    // [KC x NC] blocks one after the other, each laid out as sgemm packs it
+    std::vector<float> data_;
+};
+
+// B is addressed as b[p * rsb + j * csb], so swapping the strides packs its transpose
+// packs on the calling thread
+std::shared_ptr<PackedB> pack(int k, int n, const float* b, int rsb, int csb);
+
+// k and n are the packed B's
+void sgemm(int m, const float* a, int lda, const PackedB& b, float* c, int ldc, const Epilogue& epilogue);
+
+void sgemm(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc,
+           const Epilogue& epilogue);
+
+// A and B stored at half width, converted to float32 as they're packed
+// C and the accumulation stay float32
+void sgemm(int m, int n, int k, const bfloat16* a, int lda, const bfloat16* b, int ldb, float* c, int ldc,
+           const Epilogue& epilogue);
+
+void sgemm(int m, int n, int k, const float16* a, int lda, const float16* b, int ldb, float* c, int ldc,
+           const Epilogue& epilogue);
+
+// C = alpha * op(A) @ op(B) + beta * C, BLAS style
+//
+// op() transposes its operand when the flag is set, by reading it with its strides swapped rather than copying it
+// A and B are stored row-major with row strides lda and ldb as they are in memory, i.e. before op()
+// op(A) is [m x k] and op(B) is [k x n]; with a beta of 0, C is only written
+void sgemm(bool trans_a, bool trans_b, int m, int n, int k, float alpha, const float* a, int lda, const float* b,
+           int ldb, float beta, float* c, int ldc);
+
+void sgemm(bool trans_a, bool trans_b, int m, int n, int k, float alpha, const bfloat16* a, int lda,
+           const bfloat16* b, int ldb, float beta, float* c, int ldc);
+
+void sgemm(bool trans_a, bool trans_b, int m, int n, int k, float alpha, const float16* a, int lda, const float16* b,
+           int ldb, float beta, float* c, int ldc);
+
+// y = alpha * op(A) @ x + beta * y, BLAS style, with A stored [m x n] row-major
+//
+// op(A) @ x is m dot products of the rows of A with x, a few rows at a time so x is loaded once for all of them
+// op(A) @ x with the transpose sums the rows of A scaled by x, holding a block of y in registers as they stream past
+// either way A is read straight from memory once, with the next rows prefetched, and y is split across threads once A
+// is large enough
+//
+// sgemm hands any product with a single row or column of output to this, as is the case at a batch size of 1,
+// and multiplies a single row by a packed B panel by panel with no packing of A
+void sgemv(bool trans, int m, int n, float alpha, const float* a, int lda, const float* x, int incx, float beta,
+           float* y, int incy);
+
+// double precision, same layout as sgemm
+// not packed or register tiled, rows of C are split across threads and built up a row of B at a time
+void dgemm(int m, int n, int k, const double* a, int lda, const double* b, int ldb, double* c, int ldc);
+
+void dgemm(bool trans_a, bool trans_b, int m, int n, int k, double alpha, const double* a, int lda, const double* b,
+           int ldb, double beta, double* c, int ldc);
+
+// many independent products of the same small shape, e.g. the per-batch products of a batched matmul
+//
+// C = A @ B for every `offsets[i]`, which holds the element offsets of that product's A, B and C
+// none of m, n and k should be more than SMALL: nothing is packed or blocked, a row of C is built up in registers,
+// and an n and k of 1, 2, 4, 8 or 16 get a kernel unrolled for exactly that size
+// plain products only, C is written without being read
+constexpr int SMALL = 16;
+
+void sgemmBatched(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc,
+                  const std::array<size_t, 3>* offsets, size_t count);
+
+void dgemmBatched(int m, int n, int k, const double* a, int lda, const double* b, int ldb, double* c, int ldc,
+                  const std::array<size_t, 3>* offsets, size_t count);
+
+// int8 quantized, unsigned 8-bit A times signed 8-bit B accumulated exactly in int32
+//
+// B is given transposed, [n x k] row-major, so both operands of each dot product are read in order
+// A is offset by `a_zero_point`, which is taken back out of the int32 sums using `b_sums` (each column of B summed)
+// the sums are dequantized into C by `b_scales` (one per column) and then the epilogue,
+// whose scale_ should be the scale of A
+void qgemm(int m, int n, int k, const uint8_t* a, int lda, uint8_t a_zero_point, const int8_t* bt, int ldb,
+           const int32_t* b_sums, const float* b_scales, float* c, int ldc, const Epilogue& epilogue);
+
+}  // namespace gemm
+
+#endif
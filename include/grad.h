@@ -8,6 +8,9 @@ namespace gradient {
 
 void _propagate_current_grad(std::shared_ptr<Node> node, std::shared_ptr<Node> child);
 
+// gradients wrt the first two args of a matmul-shaped `node`, given the gradient of its product
+void _matmul_gradient(std::shared_ptr<Node> node, std::shared_ptr<GraphBuffer> upstream);
+
 void propagateNode(std::shared_ptr<Node> node);
 
 }  // namespace gradient
@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <climits>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <map>
 #include <memory>
@@ -19,6 +20,18 @@
 class Node;
 class Graph;
 
+namespace fusion {
+struct Program;
+}
+
+namespace quantize {
+struct Weights;
+}
+
+namespace packing {
+struct Cache;
+}
+
 // probably needs moved
 //
 // TODO: This Node class needs cleaned up
@@ -57,6 +70,18 @@ class Node {
     // this is only used if operation_type_ == operations::function
     std::shared_ptr<Graph> graph_;
 
+    // this is only used if operation_type_ == operations::fused
+    std::shared_ptr<fusion::Program> program_;
+
+    // this is only used if operation_type_ == operations::qmatmul
+    std::shared_ptr<quantize::Weights> quantized_;
+
+    // gemm packed copies of a parameter's weights, see packing.h
+    std::shared_ptr<packing::Cache> packed_;
+
+    // whatever the forward pass keeps around for the backward pass, e.g. the relu mask of `dense_relu`
+    std::shared_ptr<GraphBuffer> saved_;
+
     // this is true if the node is an input to the `.nn` file; false otherwise
     bool external_input_;
 
@@ -64,6 +89,24 @@ class Node {
 
     bool const_;
 
+    // the output buffer belongs to another graph, see Graph::replicate
+    // Graph::reset leaves these alone
+    bool shared_;
+
+    // kept through the forward pass when checkpointing, see checkpoint.h
+    bool checkpoint_;
+
+    // this is only used by the view operations
+    // the view is copied into a buffer of its own for a consumer that can't read it in place, see views.h
+    bool materialize_;
+
+    // element type of output_ and gradient_, see Graph::setDtype
+    DTYPE dtype_;
+
+    // trainable, const, or generated (normal(), tensor(), ones(), constants)
+    // values that are set up once rather than computed from the inputs
+    bool isParameter();
+
     void printOutput(std::ostream& stream);
 
     void printGradient(std::ostream& stream);
@@ -82,6 +125,18 @@ class Graph {
 
     Graph(std::shared_ptr<Graph> graph);
 
+    // a copy of this graph for running it on another thread
+    //
+    // parameters (trainable, const, and generated tensors like normal() or constants) share their output buffers
+    // with this graph, everything else gets a private buffer
+    // inputs get a leading (batch) dimension of `batch_size`, 0 keeps the declared one
+    //
+    // `gradients` decides whether the replica can be backpropagated through, in which case every node gets a
+    // private gradient buffer, parameters included; otherwise only activations are allocated
+    //
+    // this graph must be allocated, only nodes it has allocated are allocated in the replica
+    std::shared_ptr<Graph> replicate(int batch_size, bool gradients);
+
     std::string getUniqueNodeName(const std::string& name);
 
     std::shared_ptr<Node> newNode();
@@ -113,6 +168,28 @@ class Graph {
 
     void setLossNode(const std::string& name);
 
+    std::shared_ptr<Node> getLossNode();
+
+    // activation checkpointing, see checkpoint.h
+    // marking a node turns checkpointing on
+    void markCheckpoint(const std::string& name);
+
+    void setCheckpointing(bool checkpointing);
+
+    bool checkpointing();
+
+    // node ids in the order the forward pass runs them in while it frees activations as it goes (i.e. checkpointing)
+    // empty leaves it to the scheduler, adding or removing nodes clears it, see memory_order.h
+    void setExecutionOrder(const std::vector<int>& order);
+
+    const std::vector<int>& executionOrder();
+
+    // element type of every node in the graph (and in the graphs of its function calls)
+    // must be set before allocation, inputs and outputs are still exchanged as floats
+    void setDtype(DTYPE dtype);
+
+    DTYPE dtype();
+
     float getLoss();
 
     std::shared_ptr<Node> getNode(int id);
@@ -123,8 +200,35 @@ class Graph {
 
     void evaluate(std::unordered_map<std::string, std::vector<float>> inputs);
 
+    // partial evaluation
+    // only the nodes the requested outputs transitively depend on are allocated and computed
+    // an empty `outputs` falls back to the loss node
+    //
+    // inputs that don't feed any of the requested outputs are ignored
+    // with checkpointing on, the activations are freed as they would be in a full forward pass (see checkpoint.h)
+    void evaluate(std::unordered_map<std::string, std::vector<float>> inputs, const std::vector<std::string>& outputs);
+
+    // non-blocking evaluate and calculateGradient, run on the shared pool (see parallel.h)
+    // so the caller can get on with loading the next batch, writing checkpoints, etc.
+    //
+    // `on_node` is called with each node once it's done, its output going forward and its gradient going backward,
+    // from whichever thread finished it
+    //
+    // the graph must not be touched until the future is ready
+    std::future<void> evaluateAsync(std::unordered_map<std::string, std::vector<float>> inputs,
+                                    std::function<void(std::shared_ptr<Node>)> on_node = nullptr);
+
+    std::future<void> calculateGradientAsync(std::function<void(std::shared_ptr<Node>)> on_node = nullptr);
+
     void allocate();
 
+    // allocates only the dependencies of `outputs`
+    // anything left unallocated is picked up lazily by a later evaluate
+    void allocate(const std::vector<std::string>& outputs);
+
+    // ids of every node reachable from `outputs` through `children_`, the outputs included
+    std::set<int> dependencies(const std::vector<std::string>& outputs);
+
     void print();
 
     void serialize(const std::string& filepath);
@@ -143,16 +247,50 @@ class Graph {
 
     void reset();
 
+    // visits every node the loss depends on once all of its consumers have been visited
+    // independent nodes are visited concurrently, see scheduler.h
     void inverseTopologicalSort(std::function<void(std::shared_ptr<Node>)> visit_function);
 
     // topological sort for evaluate and allocate
     void topologicalSort(std::function<void(std::shared_ptr<Node>)> visit_function);
 
+    // same as above, but nodes outside of `subgraph` are never visited
+    // `subgraph` must be closed under `children_`, e.g. the result of Graph::dependencies
+    void topologicalSort(std::function<void(std::shared_ptr<Node>)> visit_function, const std::set<int>& subgraph);
+
+    // topological order, but independent nodes are visited concurrently, see scheduler.h
+    // `visit_function` must be safe to call on different nodes at the same time
+    void parallelTopologicalSort(std::function<void(std::shared_ptr<Node>)> visit_function);
+
+    void parallelTopologicalSort(std::function<void(std::shared_ptr<Node>)> visit_function,
+                                 const std::set<int>& subgraph);
+
     // NOTE: this will probably have to change
     //       as it works only under the assumption
     //       that functions/graphs return only one output
     std::shared_ptr<Node> getHead();
 
+    // graph surgery for the optimization passes
+    //
+    // creates an operation node wired directly to `arguments`
+    // unlike createVariable, arguments are nodes rather than (possibly reassigned) variable names
+    std::shared_ptr<Node> createNode(const std::string& name, const std::string& operation_type,
+                                     const std::vector<std::shared_ptr<Node>>& arguments);
+
+    // child id -> every node in nodes_ that takes it as an input
+    std::map<int, std::vector<std::shared_ptr<Node>>> consumers();
+
+    // node id -> number of times it's consumed
+    // repeated arguments count separately, e.g. matmul(d, d) uses d twice
+    std::map<int, int> useCounts();
+
+    // points every consumer of `node` at `replacement` and drops `node` from the graph
+    // names that resolved to `node` (including the loss node) resolve to `replacement` afterwards
+    void replaceNode(std::shared_ptr<Node> node, std::shared_ptr<Node> replacement);
+
+    // drops `node` from nodes_; it's on the caller to make sure nothing consumes it
+    void removeNode(std::shared_ptr<Node> node);
+
     void listNodes();
 
     void printNodeValues();
@@ -173,6 +311,13 @@ class Graph {
     // keeping track of the input nodes without having to iterate the whole graph
     std::map<std::string, std::shared_ptr<Node>> inputs_;
 
+    void _load_inputs(const std::unordered_map<std::string, std::vector<float>>& inputs);
+
+    // the forward pass behind evaluate, `on_node` (if any) is called after each node is computed
+    void _compute(std::function<void(std::shared_ptr<Node>)> on_node);
+
+    void _topological_sort(std::function<void(std::shared_ptr<Node>)> visit_function, const std::set<int>* subgraph);
+
     std::shared_ptr<Node> _create_variable(const std::string& name, const std::string& operation_type,
                                            const std::vector<std::string>& arguments, bool trainable, bool is_const);
 
@@ -184,6 +329,16 @@ class Graph {
     std::map<std::string, std::string> alias_map_;
 
     int node_index_ = 0;
+
+    bool checkpointing_ = false;
+
+    // some nodes may be without buffers, left out of a partial allocation or freed while checkpointing,
+    // so the next forward pass allocates them before computing anything
+    bool unallocated_ = false;
+
+    DTYPE dtype_ = DTYPE::float32;
+
+    std::vector<int> execution_order_;
 };
 
 #endif
@@ -0,0 +1,151 @@
+#ifndef HALF
+#define HALF
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// 16-bit storage types
+//
+// these only store values, all arithmetic on them goes through float
+// e.g. `a + b` on two `bfloat16`s is a float addition, and assigning the result back rounds it to nearest even
+//
+// bfloat16 is the top half of a float32, so it has the same range with 8 bits of mantissa
+// float16 is IEEE half precision, 11 bits of mantissa but nothing past 65504
+//
+// float16 conversions use F16C when compiled with it enabled (e.g. -mf16c or -march=native)
+namespace half {
+
+inline uint32_t _bits(float x) {
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+
+    return bits;
+}
+
+inline float _float(uint32_t bits) {
+    float x;
+    std::memcpy(&x, &bits, sizeof(x));
+
+    return x;
+}
+
+inline uint16_t toBfloat16(float x) {
+    uint32_t bits = _bits(x);
+
+    // quiet the NaN instead of letting rounding carry it into infinity
+    if ((bits & 0x7fffffff) > 0x7f800000) {
+        return (bits >> 16) | 0x0040;
+    }
+
+    // round to nearest even
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return bits >> 16;
+}
+
+inline float fromBfloat16(uint16_t bits) {
+    return _float((uint32_t)bits << 16);
+}
+
+inline uint16_t toFloat16(float x) {
+#if defined(__F16C__)
+    return _cvtss_sh(x, _MM_FROUND_TO_NEAREST_INT);
+#else
+    uint32_t bits = _bits(x);
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7fffffff;
+
+    // NaN and infinity
+    if (magnitude >= 0x7f800000) {
+        return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x0200 : 0);
+    }
+
+    // past the largest half once rounded
+    if (magnitude >= 0x477ff000) {
+        return sign | 0x7c00;
+    }
+
+    // subnormal halves, the float is shifted down into place with the implicit bit made explicit
+    if (magnitude < 0x38800000) {
+        if (magnitude < 0x33000000) {
+            return sign;
+        }
+
+        int shift = 113 - (magnitude >> 23);
+        uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+
+        uint32_t half_bits = mantissa >> (shift + 13);
+        uint32_t remainder = mantissa & ((1u << (shift + 13)) - 1);
+        uint32_t halfway = 1u << (shift + 12);
+        if (remainder > halfway || (remainder == halfway && (half_bits & 1))) {
+            half_bits++;
+        }
+
+        return sign | half_bits;
+    }
+
+    // rebias the exponent from 127 to 15 and round the mantissa to nearest even
+    uint32_t half_bits = (magnitude - 0x38000000) >> 13;
+    uint32_t remainder = magnitude & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half_bits & 1))) {
+        half_bits++;
+    }
+
+    return sign | half_bits;
+#endif
+}
+
+inline float fromFloat16(uint16_t bits) {
+#if defined(__F16C__)
+    return _cvtsh_ss(bits);
+#else
+    uint32_t sign = (uint32_t)(bits & 0x8000) << 16;
+    uint32_t exponent = (bits >> 10) & 0x1f;
+    uint32_t mantissa = bits & 0x3ff;
+
+    if (exponent == 0x1f) {
+        return _float(sign | 0x7f800000 | (mantissa << 13));
+    }
+
+    if (exponent == 0) {
+        // zero or subnormal, 2^-24 per step
+        float value = mantissa * (1.f / 16777216.f);
+        return sign ? -value : value;
+    }
+
+    return _float(sign | ((exponent + 112) << 23) | (mantissa << 13));
+#endif
+}
+
+}  // namespace half
+
+struct bfloat16 {
+    uint16_t bits_;
+
+    bfloat16() = default;
+
+    bfloat16(float x) : bits_(half::toBfloat16(x)) {
+    }
+
+    operator float() const {
+        return half::fromBfloat16(bits_);
+    }
+};
+
+struct float16 {
+    uint16_t bits_;
+
+    float16() = default;
+
+    float16(float x) : bits_(half::toFloat16(x)) {
+    }
+
+    operator float() const {
+        return half::fromFloat16(bits_);
+    }
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef HOGWILD
+#define HOGWILD
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "graph.h"
+
+// lock-free asynchronous SGD (Hogwild)
+//
+// every worker owns a replica of the graph (see Graph::replicate) and loops: sample a batch, run the forward and
+// backward pass against whatever the parameters are at that moment, then apply its update straight to the shared
+// parameter buffers with relaxed stores, no locks and no barrier between workers
+//
+// workers read parameters while others are writing them, so a step's gradient can be computed against a mix of
+// old and new weights; that's the trade Hogwild makes, it pays off when updates are sparse enough to rarely collide
+//
+// staleness is how many updates other workers applied between a step reading the parameters and applying its own
+namespace hogwild {
+
+struct Report {
+    int steps_;
+
+    // the loss of every step, in the order the steps were started
+    std::vector<float> losses_;
+
+    double mean_staleness_;
+    int max_staleness_;
+};
+
+class Trainer {
+   public:
+    // `graph` must be allocated with its loss node set
+    // each of the `workers` replicas takes batches the size of the graph's declared inputs
+    Trainer(std::shared_ptr<Graph> graph, int workers);
+
+    // `steps` SGD steps split between the workers as they free up
+    // `sample` is never called by two workers at once, so it needn't be thread safe
+    Report run(std::function<std::unordered_map<std::string, std::vector<float>>()> sample, int steps,
+               float learning_rate);
+
+   private:
+    std::shared_ptr<Graph> graph_;
+
+    std::vector<std::shared_ptr<Graph>> replicas_;
+
+    // ids of the trainable nodes
+    std::vector<int> parameters_;
+
+    int batch_size_;
+};
+
+void printReport(const Report& report);
+
+}  // namespace hogwild
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef INFERENCE
+#define INFERENCE
+
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "graph.h"
+
+// concurrent inference over one set of weights
+//
+// a pool of execution contexts, each a forward-only replica of the graph (see Graph::replicate):
+// parameters are shared with the graph and never written, each context owns only its activations,
+// so serving memory grows with the activations per context rather than with the parameters
+//
+// any number of threads can call `evaluate` at once, each request borrows a free context for its duration
+// and waits for one if they're all busy
+namespace inference {
+
+class ContextPool {
+   public:
+    // `graph` must be allocated, `outputs` are the nodes requests get back
+    // only what `outputs` depend on is computed, see the partial Graph::evaluate
+    //
+    // nothing may train `graph` while the pool is in use
+    ContextPool(std::shared_ptr<Graph> graph, int contexts, const std::vector<std::string>& outputs);
+
+    // output name -> flat output values
+    std::unordered_map<std::string, std::vector<float>> evaluate(
+        const std::unordered_map<std::string, std::vector<float>>& inputs);
+
+    int size();
+
+    // bytes held by the shared parameters, counted once
+    size_t parameterBytes();
+
+    // bytes held by the activations of a single context
+    size_t contextBytes();
+
+   private:
+    std::shared_ptr<Graph> _acquire();
+
+    void _release(std::shared_ptr<Graph> context);
+
+    std::shared_ptr<Graph> graph_;
+
+    std::vector<std::string> outputs_;
+
+    std::vector<std::shared_ptr<Graph>> contexts_;
+
+    std::mutex mutex_;
+    std::condition_variable available_;
+    std::vector<std::shared_ptr<Graph>> free_;
+};
+
+}  // namespace inference
+
+#endif
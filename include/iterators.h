@@ -16,6 +16,9 @@ class IndexIterator {
 
     void increment();
 
+    // jumps to the `index`th position in iteration order
+    void seek(size_t index);
+
     bool end();
 
     size_t getIndex();
@@ -0,0 +1,45 @@
+#ifndef MATMUL_CHAIN
+#define MATMUL_CHAIN
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "graph.h"
+
+// matrix chain reordering
+//
+// a chain is a tree of matmul nodes where every internal matmul has exactly one consumer,
+// e.g. `matmul(matmul(A, B), C)` with `matmul(A, B)` used nowhere else
+//
+// the chain is flattened into its operands A_0 ... A_n-1, the cheapest parenthesization is found with the
+// classic O(n^3) dynamic program, and the tree is rebuilt in that order if it beats the original
+//
+// this needs the shapes figured out by `Graph::allocate`, so run it after allocation
+// the chain's head keeps its name, buffers and consumers; only the intermediates are replaced
+namespace matmul_chain {
+
+struct Report {
+    int chains_;
+    int rewritten_;
+
+    // multiply-adds, batch dimensions included
+    size_t flops_before_;
+    size_t flops_after_;
+};
+
+// cost[i][j] is the cheapest way to multiply operands i..j
+// split[i][j] is where that product is split, i.e. (i..split) @ (split + 1..j)
+//
+// `dims` has n + 1 entries, operand i being [dims[i], dims[i + 1]]
+// `batches[i][j]` is the number of matrices in the (broadcasted) product of operands i..j
+void optimalOrder(const std::vector<size_t>& dims, const std::vector<std::vector<size_t>>& batches,
+                  std::vector<std::vector<size_t>>& cost, std::vector<std::vector<int>>& split);
+
+Report run(std::shared_ptr<Graph> graph);
+
+void printReport(const Report& report);
+
+}  // namespace matmul_chain
+
+#endif
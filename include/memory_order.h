@@ -0,0 +1,54 @@
+#ifndef MEMORY_ORDER
+#define MEMORY_ORDER
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "graph.h"
+
+// memory-aware node ordering
+//
+// when activations are freed after their last consumer (the checkpointing forward pass, see checkpoint.h),
+// how many are alive at once depends on the order nodes run in; FIFO order tends to open up every branch of a
+// wide graph before closing any of them
+//
+// a few heuristics produce candidate topological orders, each is simulated with the shapes known after allocation
+// and the one with the lowest peak becomes the graph's execution order:
+// - fifo: Graph::topologicalSort's order
+// - depth first: the most recently readied node first, finishing a branch before starting the next
+// - greedy: the ready node freeing the most bytes net of what it allocates
+//
+// parameters and inputs are resident throughout and counted separately
+namespace memory_order {
+
+struct Report {
+    size_t resident_bytes_;
+
+    size_t fifo_peak_bytes_;
+    size_t depth_first_peak_bytes_;
+    size_t greedy_peak_bytes_;
+
+    std::string chosen_;
+    size_t chosen_peak_bytes_;
+};
+
+std::vector<int> fifo(std::shared_ptr<Graph> graph);
+
+std::vector<int> depthFirst(std::shared_ptr<Graph> graph);
+
+std::vector<int> greedy(std::shared_ptr<Graph> graph);
+
+// the most activation bytes alive at once running `order`
+size_t peakBytes(std::shared_ptr<Graph> graph, const std::vector<int>& order);
+
+// picks the order with the lowest peak and sets it as the graph's execution order
+// the graph should be allocated so every node's shape is known
+Report run(std::shared_ptr<Graph> graph);
+
+void printReport(const Report& report);
+
+}  // namespace memory_order
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef MIXED_PRECISION
+#define MIXED_PRECISION
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "graph.h"
+
+// mixed precision training
+//
+// the graph is stored in bfloat16 or float16 (see Graph::setDtype), halving the bytes every kernel moves, while
+// the kernels themselves accumulate in float32 (see half.h)
+//
+// the trainer keeps a float32 master copy of every trainable parameter; updates are applied to the masters and
+// only then rounded down into the graph, so updates smaller than the weights' half precision spacing aren't lost
+//
+// dynamic loss scaling: the backward pass is seeded with the current scale instead of 1 so small gradients don't
+// underflow in float16, and gradients are divided back down in float32 before the update
+// a step that produced any non-finite gradient is skipped and the scale halved,
+// every `growth_interval` clean steps in a row the scale is doubled
+namespace mixed_precision {
+
+struct Report {
+    int steps_;
+
+    // steps thrown away because of overflowing gradients
+    int skipped_;
+
+    float scale_;
+
+    size_t parameter_bytes_;
+    size_t master_bytes_;
+};
+
+class Trainer {
+   public:
+    // `graph` must be allocated with its loss node set
+    Trainer(std::shared_ptr<Graph> graph, float initial_scale, int growth_interval);
+
+    // one SGD step over `batch`, laid out the same way Graph::evaluate takes it
+    // returns the loss, skipped steps included
+    float step(const std::unordered_map<std::string, std::vector<float>>& batch, float learning_rate);
+
+    float scale();
+
+    Report report();
+
+   private:
+    // false if any trainable gradient overflowed
+    bool _finite();
+
+    std::shared_ptr<Graph> graph_;
+
+    // trainable node id -> float32 copy of its weights
+    std::map<int, std::shared_ptr<GraphBuffer>> masters_;
+
+    float scale_;
+    int growth_interval_;
+
+    // clean steps since the scale last changed
+    int good_steps_;
+
+    int steps_;
+    int skipped_;
+
+    int batch_size_;
+};
+
+void printReport(const Report& report);
+
+}  // namespace mixed_precision
+
+#endif
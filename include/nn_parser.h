@@ -105,6 +105,8 @@ class NNParser {
 
     std::string registerFunctionDefinition(std::string function_name, const std::string& contents);
 
+    void registerCheckpoint(std::shared_ptr<Graph> graph, const std::string& contents);
+
     std::string buffer_;
 
     size_t content_size_;
@@ -119,8 +121,11 @@ class NNParser {
     const std::string variable_declarator_ = "var";
     const std::string function_declarator_ = "function";
 
+    // `checkpoint x` keeps x's current value through the forward pass, see checkpoint.h
+    const std::string checkpoint_declarator_ = "checkpoint";
+
     const std::set<std::string> keywords = {variable_declarator_, function_declarator_, constant_declarator_,
-                                            const_declarator_};
+                                            const_declarator_, checkpoint_declarator_};
 
     std::set<std::string> registered_variables_;
     std::map<std::string, std::shared_ptr<Graph>> registered_functions_;
@@ -0,0 +1,49 @@
+#ifndef NORMALIZATION
+#define NORMALIZATION
+
+#include <memory>
+
+#include "buffer.h"
+#include "graph.h"
+
+// layer and rms normalization over the last dimension, with their scale and shift fused in
+//
+// each row's mean and variance come from a single Welford pass, a running mean per vector lane with the lanes
+// merged at the end, which doesn't lose the variance to cancellation the way sum and sum of squares can
+// a second pass writes (x - mean) * rstd * gamma + beta, where rstd = 1 / sqrt(variance + EPSILON)
+// rms normalization is the same without the mean, rstd coming from the mean of squares, and without a shift
+//
+// each row's mean and rstd are kept on the node (`Node::saved_`), so the backward pass rebuilds the normalized row
+// from them and the input instead of keeping it, in two passes per row
+// rows are split across threads and walked with vectors
+//
+// in a graph they're the `layer_norm` and `rms_norm` operations, e.g.
+//      var gamma = ones(512)
+//      var beta = tensor(512)
+//      let h = layer_norm(x, gamma, beta);
+//      let h = rms_norm(x, gamma);
+// gamma and beta hold one value per element of the last dimension
+namespace normalization {
+
+enum class Norm { layer, rms };
+
+// `x` normalized over its last dimension, scaled by `gamma` and shifted by `beta` (ignored for rms) into `out`
+// each row's mean and rstd go into `stats`, two values per row in float32 (float64 for float64 inputs)
+void normalize(Norm norm, std::shared_ptr<Buffer> x, std::shared_ptr<Buffer> gamma, std::shared_ptr<Buffer> beta,
+               std::shared_ptr<Buffer> out, std::shared_ptr<Buffer> stats);
+
+// gradients of the normalization with respect to `x`, `gamma` and `beta` (ignored for rms) given the output's
+// gradient `upstream` and the `stats` kept by `normalize`
+void normalizeGradient(Norm norm, std::shared_ptr<Buffer> x, std::shared_ptr<Buffer> gamma,
+                       std::shared_ptr<Buffer> stats, std::shared_ptr<Buffer> upstream,
+                       std::shared_ptr<Buffer> x_gradient, std::shared_ptr<Buffer> gamma_gradient,
+                       std::shared_ptr<Buffer> beta_gradient);
+
+// allocation, kernel and gradient behind the normalization operations
+void allocate(std::shared_ptr<Node> node);
+void forward(std::shared_ptr<Node> node);
+void backward(std::shared_ptr<Node> node);
+
+}  // namespace normalization
+
+#endif
@@ -82,6 +82,7 @@ REGISTER_OPERATION(divide);
 
 REGISTER_OPERATION(sqrt);
 REGISTER_OPERATION(exp);
+REGISTER_OPERATION(ln);
 REGISTER_OPERATION(pow);
 
 REGISTER_OPERATION(matmul);
@@ -90,6 +91,35 @@ REGISTER_OPERATION(conv2d);  // conv2d(input_image, kernel)
 REGISTER_OPERATION(sigmoid);
 REGISTER_OPERATION(relu);
 
+// reduce_x(x) or reduce_x(x, axes...), see reduction.h
 REGISTER_OPERATION(reduce_sum);
+REGISTER_OPERATION(reduce_mean);
+REGISTER_OPERATION(reduce_max);
+
+// softmax(x) over the last dimension, softmax_cross_entropy(logits, labels), see softmax.h
+REGISTER_OPERATION(softmax);
+REGISTER_OPERATION(softmax_cross_entropy);
+
+// layer_norm(x, gamma, beta) and rms_norm(x, gamma) over the last dimension, see normalization.h
+REGISTER_OPERATION(layer_norm);
+REGISTER_OPERATION(rms_norm);
+
+// zero-copy views of their first argument, see views.h
+REGISTER_OPERATION(transpose);  // transpose(x) or transpose(x, axes...)
+REGISTER_OPERATION(reshape);    // reshape(x, shape...)
+REGISTER_OPERATION(slice);      // slice(x, axis, begin, end)
+REGISTER_OPERATION(expand);     // expand(x, shape...)
+REGISTER_OPERATION(squeeze);    // squeeze(x) or squeeze(x, axis)
+
+// created by the element-wise fusion pass, see fusion.h
+REGISTER_OPERATION(fused);
+
+// created by the dense fusion pass, see dense.h
+REGISTER_OPERATION(dense);          // dense(x, w, bias)
+REGISTER_OPERATION(dense_relu);     // dense_relu(x, w, bias)
+REGISTER_OPERATION(dense_sigmoid);  // dense_sigmoid(x, w, bias)
+
+// created by the int8 quantization pass, see quantize.h
+REGISTER_OPERATION(qmatmul);  // qmatmul(x) or qmatmul(x, bias)
 
 #endif  // OPS_H
@@ -0,0 +1,45 @@
+#ifndef PACKING
+#define PACKING
+
+#include <memory>
+#include <mutex>
+
+#include "gemm.h"
+#include "graph.h"
+
+// packed weight cache
+//
+// a parameter multiplied as the right operand of a matmul or dense layer is packed into gemm panels (see gemm::pack)
+// the first time it's used and then reused, instead of being packed again by every product;
+// its transpose is packed the same way for the input gradient of the backward pass
+//
+// products against a packed operand fold the batch into the rows of a single gemm and skip packing B altogether
+//
+// the packs are dropped whenever the weights may have changed, i.e. the output's version moved (see Buffer::version),
+// so writes from anywhere (optimizers, loaders, setValue) are picked up without having to call `invalidate`
+// replicas share their parameters' caches along with the weights, see Graph::replicate
+namespace packing {
+
+struct Cache {
+    std::mutex mutex_;
+
+    // the output buffer and version the packs were made from, a new buffer or a write means packing again
+    const void* source_ = nullptr;
+    size_t version_ = 0;
+
+    std::shared_ptr<gemm::PackedB> b_;
+    std::shared_ptr<gemm::PackedB> transposed_;
+};
+
+// float32 [k x n] parameters that are allocated
+bool packable(std::shared_ptr<Node> node);
+
+// `node`'s weights packed as B, or as B^T with `transposed`, packing them if they aren't already
+std::shared_ptr<gemm::PackedB> get(std::shared_ptr<Node> node, bool transposed);
+
+// drops the packs, e.g. to free them
+void invalidate(std::shared_ptr<Node> node);
+
+}  // namespace packing
+
+#endif
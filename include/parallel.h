@@ -0,0 +1,123 @@
+#ifndef PARALLEL
+#define PARALLEL
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// intra-op parallelism
+//
+// a process-wide work-stealing pool: every worker owns a deque, pushes and pops its own work at the back,
+// and steals from the front of everyone else's when it runs dry
+//
+// threads waiting on work they handed out (including the caller of `parallelFor`) run queued tasks in the meantime,
+// so nesting `parallelFor` inside a kernel that's already running on the pool can't deadlock
+//
+// the thread count defaults to the `HIVE_THREADS` environment variable, falling back to the hardware concurrency
+namespace parallel {
+
+class ThreadPool {
+   public:
+    // `threads` counts the calling thread, so `threads - 1` workers are spawned
+    ThreadPool(int threads);
+
+    ~ThreadPool();
+
+    int size();
+
+    void submit(std::function<void()> task);
+
+    // runs one queued task on the calling thread, false if there was nothing to run
+    bool runPending();
+
+   private:
+    struct _Queue {
+        std::mutex mutex_;
+        std::deque<std::function<void()>> tasks_;
+    };
+
+    void _work(int index);
+
+    bool _pop(int index, std::function<void()>& task);
+
+    int threads_;
+
+    std::vector<std::unique_ptr<_Queue>> queues_;
+    std::vector<std::thread> workers_;
+
+    // round robin target for tasks submitted from outside the pool
+    std::atomic<size_t> next_queue_;
+
+    std::atomic<int> queued_;
+    std::atomic<bool> stop_;
+
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+};
+
+// while one of these is alive, `parallelFor` calls made by the constructing thread run inline on it
+class SerialScope {
+   public:
+    SerialScope();
+
+    ~SerialScope();
+};
+
+bool serial();
+
+// must not be called while the pool is in use
+void setThreadCount(int threads);
+
+int threadCount();
+
+ThreadPool& pool();
+
+// elements handed to a thread at a time by the element-wise and row-wise kernels,
+// enough work to be worth handing out, few enough that a typical activation still splits across threads
+static const size_t GRAIN = 4096;
+
+// the range split into chunks of at least `grain` elements, at most a few per thread
+size_t chunkSize(size_t size, size_t grain);
+
+// `body(first, last)` over chunks of [begin, end), returns once every chunk is done
+//
+// ranges smaller than two grains run inline on the calling thread
+void parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+// `body(first, last, identity)` reduces one chunk, the chunk results are combined in order
+// so the result doesn't depend on scheduling, only on the thread count
+template <typename T>
+T parallelReduce(size_t begin, size_t end, size_t grain, T identity, const std::function<T(size_t, size_t, T)>& body,
+                 const std::function<T(T, T)>& combine) {
+    if (end <= begin) {
+        return identity;
+    }
+
+    size_t chunk = chunkSize(end - begin, grain);
+    size_t chunks = (end - begin + chunk - 1) / chunk;
+
+    std::vector<T> partials(chunks, identity);
+    parallelFor(0, chunks, 1, [&](size_t first, size_t last) {
+        for (size_t c = first; c < last; c++) {
+            partials[c] = body(begin + c * chunk, std::min(end, begin + (c + 1) * chunk), identity);
+        }
+    });
+
+    T result = identity;
+    for (const T& partial : partials) {
+        result = combine(result, partial);
+    }
+
+    return result;
+}
+
+}  // namespace parallel
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef QUANTIZE
+#define QUANTIZE
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gemm.h"
+#include "graph.h"
+
+// int8 post-training quantization for inference
+//
+// `matmul(x, w)` and the dense layers (see dense.h) with a parameter for `w` are rewritten into `qmatmul` nodes
+// that hold w as int8 with one scale per output column, a quarter of its float32 size
+//
+// x is quantized to uint8 with a scale and zero point picked by calibration (min/max over a sample of batches),
+// the product is accumulated in int32 and dequantized in the gemm epilogue along with the bias and activation
+// (see gemm::qgemm), so x, w and the result are still float32 as far as the rest of the graph can tell
+//
+// quantized graphs are float32 and forward only; calculateGradient on a `qmatmul` is an error
+// conv2d isn't a gemm here and stays float32
+namespace quantize {
+
+// a quantized weight matrix, stored transposed: [n x k], one row per output column
+struct Weights {
+    int k_;
+    int n_;
+
+    std::vector<int8_t> data_;
+
+    // per output column, w[p][j] ~= data_[j * k_ + p] * scales_[j]
+    std::vector<float> scales_;
+
+    // per output column, data_ summed over k, for taking the input's zero point back out
+    std::vector<int32_t> sums_;
+
+    // x ~= (q - input_zero_point_) * input_scale_
+    float input_scale_;
+    uint8_t input_zero_point_;
+
+    // carried over from the dense layer that was quantized, if any
+    gemm::Activation activation_;
+};
+
+struct Range {
+    float min_;
+    float max_;
+};
+
+// node id of each quantizable layer -> range its input was seen to take during calibration
+struct Calibration {
+    std::map<int, Range> ranges_;
+    int batches_;
+};
+
+struct Report {
+    int layers_;
+
+    size_t float_bytes_;
+    size_t quantized_bytes_;
+
+    // quantizable layers left alone for lack of calibration data
+    int uncalibrated_;
+};
+
+// runs `batches` batches from `sample` through the forward pass (Graph::evaluateAsync),
+// e.g. `[&] { return dataset.sample(32); }`
+// `graph` must be allocated, calibrate after loading the weights and before quantizing
+Calibration calibrate(std::shared_ptr<Graph> graph,
+                      std::function<std::unordered_map<std::string, std::vector<float>>()> sample, int batches);
+
+// rewrites every calibrated layer, weights nothing else reads are dropped from the graph
+Report run(std::shared_ptr<Graph> graph, const Calibration& calibration);
+
+void printReport(const Report& report);
+
+// symmetric per column quantization of a row-major [k x n] matrix, the activation scale is left unset
+std::shared_ptr<Weights> quantizeWeights(const float* w, int k, int n);
+
+// bytes held by the int8 weights and their per column scales and sums
+size_t bytes(const Weights& weights);
+
+// kernel behind the qmatmul operation
+void forward(std::shared_ptr<Node> node);
+
+}  // namespace quantize
+
+#endif
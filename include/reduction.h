@@ -0,0 +1,47 @@
+#ifndef REDUCTION
+#define REDUCTION
+
+#include <memory>
+#include <vector>
+
+#include "buffer.h"
+#include "graph.h"
+
+// reductions over any set of axes
+//
+// the input is split into runs of dimensions that are either all reduced or all kept, then
+// - a reduced innermost run is reduced a line at a time, with several vector accumulators
+// - a kept innermost run has whole rows combined column by column into a row of accumulators held in L1
+// sums are taken pairwise, halving long lines and adding rows in blocks, so their rounding error grows with the log
+// of the length rather than the length, and accumulate in float32 for the half precision dtypes
+// outputs (or output columns) are split across threads, a single full reduction is split along its length
+//
+// in a graph they're the `reduce_sum`, `reduce_mean` and `reduce_max` operations, e.g.
+//      let loss = reduce_sum(x);        // everything, into a single value
+//      let y = reduce_mean(x, 1);       // over axis 1, kept as a dimension of 1
+//      let y = reduce_max(x, 0, -1);    // negative axes count from the end
+// reduced axes stay around as 1s so the result broadcasts back against the input, `squeeze` drops them
+namespace reduction {
+
+enum class Op { sum, mean, max, min, l2 };
+
+// `a` reduced over `axes` into `out`, which holds a's kept dimensions in order, either with the reduced ones as 1s
+// or dropped, and has to be contiguous
+// `accumulate` adds the result onto what's already in `out` instead of overwriting it
+void reduce(Op op, std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, const std::vector<int>& axes,
+            bool accumulate);
+
+// every element of `a`
+double reduce(Op op, std::shared_ptr<Buffer> a);
+
+// `shape` with `axes` reduced to 1s
+std::vector<int> reducedShape(const std::vector<int>& shape, const std::vector<int>& axes);
+
+// allocation, kernel and gradient behind the reduction operations
+void allocate(std::shared_ptr<Node> node);
+void forward(std::shared_ptr<Node> node);
+void backward(std::shared_ptr<Node> node);
+
+}  // namespace reduction
+
+#endif
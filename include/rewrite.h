@@ -0,0 +1,49 @@
+#ifndef REWRITE
+#define REWRITE
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "graph.h"
+
+// algebraic simplification of a parsed graph
+//
+// this is meant to run between `NNParser::parse` and `Graph::allocate`,
+// though none of the default rules change shapes so running it on an allocated graph is fine too
+//
+// every rule rewrites the forward expression into one whose registered gradient
+// computes the same derivative, so there's no separate gradient rewriting to do
+namespace rewrite {
+
+struct Rule {
+    std::string name_;
+
+    // returns true if the rule matched `node` and the graph was changed
+    std::function<bool(std::shared_ptr<Graph>, std::shared_ptr<Node>)> apply_;
+};
+
+// rule name -> number of times it fired
+typedef std::map<std::string, int> Report;
+
+// pow(x, 2)                       -> multiply(x, x)
+// pow(x, 0.5)                     -> sqrt(x)
+// multiply(x, 1), divide(x, 1)    -> x
+// add(x, 0), subtract(x, 0)       -> x
+// subtract(0, subtract(0, x))     -> x
+// exp(ln(x)), ln(exp(x))          -> x
+std::vector<Rule> defaultRules();
+
+// applies `rules` until none of them match anymore
+// nodes that only existed to feed a rewritten expression are dropped from the graph afterwards
+Report run(std::shared_ptr<Graph> graph, const std::vector<Rule>& rules);
+
+Report run(std::shared_ptr<Graph> graph);
+
+void printReport(const Report& report);
+
+}  // namespace rewrite
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef SCHEDULER
+#define SCHEDULER
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "graph.h"
+
+// inter-op parallelism
+//
+// every node gets an atomic counter of the nodes it's waiting on, its children going forward and its consumers
+// going backward; whichever thread finishes the last of those readies the node
+//
+// a thread keeps one of the nodes it readied for itself and hands the rest to the pool (see parallel.h),
+// so independent branches run side by side
+//
+// a rough cost model decides how each node runs:
+// - cheap nodes (constants, small element-wise ops) run right away on the thread that readied them
+// - nodes under the intra-op threshold run single threaded, several of them at once
+// - anything bigger is free to split its kernel across the pool as well
+//
+// with a single thread, or inside a parallel::SerialScope, this is plain Kahn's algorithm
+namespace scheduler {
+
+// roughly how many scalar operations the node's kernel performs
+size_t cost(std::shared_ptr<Node> node);
+
+// visits each of `nodes` once all of its children among `nodes` have been visited
+void forward(const std::vector<std::shared_ptr<Node>>& nodes, std::function<void(std::shared_ptr<Node>)> visit);
+
+// visits each of `nodes` once all of its consumers among `nodes` have been visited
+//
+// consumers sharing a child can finish concurrently, so writes to a shared child's gradient are serialized
+// by locking that child for the duration of each consumer's visit
+void backward(const std::vector<std::shared_ptr<Node>>& nodes, std::function<void(std::shared_ptr<Node>)> visit);
+
+}  // namespace scheduler
+
+#endif
@@ -0,0 +1,292 @@
+#ifndef SIMD
+#define SIMD
+
+// thin wrappers over whichever vector extension the build targets
+//
+// AVX when compiled with it enabled (e.g. -mavx2 -mfma or -march=native),
+// SSE otherwise on x86-64 since it's part of the baseline,
+// and plain scalars everywhere else
+//
+// kernels are written once against `simd::vec` and `simd::WIDTH`
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#else
+#include <cmath>
+#endif
+
+namespace simd {
+
+#if defined(__AVX__)
+
+typedef __m256 vec;
+static const int WIDTH = 8;
+
+inline vec load(const float* p) {
+    return _mm256_loadu_ps(p);
+}
+
+inline void store(float* p, vec v) {
+    _mm256_storeu_ps(p, v);
+}
+
+inline vec broadcast(float x) {
+    return _mm256_set1_ps(x);
+}
+
+inline vec zero() {
+    return _mm256_setzero_ps();
+}
+
+inline vec add(vec a, vec b) {
+    return _mm256_add_ps(a, b);
+}
+
+inline vec sub(vec a, vec b) {
+    return _mm256_sub_ps(a, b);
+}
+
+inline vec mul(vec a, vec b) {
+    return _mm256_mul_ps(a, b);
+}
+
+inline vec div(vec a, vec b) {
+    return _mm256_div_ps(a, b);
+}
+
+inline vec max(vec a, vec b) {
+    return _mm256_max_ps(a, b);
+}
+
+inline vec min(vec a, vec b) {
+    return _mm256_min_ps(a, b);
+}
+
+// a * b + c
+inline vec fmadd(vec a, vec b, vec c) {
+#if defined(__FMA__)
+    return _mm256_fmadd_ps(a, b, c);
+#else
+    return _mm256_add_ps(_mm256_mul_ps(a, b), c);
+#endif
+}
+
+// 1 where x > 0, 0 elsewhere
+inline vec step(vec x) {
+    return _mm256_and_ps(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_set1_ps(1));
+}
+
+inline float sum(vec v) {
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+
+    return _mm_cvtss_f32(half);
+}
+
+// e^x to within about an ulp, inputs are clamped to where it neither overflows nor goes subnormal
+// x = n ln2 + r with |r| <= ln2 / 2, e^r from a polynomial and 2^n put straight into the exponent bits
+inline vec exp(vec x) {
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.3365f)), _mm256_set1_ps(88.3762f));
+
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)), _MM_FROUND_TO_NEAREST_INT);
+    __m256 r = _mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(0.693359375f)));
+    r = _mm256_sub_ps(r, _mm256_mul_ps(n, _mm256_set1_ps(-2.12194440e-4f)));
+
+    __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+    p = fmadd(p, r, _mm256_set1_ps(1.3981999507e-3f));
+    p = fmadd(p, r, _mm256_set1_ps(8.3334519073e-3f));
+    p = fmadd(p, r, _mm256_set1_ps(4.1665795894e-2f));
+    p = fmadd(p, r, _mm256_set1_ps(1.6666665459e-1f));
+    p = fmadd(p, r, _mm256_set1_ps(5.0000001201e-1f));
+    p = fmadd(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1)));
+
+    __m256i e = _mm256_cvtps_epi32(_mm256_add_ps(n, _mm256_set1_ps(127)));
+#if defined(__AVX2__)
+    e = _mm256_slli_epi32(e, 23);
+#else
+    __m128i low = _mm_slli_epi32(_mm256_castsi256_si128(e), 23);
+    __m128i high = _mm_slli_epi32(_mm256_extractf128_si256(e, 1), 23);
+    e = _mm256_insertf128_si256(_mm256_castsi128_si256(low), high, 1);
+#endif
+
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+// a WIDTH x WIDTH block held a row per vector, turned so each vector holds a column
+inline void transpose(vec* rows) {
+    __m256 t[8];
+    for (int i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_ps(rows[i], rows[i + 1]);
+        t[i + 1] = _mm256_unpackhi_ps(rows[i], rows[i + 1]);
+    }
+
+    __m256 s[8];
+    for (int i = 0; i < 8; i += 4) {
+        s[i] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(1, 0, 1, 0));
+        s[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(3, 2, 3, 2));
+        s[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(1, 0, 1, 0));
+        s[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(3, 2, 3, 2));
+    }
+
+    for (int i = 0; i < 4; i++) {
+        rows[i] = _mm256_permute2f128_ps(s[i], s[i + 4], 0x20);
+        rows[i + 4] = _mm256_permute2f128_ps(s[i], s[i + 4], 0x31);
+    }
+}
+
+#elif defined(__SSE2__)
+
+typedef __m128 vec;
+static const int WIDTH = 4;
+
+inline vec load(const float* p) {
+    return _mm_loadu_ps(p);
+}
+
+inline void store(float* p, vec v) {
+    _mm_storeu_ps(p, v);
+}
+
+inline vec broadcast(float x) {
+    return _mm_set1_ps(x);
+}
+
+inline vec zero() {
+    return _mm_setzero_ps();
+}
+
+inline vec add(vec a, vec b) {
+    return _mm_add_ps(a, b);
+}
+
+inline vec sub(vec a, vec b) {
+    return _mm_sub_ps(a, b);
+}
+
+inline vec mul(vec a, vec b) {
+    return _mm_mul_ps(a, b);
+}
+
+inline vec div(vec a, vec b) {
+    return _mm_div_ps(a, b);
+}
+
+inline vec max(vec a, vec b) {
+    return _mm_max_ps(a, b);
+}
+
+inline vec min(vec a, vec b) {
+    return _mm_min_ps(a, b);
+}
+
+inline vec fmadd(vec a, vec b, vec c) {
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+
+inline vec step(vec x) {
+    return _mm_and_ps(_mm_cmpgt_ps(x, _mm_setzero_ps()), _mm_set1_ps(1));
+}
+
+inline float sum(vec v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+
+    return _mm_cvtss_f32(v);
+}
+
+inline vec exp(vec x) {
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-87.3365f)), _mm_set1_ps(88.3762f));
+
+    // converting rounds to nearest
+    __m128i k = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.44269504f)));
+    __m128 n = _mm_cvtepi32_ps(k);
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(0.693359375f)));
+    r = _mm_sub_ps(r, _mm_mul_ps(n, _mm_set1_ps(-2.12194440e-4f)));
+
+    __m128 p = _mm_set1_ps(1.9875691500e-4f);
+    p = fmadd(p, r, _mm_set1_ps(1.3981999507e-3f));
+    p = fmadd(p, r, _mm_set1_ps(8.3334519073e-3f));
+    p = fmadd(p, r, _mm_set1_ps(4.1665795894e-2f));
+    p = fmadd(p, r, _mm_set1_ps(1.6666665459e-1f));
+    p = fmadd(p, r, _mm_set1_ps(5.0000001201e-1f));
+    p = fmadd(p, _mm_mul_ps(r, r), _mm_add_ps(r, _mm_set1_ps(1)));
+
+    return _mm_mul_ps(p, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(k, _mm_set1_epi32(127)), 23)));
+}
+
+inline void transpose(vec* rows) {
+    _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+}
+
+#else
+
+typedef float vec;
+static const int WIDTH = 1;
+
+inline vec load(const float* p) {
+    return *p;
+}
+
+inline void store(float* p, vec v) {
+    *p = v;
+}
+
+inline vec broadcast(float x) {
+    return x;
+}
+
+inline vec zero() {
+    return 0;
+}
+
+inline vec add(vec a, vec b) {
+    return a + b;
+}
+
+inline vec sub(vec a, vec b) {
+    return a - b;
+}
+
+inline vec mul(vec a, vec b) {
+    return a * b;
+}
+
+inline vec div(vec a, vec b) {
+    return a / b;
+}
+
+inline vec max(vec a, vec b) {
+    return a > b ? a : b;
+}
+
+inline vec min(vec a, vec b) {
+    return a < b ? a : b;
+}
+
+inline vec fmadd(vec a, vec b, vec c) {
+    return a * b + c;
+}
+
+inline vec step(vec x) {
+    return x > 0 ? 1 : 0;
+}
+
+inline float sum(vec v) {
+    return v;
+}
+
+inline vec exp(vec x) {
+    return std::exp(x);
+}
+
+inline void transpose(vec* rows) {
+}
+
+#endif
+
+}  // namespace simd
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef SOFTMAX
+#define SOFTMAX
+
+#include <memory>
+
+#include "buffer.h"
+#include "graph.h"
+
+// softmax over the last dimension, and cross entropy against it fused into a single loss
+//
+// each row's max and sum of exponentials are found together in one pass, the running sum being rescaled whenever
+// the max moves, so nothing is exponentiated before it's shifted below 0 and nothing overflows
+// a second pass writes the normalized row, and the loss needs none: it's logsumexp(x) minus the labels' dot with x
+// rows are split across threads and each is walked with vectors, the exponentials from simd::exp
+//
+// in a graph they're the `softmax` and `softmax_cross_entropy` operations, e.g.
+//      let p = softmax(logits);
+//      let l = softmax_cross_entropy(logits, labels);   // one loss per row, [.., 1]
+//      let loss = reduce_mean(l);
+// the loss's gradient is softmax(logits) - labels, recomputed from the logits when it's needed rather than kept from
+// the forward pass; labels get no gradient
+namespace softmax {
+
+// softmax of each row of `x` into `out`, which can be `x` itself
+void softmax(std::shared_ptr<Buffer> x, std::shared_ptr<Buffer> out);
+
+// -sum(labels * log(softmax(logits))) for each row into `out`, one value per row
+// `labels` are distributions over each row, e.g. one-hot
+void crossEntropy(std::shared_ptr<Buffer> logits, std::shared_ptr<Buffer> labels, std::shared_ptr<Buffer> out);
+
+// the cross entropy's gradient with respect to `logits` into `out`, scaled by each row's value in `upstream`
+void crossEntropyGradient(std::shared_ptr<Buffer> logits, std::shared_ptr<Buffer> labels,
+                          std::shared_ptr<Buffer> upstream, std::shared_ptr<Buffer> out);
+
+// allocation, kernel and gradient behind the softmax operations
+void allocate(std::shared_ptr<Node> node);
+void forward(std::shared_ptr<Node> node);
+void backward(std::shared_ptr<Node> node);
+
+}  // namespace softmax
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef VIEWS
+#define VIEWS
+
+#include <memory>
+#include <vector>
+
+#include "buffer.h"
+#include "graph.h"
+
+// zero-copy tensor views
+//
+// a view is a GraphBuffer over another buffer's data with its own shape, strides and starting offset (see buffer.h),
+// so transposing, reshaping, slicing, expanding and squeezing only ever touch metadata
+//
+// in a graph they're the `transpose`, `reshape`, `slice`, `expand` and `squeeze` operations, e.g.
+//      let y = transpose(x);           // swaps the last two dimensions
+//      let y = transpose(x, 2, 0, 1);  // any permutation
+//      let y = reshape(x, 8, 16);
+//      let y = slice(x, 1, 0, 4);      // slice(x, axis, begin, end), end excluded
+//      let y = expand(x, 32, 16);      // dimensions of 1 are repeated up to the given shape
+//      let y = squeeze(x);             // drops every dimension of 1, or just the one given
+//
+// kernels read most operands as flat arrays, only a few read them through their strides:
+// the broadcasting element-wise kernels (add, subtract, multiply), matmul for operands that are transposes of their
+// last two dimensions (read with gemm's transpose flags), and other views
+// a view node any other consumer reads is copied out into a buffer of its own as it's computed,
+// this is decided as the consumers are allocated (see `accepts`)
+namespace views {
+
+// axes in `permutation` order
+std::shared_ptr<GraphBuffer> transpose(std::shared_ptr<Buffer> a, const std::vector<int>& permutation);
+
+// same elements in the same order, `a` is copied first if it isn't contiguous
+std::shared_ptr<GraphBuffer> reshape(std::shared_ptr<Buffer> a, const std::vector<int>& shape);
+
+// [begin, end) of `axis`
+std::shared_ptr<GraphBuffer> slice(std::shared_ptr<Buffer> a, int axis, int begin, int end);
+
+// broadcasts dimensions of 1 up to `shape`, leading dimensions can be added
+std::shared_ptr<GraphBuffer> expand(std::shared_ptr<Buffer> a, const std::vector<int>& shape);
+
+// drops `axis`, which must be a dimension of 1, or every dimension of 1 with an axis of -1
+std::shared_ptr<GraphBuffer> squeeze(std::shared_ptr<Buffer> a, int axis);
+
+// `a` is the transpose of its last two dimensions over contiguous data, i.e. reading it as row-major [.., n x m]
+// and flipping gemm's transpose flag gives it back
+bool transposed(std::shared_ptr<Buffer> a);
+
+// element-wise copy between buffers of the same shape and dtype, either one can be strided
+// when the two are laid out along different dimensions, e.g. materializing a transpose, it's done as a blocked
+// transpose
+void copy(std::shared_ptr<Buffer> from, std::shared_ptr<Buffer> to);
+
+// `a` if it's contiguous, otherwise a contiguous copy of it
+std::shared_ptr<GraphBuffer> contiguous(std::shared_ptr<GraphBuffer> a);
+
+// `node` is one of the view operations
+bool isView(std::shared_ptr<Node> node);
+
+// `consumer` can read `child`'s output as is
+bool accepts(std::shared_ptr<Node> consumer, std::shared_ptr<Node> child);
+
+// has the view node `node` copy its view into a buffer of its own from now on
+void materialize(std::shared_ptr<Node> node);
+
+// allocation, kernel and gradient behind the view operations
+void allocate(std::shared_ptr<Node> node);
+void forward(std::shared_ptr<Node> node);
+void backward(std::shared_ptr<Node> node);
+
+}  // namespace views
+
+#endif
@@ -3,14 +3,19 @@
 
 #include "buffer_ops.h"
 #include "data/csv.h"
+#include "dense.h"
 #include "dtypes.h"
+#include "fusion.h"
 #include "generation_utils.h"
 #include "graph.h"
 #include "iterators.h"
 #include "kernel.h"
 #include "logging.h"
+#include "matmul_chain.h"
 #include "metrics.h"
 #include "nn_parser.h"
+#include "quantize.h"
+#include "rewrite.h"
 #include "string_utils.h"
 
 using namespace std;
@@ -282,6 +287,122 @@ void denseLayerTest() {
     i->printOutput(cout);
 }
 
+// only `final_output` and its dependencies are allocated and computed
+// the `label` input and the `mse` branch are never touched
+void partialEvaluateTest() {
+    const string model_path = "./nn/mlp.nn";
+    const string contents = nn_parser::readFile(model_path);
+
+    nn_parser::NNParser parser(contents);
+    std::shared_ptr<Graph> g = parser.parse(contents);
+    g->allocate({"final_output"});
+
+    const string dataset_path = "./data/sine.csv";
+    vector<string> inputs = {"t"};
+    vector<string> outputs = {"sine_value"};
+
+    CSVDataset dataset = CSVDataset(dataset_path, inputs, outputs);
+
+    g->evaluate(dataset.sample(32), {"final_output"});
+
+    cout << "final_output " << endl;
+    g->getNode("final_output")->printOutput(cout);
+
+    cout << "mse allocated: " << (g->getNode("mse")->output_ != nullptr ? "true" : "false") << endl;
+}
+
+void rewriteTest() {
+    const string filepath = "./nn/mlp.nn";
+    const string contents = nn_parser::readFile(filepath);
+
+    nn_parser::NNParser parser(contents);
+    std::shared_ptr<Graph> g = parser.parse(contents);
+
+    // mse = pow(subtract(label, final_output), 2) becomes a multiply
+    rewrite::printReport(rewrite::run(g));
+
+    g->allocate();
+    g->print();
+}
+
+// D = (A @ B) @ C with A [64, 2], B [2, 64], C [64, 1]
+// reordered as A @ (B @ C), the [64, 64] intermediate never exists
+void matmulChainTest() {
+    const string filepath = "./nn/tests/matmul_chain.nn";
+    const string contents = nn_parser::readFile(filepath);
+
+    nn_parser::NNParser parser(contents);
+    std::shared_ptr<Graph> g = parser.parse(contents);
+    g->allocate();
+
+    matmul_chain::printReport(matmul_chain::run(g));
+
+    g->evaluate();
+    g->getNode("D")->printOutput(cout);
+}
+
+// add -> multiply -> relu -> exp becomes a single fused node, none of the intermediates get buffers of their own
+void fusionTest() {
+    const string filepath = "./nn/tests/fusion.nn";
+    const string contents = nn_parser::readFile(filepath);
+
+    nn_parser::NNParser parser(contents);
+    std::shared_ptr<Graph> g = parser.parse(contents);
+
+    fusion::printReport(fusion::run(g, {"output"}));
+
+    g->allocate();
+    g->setLossNode("output");
+
+    g->evaluate();
+    g->calculateGradient();
+
+    g->getNode("output")->printOutput(cout);
+    g->getNode("weights")->printGradient(cout);
+}
+
+// each matmul -> add -> relu of the mlp becomes one dense_relu node
+void denseFusionTest() {
+    const string filepath = "./nn/mlp.nn";
+    const string contents = nn_parser::readFile(filepath);
+
+    nn_parser::NNParser parser(contents);
+    std::shared_ptr<Graph> g = parser.parse(contents);
+
+    dense::printReport(dense::run(g, {"final_output"}));
+
+    g->allocate();
+    g->setLossNode("mse");
+
+    CSVDataset dataset = CSVDataset("./data/sine.csv", {"t"}, {"sine_value"});
+
+    g->evaluate(dataset.sample(32));
+    g->calculateGradient();
+
+    cout << "loss " << g->getLoss() << endl;
+    g->getNode("final_output")->printOutput(cout);
+}
+
+// dense fusion and then int8 quantization of the mlp, each replacing final_output's node in turn
+void quantizedDenseTest() {
+    const string filepath = "./nn/mlp.nn";
+    const string contents = nn_parser::readFile(filepath);
+
+    nn_parser::NNParser parser(contents);
+    std::shared_ptr<Graph> g = parser.parse(contents);
+
+    dense::printReport(dense::run(g, {"final_output"}));
+
+    g->allocate();
+
+    CSVDataset dataset = CSVDataset("./data/sine.csv", {"t"}, {"sine_value"});
+    quantize::Calibration calibration = quantize::calibrate(g, [&] { return dataset.sample(32); }, 4);
+    quantize::printReport(quantize::run(g, calibration));
+
+    g->evaluate(dataset.sample(32), {"final_output"});
+    g->getNode("final_output")->printOutput(cout);
+}
+
 int main() {
     basicBinaryOpEvalTest("conv2d");
 }
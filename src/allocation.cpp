@@ -8,8 +8,13 @@
 #include "buffer.h"
 #include "generation_utils.h"
 #include "graph.h"
+#include "normalization.h"
 #include "ops.h"
+#include "quantize.h"
+#include "reduction.h"
+#include "softmax.h"
 #include "string_utils.h"
+#include "views.h"
 
 // is this also where validation will be taking place?
 namespace allocation {
@@ -19,6 +24,24 @@ namespace allocation {
 void allocateNode(std::shared_ptr<Node> node) {
     const auto& allocationMap = OperationRegistry::GetAllocationMap();
 
+    // kernels dispatch on the node's dtype and read their operands as the same type
+    for (auto& [name, child] : node->children_) {
+        if (child->output_ != nullptr && child->output_->dtype() != node->dtype_) {
+            std::cerr << strings::error("allocation::allocateNode error: ") << "node "
+                      << strings::info(node->name_) << " is " << strings::info(dtypes::name(node->dtype_))
+                      << " but its input " << strings::info(child->name_) << " is "
+                      << strings::info(dtypes::name(child->output_->dtype())) << std::endl;
+            exit(-1);
+        }
+    }
+
+    // views this node can't read in place are copied out before it's ever run
+    for (auto& [name, child] : node->children_) {
+        if (!views::accepts(node, child)) {
+            views::materialize(child);
+        }
+    }
+
     auto it = allocationMap.find(node->operation_type_);
     if (it != allocationMap.end()) {
         it->second(node);
@@ -49,10 +72,10 @@ void inputAllocate(std::shared_ptr<Node> node) {
         node->gradient_ = input_node->gradient_;
     } else {
         // otherwise this needs allocated space
-        node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, DTYPE::float32));
+        node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
 
         // what do we do with the gradient here
-        node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, DTYPE::float32));
+        node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
     }
 }
 
@@ -67,11 +90,10 @@ void tensorAllocate(std::shared_ptr<Node> node) {
         shape.push_back(dim);
     }
 
-    node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, DTYPE::float32));
-    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, DTYPE::float32));
-    const float one = 1;
+    node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
+    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
     for (size_t i = 0; i < node->gradient_->size(); i++) {
-        node->gradient_->setIndex(i, (void*)(&one));
+        node->gradient_->setValue(i, 1.0);
     }
 
     node->shape_ = shape;
@@ -109,11 +131,10 @@ void _element_wise_allocate(std::shared_ptr<Node> node) {
         }
     }
 
-    node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(output_shape, DTYPE::float32));
-    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(gradient_shape, DTYPE::float32));
-    const float one = 1;
+    node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(output_shape, node->dtype_));
+    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(gradient_shape, node->dtype_));
     for (size_t i = 0; i < node->gradient_->size(); i++) {
-        node->gradient_->setIndex(i, (void*)(&one));
+        node->gradient_->setValue(i, 1.0);
     }
 
     node->shape_ = node_shape;
@@ -149,6 +170,11 @@ void expAllocate(std::shared_ptr<Node> node) {
     _element_wise_allocate(node);
 }
 
+void lnAllocate(std::shared_ptr<Node> node) {
+    _input_validator(1, node->arg_order_.size(), "ln");
+    _element_wise_allocate(node);
+}
+
 void powAllocate(std::shared_ptr<Node> node) {
     _input_validator(2, node->arg_order_.size(), "pow");
     _element_wise_allocate(node);
@@ -157,13 +183,8 @@ void powAllocate(std::shared_ptr<Node> node) {
 // NOTE: broadcasting is currently not supported
 //       this means given inputs MUST be the same shape,
 //       save for the last two dimensions
-void matmulAllocate(std::shared_ptr<Node> node) {
-    if (node->arg_order_.size() != 2) {
-        std::cerr << strings::error("matmulAllocateError: ") << "matmul node has <> 2 args, how did this happen?"
-                  << std::endl;
-        exit(-1);
-    }
-
+// output and gradient for the product of the node's first two args
+void _matmul_allocate(std::shared_ptr<Node> node) {
     size_t size = 1;
     std::vector<int> shape_a, shape_b;
 
@@ -215,48 +236,45 @@ void matmulAllocate(std::shared_ptr<Node> node) {
         exit(-1);
     }
 
-    node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(new_shape, DTYPE::float32));
-    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(new_shape, DTYPE::float32));
-    const float one = 1;
+    node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(new_shape, node->dtype_));
+    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(new_shape, node->dtype_));
     for (size_t i = 0; i < node->gradient_->size(); i++) {
-        node->gradient_->setIndex(i, (void*)(&one));
+        node->gradient_->setValue(i, 1.0);
     }
 
     node->shape_ = new_shape;
 }
 
-// all constants will be assumed to be 32-bit float values
+void matmulAllocate(std::shared_ptr<Node> node) {
+    if (node->arg_order_.size() != 2) {
+        std::cerr << strings::error("matmulAllocateError: ") << "matmul node has <> 2 args, how did this happen?"
+                  << std::endl;
+        exit(-1);
+    }
+
+    _matmul_allocate(node);
+}
+
+// constants take the node's dtype like everything else
 // does gradient_ need allocated here?
 // trivial memory usage either way
 void constantAllocate(std::shared_ptr<Node> node) {
-    node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer({1}, DTYPE::float32));
-    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer({1}, DTYPE::float32));
+    node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer({1}, node->dtype_));
+    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer({1}, node->dtype_));
 
-    float value = std::stof(node->name_);
-    float zero = 1;
-
-    node->output_->setIndex(0, (void*)(&value));
-    node->gradient_->setIndex(0, (void*)(&zero));
+    node->output_->setValue(0, std::stod(node->name_));
+    node->gradient_->setValue(0, 1.0);
 }
 
 void normalAllocate(std::shared_ptr<Node> node) {
     tensorAllocate(node);
-    std::shared_ptr<GraphBuffer> buf = node->output_;
-
-    if (buf->dtype() != DTYPE::float32) {
-        std::cerr << strings::error("allocation::allocateNormalNode error (TODO): ")
-                  << "buffer data type must be float32" << std::endl;
-        exit(-1);
-    }
-
-    generation::fillNormal(buf);
+    generation::fillNormal(node->output_);
 }
 
 void onesAllocate(std::shared_ptr<Node> node) {
     tensorAllocate(node);
-    const float one = 1;
     for (size_t i = 0; i < node->output_->size(); i++) {
-        node->output_->setIndex(i, (void*)(&one));
+        node->output_->setValue(i, 1.0);
     }
 }
 
@@ -271,18 +289,132 @@ void reluAllocate(std::shared_ptr<Node> node) {
 }
 
 void reduce_sumAllocate(std::shared_ptr<Node> node) {
-    _input_validator(1, node->arg_order_.size(), "reduce_sum");
+    reduction::allocate(node);
+}
+
+void reduce_meanAllocate(std::shared_ptr<Node> node) {
+    reduction::allocate(node);
+}
+
+void reduce_maxAllocate(std::shared_ptr<Node> node) {
+    reduction::allocate(node);
+}
+
+void softmaxAllocate(std::shared_ptr<Node> node) {
+    _input_validator(1, node->arg_order_.size(), "softmax");
+    softmax::allocate(node);
+}
 
-    node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer({1}, DTYPE::float32));
-    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer({1}, DTYPE::float32));
+void softmax_cross_entropyAllocate(std::shared_ptr<Node> node) {
+    _input_validator(2, node->arg_order_.size(), "softmax_cross_entropy");
+    softmax::allocate(node);
+}
+
+void layer_normAllocate(std::shared_ptr<Node> node) {
+    _input_validator(3, node->arg_order_.size(), "layer_norm");
+    normalization::allocate(node);
+}
+
+void rms_normAllocate(std::shared_ptr<Node> node) {
+    _input_validator(2, node->arg_order_.size(), "rms_norm");
+    normalization::allocate(node);
+}
+
+// the fused expression is element-wise end to end,
+// so the output is just the broadcast of every leaf
+void fusedAllocate(std::shared_ptr<Node> node) {
+    _element_wise_allocate(node);
+}
+
+// dense(x, w, bias) is matmul(x, w) + bias with bias being one value per output column
+void _dense_allocate(std::shared_ptr<Node> node) {
+    _input_validator(3, node->arg_order_.size(), node->operation_type_);
+    _matmul_allocate(node);
+
+    std::shared_ptr<Node> bias = node->children_[node->arg_order_[2]];
+    if (bias->output_->size() != node->shape_.back() || bias->shape_.back() != node->shape_.back()) {
+        std::cerr << strings::error("allocation::" + node->operation_type_ + "Allocate error: ")
+                  << "bias must have one value per output column, got "
+                  << strings::info(strings::vecToString(bias->shape_)) << " for output "
+                  << strings::info(strings::vecToString(node->shape_)) << std::endl;
+        exit(-1);
+    }
+}
+
+void denseAllocate(std::shared_ptr<Node> node) {
+    _dense_allocate(node);
+}
+
+// the relu mask is kept for the backward pass
+void dense_reluAllocate(std::shared_ptr<Node> node) {
+    _dense_allocate(node);
+    node->saved_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
+}
+
+void dense_sigmoidAllocate(std::shared_ptr<Node> node) {
+    _dense_allocate(node);
+}
+
+// qmatmul(x) or qmatmul(x, bias), w lives on the node as int8, see quantize.h
+void qmatmulAllocate(std::shared_ptr<Node> node) {
+    if (node->quantized_ == nullptr || node->arg_order_.empty() || node->arg_order_.size() > 2) {
+        std::cerr << strings::error("allocation::qmatmulAllocate error: ")
+                  << "expected quantized weights and 1 or 2 inputs, got "
+                  << strings::info(std::to_string(node->arg_order_.size())) << " inputs" << std::endl;
+        exit(-1);
+    }
+
+    if (node->dtype_ != DTYPE::float32) {
+        std::cerr << strings::error("allocation::qmatmulAllocate error: ") << "quantized nodes are float32 only, got "
+                  << strings::info(dtypes::name(node->dtype_)) << std::endl;
+        exit(-1);
+    }
+
+    const quantize::Weights& weights = *node->quantized_;
+    std::shared_ptr<Node> x = node->children_[node->arg_order_[0]];
+    if (x->shape_.empty() || x->shape_.back() != weights.k_) {
+        std::cerr << strings::error("allocation::qmatmulAllocate error: ") << "input of shape "
+                  << strings::info(strings::vecToString(x->shape_)) << " can't be multiplied with quantized weights of "
+                  << strings::info(std::to_string(weights.k_)) << " rows" << std::endl;
+        exit(-1);
+    }
+
+    node->shape_ = x->shape_;
+    node->shape_.back() = weights.n_;
+
+    if (node->arg_order_.size() == 2) {
+        std::shared_ptr<Node> bias = node->children_[node->arg_order_[1]];
+        if (bias->output_->size() != weights.n_) {
+            std::cerr << strings::error("allocation::qmatmulAllocate error: ")
+                      << "bias must have one value per output column, got "
+                      << strings::info(strings::vecToString(bias->shape_)) << std::endl;
+            exit(-1);
+        }
+    }
+
+    node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
+    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
+}
+
+void transposeAllocate(std::shared_ptr<Node> node) {
+    views::allocate(node);
+}
 
-    float value = 0;
-    float zero = 1;
+void reshapeAllocate(std::shared_ptr<Node> node) {
+    views::allocate(node);
+}
 
-    node->output_->setIndex(0, (void*)(&value));
-    node->gradient_->setIndex(0, (void*)(&zero));
+void sliceAllocate(std::shared_ptr<Node> node) {
+    _input_validator(4, node->arg_order_.size(), "slice");
+    views::allocate(node);
+}
+
+void expandAllocate(std::shared_ptr<Node> node) {
+    views::allocate(node);
+}
 
-    node->shape_ = {1};
+void squeezeAllocate(std::shared_ptr<Node> node) {
+    views::allocate(node);
 }
 
 void conv2dAllocate(std::shared_ptr<Node> node) {
@@ -319,8 +451,8 @@ void conv2dAllocate(std::shared_ptr<Node> node) {
 
     node->shape_.push_back(kernel->shape_[2]);
 
-    node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, DTYPE::float32));
-    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, DTYPE::float32));
+    node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
+    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
 }
 
 }  // namespace allocation
@@ -13,10 +13,11 @@
 
 // TODO: please god define an iterator for this
 
-Buffer::Buffer() {
+Buffer::Buffer() : version_(new Version()) {
 }
 
-Buffer::Buffer(std::vector<int> shape, DTYPE dtype) : shape_(shape), dtype_(dtype) {
+Buffer::Buffer(std::vector<int> shape, DTYPE dtype)
+    : shape_(shape), dtype_(dtype), version_(new Version()) {
 }
 
 GraphBuffer::GraphBuffer(std::vector<int> shape, DTYPE dtype) : Buffer(shape, dtype) {
@@ -26,6 +27,7 @@ GraphBuffer::GraphBuffer(std::vector<int> shape, DTYPE dtype) : Buffer(shape, dt
     }
 
     size_ = size;
+    span_ = size;
 
     data_ = _mm_malloc(size * dtypes::dtypeSize(dtype), 16);
     memset(data_, 0, size * dtypes::dtypeSize(dtype));
@@ -44,16 +46,55 @@ GraphBuffer::GraphBuffer(std::vector<int> shape, DTYPE dtype) : Buffer(shape, dt
     }
 }
 
-GraphBuffer::GraphBuffer(std::shared_ptr<GraphBuffer> buf) {
+GraphBuffer::GraphBuffer(std::shared_ptr<GraphBuffer> buf) : base_(buf) {
     size_ = buf->size_;
+    span_ = buf->span_;
     data_ = buf->data_;
     shape_ = buf->shape_;
     dtype_ = buf->dtype_;
     strides_ = buf->strides_;
+    version_ = buf->version_;
+}
+
+GraphBuffer::GraphBuffer(std::shared_ptr<Buffer> base, const std::vector<int>& shape, const std::vector<int>& strides,
+                         size_t offset)
+    : Buffer(shape, base->dtype()), base_(base) {
+    if (shape.size() != strides.size() || offset > base->span()) {
+        std::cerr << strings::error("GraphBuffer::GraphBuffer error: ") << "view of shape "
+                  << strings::info(strings::vecToString(shape)) << " with strides "
+                  << strings::info(strings::vecToString(strides)) << " and offset "
+                  << strings::info(std::to_string(offset)) << " doesn't fit in its base" << std::endl;
+        exit(-1);
+    }
+
+    size_t size = 1;
+    for (int dim : shape) {
+        size *= dim;
+    }
+
+    size_ = size;
+    span_ = base->span() - offset;
+    // writes through the view are writes to the base
+    data_ = (char*)base->readData() + offset * dtypes::dtypeSize(dtype_);
+    version_ = base->version_;
+
+    // dimensions of 1 get a stride of 0, same as the buffers that own their data
+    strides_ = strides;
+    for (int i = 0; i < shape.size(); i++) {
+        if (shape[i] == 1) {
+            strides_[i] = 0;
+        }
+    }
 }
 
 GraphBuffer::~GraphBuffer() {
-    _mm_free(data_);
+    if (base_ == nullptr) {
+        _mm_free(data_);
+    }
+}
+
+bool GraphBuffer::isView() {
+    return base_ != nullptr;
 }
 
 std::vector<int> Buffer::shape() {
@@ -68,9 +109,39 @@ DTYPE Buffer::dtype() {
 }
 
 void* Buffer::getData() {
+    version_->count_.fetch_add(1, std::memory_order_relaxed);
     return data_;
 }
 
+const void* Buffer::readData() {
+    return data_;
+}
+
+size_t Buffer::version() {
+    if (version_->written_.exchange(false, std::memory_order_relaxed)) {
+        version_->count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return version_->count_.load(std::memory_order_relaxed);
+}
+
+size_t Buffer::span() {
+    return span_;
+}
+
+bool Buffer::contiguous() {
+    size_t stride = 1;
+    for (int i = shape_.size() - 1; i > -1; i--) {
+        if (shape_[i] != 1 && strides_[i] != stride) {
+            return false;
+        }
+
+        stride *= shape_[i];
+    }
+
+    return true;
+}
+
 void Buffer::print() {
     std::cout << strings::debug("Buffer:") << std::endl;
     std::cout << strings::debug("- Size: ") << size_ << std::endl;
@@ -87,14 +158,22 @@ void Buffer::print() {
 // e.g. 4-D array of shape [x, y, z, w] at [i, j, k, l] means index == i * y * z * w + j * z * w + k * w + l
 // TODO: this disclaimer can probably be abstracted more easily
 void Buffer::setIndex(size_t index, void* value) {
-    if (index > size_) {
+    if (index > span_) {
         std::cerr << strings::error("Buffer::setIndex error: ") << "index " << strings::info(std::to_string(index))
                   << " out of range" << std::endl;
         exit(-1);
     }
 
+    // only the first write since the last `version` touches the shared line
+    if (!version_->written_.load(std::memory_order_relaxed)) {
+        version_->written_.store(true, std::memory_order_relaxed);
+    }
+
     if (dtype_ == DTYPE::float32) {
         *(dtypes::toFloat32(data_) + index) = *(dtypes::toFloat32(value));
+    } else {
+        size_t size = dtypes::dtypeSize(dtype_);
+        memcpy((char*)data_ + index * size, value, size);
     }
 }
 
@@ -109,12 +188,26 @@ void Buffer::setIndex(const std::vector<int>& index, void* value) {
 
 BroadcastedBuffer::BroadcastedBuffer(std::shared_ptr<Buffer> buffer, const std::vector<int>& broadcasted_shape)
     : broadcasted_shape_(broadcasted_shape) {
-    // recalculate `strides_` with `broadcasted_shape`
     size_ = buffer->size();
-    data_ = buffer->getData();
+    span_ = buffer->span();
+    // writes through the broadcast are writes to `buffer`
+    data_ = (void*)buffer->readData();
+    version_ = buffer->version_;
     shape_ = buffer->shape_;
     dtype_ = buffer->dtype();
+
     strides_ = std::vector<int>(broadcasted_shape_.size(), 0);
+
+    // a view keeps its own strides, padded with 0s for the leading dimensions
+    if (!buffer->contiguous()) {
+        for (int i = 1; i <= buffer->strides_.size() && i <= strides_.size(); i++) {
+            strides_[strides_.size() - i] = buffer->strides_[buffer->strides_.size() - i];
+        }
+
+        return;
+    }
+
+    // recalculate `strides_` with `broadcasted_shape`
     size_t stride = 1;
     for (int i = broadcasted_shape.size() - 1; i > -1; i--) {
         if (broadcasted_shape[i] == 1) {
@@ -1,16 +1,28 @@
 #include "buffer_ops.h"
 
+#include <algorithm>
+#include <array>
+#include <cstring>
 #include <memory>
+#include <type_traits>
+#include <vector>
 
 #include "broadcasting.h"
 #include "buffer.h"
+#include "gemm.h"
 #include "iterators.h"
 #include "kernel.h"
+#include "parallel.h"
+#include "reduction.h"
 #include "string_utils.h"
+#include "views.h"
 
 // weird mix of the kernel element-wise functions? this needs better organized
 namespace buffer_ops {
 
+// multiply-adds of matmul work handed to a thread at a time, everything else goes by parallel::GRAIN elements
+static const size_t MATMUL_GRAIN_WORK = 32 * 32 * 32;
+
 void _assert_equal_sizes(const std::string& op, std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b,
                          std::shared_ptr<Buffer> c) {
     if (!broadcasting::broadcastable(a, b) && (a->size() != b->size() || a->size() != c->size())) {
@@ -53,61 +65,67 @@ void _assert_equal_dtypes(const std::string& op, std::shared_ptr<Buffer> a, std:
 void multiply(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out) {
     _assert_equal_dtypes("multiply", a, b, out);
 
-    kernel::_element_wise(
-        [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
-           const std::vector<int>& indices) {
-            float output = a->getIndex<float>(indices) * b->getIndex<float>(indices);
-            out->setIndex(indices, (void*)(&output));
-        },
-        a, b, out);
+    dtypes::dispatch(out->dtype(), [&]<typename T>() {
+        kernel::_element_wise(
+            [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
+               const std::vector<int>& indices) {
+                T output = a->getIndex<T>(indices) * b->getIndex<T>(indices);
+                out->setIndex(indices, (void*)(&output));
+            },
+            a, b, out);
+    });
 }
 
 void multiplyAndReduce(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out) {
-    std::vector<int> old_out_shape = out->shape_;
     const std::vector<int>& greater_input_shape = broadcasting::greaterShape(a->shape_, b->shape_);
-    out->shape_ = broadcasting::padVector(out->shape_, greater_input_shape.size());
+
+    // `out` seen with the inputs' rank
+    std::vector<int> padded_shape = broadcasting::padVector(out->shape_, greater_input_shape.size());
+    std::shared_ptr<Buffer> padded = views::reshape(out, padded_shape);
 
     std::vector<int> reduction_dims;
-    for (int i = 0; i < out->shape_.size(); i++) {
-        if (out->shape_[i] == 1) {
+    for (int i = 0; i < padded->shape_.size(); i++) {
+        if (padded->shape_[i] == 1) {
             reduction_dims.push_back(i);
         }
     }
 
     if (reduction_dims.size() > 0) {
-        std::shared_ptr<GraphBuffer> temp(new GraphBuffer(greater_input_shape, DTYPE::float32));
+        std::shared_ptr<GraphBuffer> temp(new GraphBuffer(greater_input_shape, out->dtype()));
         multiply(a, b, temp);
-        reduceSum(temp, out, reduction_dims);
+        reduceSum(temp, padded, reduction_dims);
     } else {
-        multiply(a, b, out);
+        multiply(a, b, padded);
     }
-
-    out->shape_ = old_out_shape;
 }
 
 void multiply(std::shared_ptr<Buffer> a, float b, std::shared_ptr<Buffer> out) {
-    for (size_t i = 0; i < out->size(); i++) {
-        float output = a->getIndex<float>(i) * b;
-        out->setIndex(i, (void*)(&output));
-    }
+    dtypes::dispatch(out->dtype(), [&]<typename T>() {
+        for (size_t i = 0; i < out->size(); i++) {
+            T output = a->getIndex<T>(i) * b;
+            out->setIndex(i, (void*)(&output));
+        }
+    });
 }
 
 void divide(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out) {
     _assert_equal_sizes("divide", a, b, out);
     _assert_equal_dtypes("divide", a, b, out);
 
-    kernel::_element_wise(
-        [](std::shared_ptr<Buffer> _a, std::shared_ptr<Buffer> _b, std::shared_ptr<Buffer> _out,
-           const std::vector<int>& indices) {
-            if (_b->getIndex<float>(indices) == 0.) {
-                std::cerr << strings::error("buffer_ops::divide error: ") << "divide by 0 error" << std::endl;
-                exit(-1);
-            }
+    dtypes::dispatch(out->dtype(), [&]<typename T>() {
+        kernel::_element_wise(
+            [](std::shared_ptr<Buffer> _a, std::shared_ptr<Buffer> _b, std::shared_ptr<Buffer> _out,
+               const std::vector<int>& indices) {
+                if (_b->getIndex<T>(indices) == 0.) {
+                    std::cerr << strings::error("buffer_ops::divide error: ") << "divide by 0 error" << std::endl;
+                    exit(-1);
+                }
 
-            float output = _a->getIndex<float>(indices) / _b->getIndex<float>(indices);
-            _out->setIndex(indices, (void*)(&output));
-        },
-        a, b, out);
+                T output = _a->getIndex<T>(indices) / _b->getIndex<T>(indices);
+                _out->setIndex(indices, (void*)(&output));
+            },
+            a, b, out);
+    });
 }
 
 void divide(std::shared_ptr<Buffer> a, float b, std::shared_ptr<Buffer> out) {
@@ -116,134 +134,155 @@ void divide(std::shared_ptr<Buffer> a, float b, std::shared_ptr<Buffer> out) {
         exit(-1);
     }
 
-    for (size_t i = 0; i < out->size(); i++) {
-        float output = a->getIndex<float>(i) / b;
-        out->setIndex(i, (void*)(&output));
-    }
+    dtypes::dispatch(out->dtype(), [&]<typename T>() {
+        for (size_t i = 0; i < out->size(); i++) {
+            T output = a->getIndex<T>(i) / b;
+            out->setIndex(i, (void*)(&output));
+        }
+    });
 }
 
 void add(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out) {
     _assert_equal_sizes("add", a, b, out);
     _assert_equal_dtypes("add", a, b, out);
 
-    kernel::_element_wise(
-        [](std::shared_ptr<Buffer> _a, std::shared_ptr<Buffer> _b, std::shared_ptr<Buffer> _out,
-           const std::vector<int>& indices) {
-            float output = _a->getIndex<float>(indices) + _b->getIndex<float>(indices);
-            _out->setIndex(indices, (void*)(&output));
-        },
-        a, b, out);
+    dtypes::dispatch(out->dtype(), [&]<typename T>() {
+        kernel::_element_wise(
+            [](std::shared_ptr<Buffer> _a, std::shared_ptr<Buffer> _b, std::shared_ptr<Buffer> _out,
+               const std::vector<int>& indices) {
+                T output = _a->getIndex<T>(indices) + _b->getIndex<T>(indices);
+                _out->setIndex(indices, (void*)(&output));
+            },
+            a, b, out);
+    });
 }
 
 void add(std::shared_ptr<Buffer> a, float b, std::shared_ptr<Buffer> out) {
     _assert_equal_sizes("add", a, out);
     _assert_equal_dtypes("add", a, out);
 
-    kernel::_element_wise(
-        [](std::shared_ptr<Buffer> _a, float _b, std::shared_ptr<Buffer> _out, size_t index) {
-            float output = _a->getIndex<float>(index) + _b;
-            _out->setIndex(index, (void*)(&output));
-        },
-        a, b, out);
+    dtypes::dispatch(out->dtype(), [&]<typename T>() {
+        kernel::_element_wise(
+            [](std::shared_ptr<Buffer> _a, float _b, std::shared_ptr<Buffer> _out, size_t index) {
+                T output = _a->getIndex<T>(index) + _b;
+                _out->setIndex(index, (void*)(&output));
+            },
+            a, b, out);
+    });
 }
 
 void subtract(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out) {
     _assert_equal_sizes("subtract", a, b, out);
     _assert_equal_dtypes("subtract", a, b, out);
 
-    kernel::_element_wise(
-        [](std::shared_ptr<Buffer> _a, std::shared_ptr<Buffer> _b, std::shared_ptr<Buffer> _out,
-           const std::vector<int>& indices) {
-            float output = _a->getIndex<float>(indices) - _b->getIndex<float>(indices);
-            _out->setIndex(indices, (void*)(&output));
-        },
-        a, b, out);
+    dtypes::dispatch(out->dtype(), [&]<typename T>() {
+        kernel::_element_wise(
+            [](std::shared_ptr<Buffer> _a, std::shared_ptr<Buffer> _b, std::shared_ptr<Buffer> _out,
+               const std::vector<int>& indices) {
+                T output = _a->getIndex<T>(indices) - _b->getIndex<T>(indices);
+                _out->setIndex(indices, (void*)(&output));
+            },
+            a, b, out);
+    });
 }
 
 void reciprocal(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out) {
     _assert_equal_sizes("reciprocal", a, out);
     _assert_equal_dtypes("reciprocal", a, out);
 
-    kernel::_element_wise(
-        [](std::shared_ptr<Buffer> _a, std::shared_ptr<Buffer> _out, size_t index) {
-            if (_a->getIndex<float>(index) < EPSILON) {
-                std::cerr << strings::error("buffer_ops::reciprocal error: ") << "divide by 0 error" << std::endl;
-                exit(-1);
-            }
+    dtypes::dispatch(out->dtype(), [&]<typename T>() {
+        kernel::_element_wise(
+            [](std::shared_ptr<Buffer> _a, std::shared_ptr<Buffer> _out, size_t index) {
+                if (_a->getIndex<T>(index) < EPSILON) {
+                    std::cerr << strings::error("buffer_ops::reciprocal error: ") << "divide by 0 error" << std::endl;
+                    exit(-1);
+                }
 
-            float output = 1. / _a->getIndex<float>(index);
-            _out->setIndex(index, (void*)(&output));
-        },
-        a, out);
+                T output = 1. / _a->getIndex<T>(index);
+                _out->setIndex(index, (void*)(&output));
+            },
+            a, out);
+    });
 }
 
 void ln(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out) {
     _assert_equal_sizes("ln", a, out);
     _assert_equal_dtypes("ln", a, out);
 
-    kernel::_element_wise(
-        [](std::shared_ptr<Buffer> _a, std::shared_ptr<Buffer> _out, size_t index) {
-            // TODO: option to ignore?
-            if (_a->getIndex<float>(index) <= EPSILON) {
-                return;
-                std::cerr << strings::error("buffer_ops::ln error: ") << "cannot take natural log of 0" << std::endl;
-                // exit(-1);
-            }
+    dtypes::dispatch(out->dtype(), [&]<typename T>() {
+        kernel::_element_wise(
+            [](std::shared_ptr<Buffer> _a, std::shared_ptr<Buffer> _out, size_t index) {
+                // TODO: option to ignore?
+                if (_a->getIndex<T>(index) <= EPSILON) {
+                    return;
+                    std::cerr << strings::error("buffer_ops::ln error: ") << "cannot take natural log of 0"
+                              << std::endl;
+                    // exit(-1);
+                }
 
-            float output = std::log(_a->getIndex<float>(index));
-            _out->setIndex(index, (void*)(&output));
-        },
-        a, out);
+                T output = std::log(_a->getIndex<T>(index));
+                _out->setIndex(index, (void*)(&output));
+            },
+            a, out);
+    });
 }
 
 void sigmoid(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out) {
     _assert_equal_sizes("sigmoid", a, out);
     _assert_equal_dtypes("sigmoid", a, out);
 
-    kernel::_element_wise(
-        [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, size_t index) {
-            float output = 1 / (1 + std::exp(-(a->getIndex<float>(index))));
-            out->setIndex(index, (void*)(&output));
-        },
-        a, out);
+    dtypes::dispatch(out->dtype(), [&]<typename T>() {
+        kernel::_element_wise(
+            [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, size_t index) {
+                T output = 1 / (1 + std::exp(-(a->getIndex<T>(index))));
+                out->setIndex(index, (void*)(&output));
+            },
+            a, out);
+    });
 }
 
 void relu(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out) {
     _assert_equal_sizes("relu", a, out);
     _assert_equal_dtypes("relu", a, out);
 
-    kernel::_element_wise(
-        [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, size_t index) {
-            float output = a->getIndex<float>(index);
-            output = output > EPSILON ? output : 0;
-            out->setIndex(index, (void*)(&output));
-        },
-        a, out);
+    dtypes::dispatch(out->dtype(), [&]<typename T>() {
+        kernel::_element_wise(
+            [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, size_t index) {
+                T output = a->getIndex<T>(index);
+                output = output > EPSILON ? output : T(0);
+                out->setIndex(index, (void*)(&output));
+            },
+            a, out);
+    });
 }
 
 void pow(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out) {
     _assert_equal_sizes("pow", a, b, out);
     _assert_equal_dtypes("pow", a, b, out);
 
-    kernel::_element_wise(
-        [](std::shared_ptr<Buffer> _a, std::shared_ptr<Buffer> _b, std::shared_ptr<Buffer> _out,
-           const std::vector<int>& indices) {
-            float output = std::pow(_a->getIndex<float>(indices), _b->getIndex<float>(indices));
-            _out->setIndex(indices, (void*)(&output));
-        },
-        a, b, out);
+    dtypes::dispatch(out->dtype(), [&]<typename T>() {
+        kernel::_element_wise(
+            [](std::shared_ptr<Buffer> _a, std::shared_ptr<Buffer> _b, std::shared_ptr<Buffer> _out,
+               const std::vector<int>& indices) {
+                T output = std::pow(_a->getIndex<T>(indices), _b->getIndex<T>(indices));
+                _out->setIndex(indices, (void*)(&output));
+            },
+            a, b, out);
+    });
 }
 
 void pow(std::shared_ptr<Buffer> a, float b, std::shared_ptr<Buffer> out) {
     _assert_equal_sizes("pow", a, out);
     _assert_equal_dtypes("pow", a, out);
 
-    kernel::_element_wise(
-        [](std::shared_ptr<Buffer> _a, float _b, std::shared_ptr<Buffer> _out, size_t index) {
-            float output = std::pow(_a->getIndex<float>(index), _b);
-            _out->setIndex(index, (void*)(&output));
-        },
-        a, b, out);
+    dtypes::dispatch(out->dtype(), [&]<typename T>() {
+        kernel::_element_wise(
+            [](std::shared_ptr<Buffer> _a, float _b, std::shared_ptr<Buffer> _out, size_t index) {
+                T output = std::pow(_a->getIndex<T>(index), _b);
+                _out->setIndex(index, (void*)(&output));
+            },
+            a, b, out);
+    });
 }
 
 // TODO: this isn't at all optimized for GPU usage
@@ -252,6 +291,7 @@ void pow(std::shared_ptr<Buffer> a, float b, std::shared_ptr<Buffer> out) {
 // this might change? as such this function will need to change if/when that happens
 void transpose(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, const std::vector<int>& permutation) {
     _assert_equal_sizes("transpose", a, out);
+    _assert_equal_dtypes("transpose", a, out);
 
     auto [a_shape, out_shape] = broadcasting::padVectors(a->shape(), out->shape());
 
@@ -275,23 +315,18 @@ void transpose(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, const std
         }
     }
 
-    iterators::IndexIterator input_it(a_shape);
-    iterators::IndexIterator output_it(out_shape);
-
-    while (!input_it.end()) {
-        for (int i = 0; i < output_it.current_.size(); i++) {
-            output_it.current_[i] = input_it.current_[permutation[i]];
-        }
-
-        float value = a->getIndex<float>(input_it.getIndex());
-        out->setIndex(output_it.getIndex(), (void*)(&value));
-
-        input_it.increment();
-    }
+    // a permuted view of `a` copied out, which is a blocked transpose whenever it swaps the contiguous dimension,
+    // see views::copy
+    std::shared_ptr<GraphBuffer> permuted = views::transpose(views::expand(a, a_shape), permutation);
+    views::copy(permuted, permuted->shape_ == out->shape_ ? out : views::reshape(out, permuted->shape_));
 }
 
-void matmul(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
-            const std::vector<int>& shape_a, const std::vector<int>& shape_b, const std::vector<int>& shape_out) {
+// the transposing gemms take no epilogue, so either `epilogue` is none or the operands are plain
+void _matmul(std::shared_ptr<Buffer> a, bool trans_a, std::shared_ptr<Buffer> b, bool trans_b,
+             std::shared_ptr<Buffer> out, const std::vector<int>& shape_a, const std::vector<int>& shape_b,
+             const std::vector<int>& shape_out, const gemm::Epilogue& epilogue, float alpha, float beta) {
+    _assert_equal_dtypes("matmul", a, b, out);
+
     int l = shape_a.size();
     int r = shape_b.size();
     int o = shape_out.size();
@@ -300,89 +335,169 @@ void matmul(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_pt
     size_t r_matrix_size = shape_b[r - 2] * shape_b[r - 1];
     size_t o_matrix_size = shape_out[o - 2] * shape_out[o - 1];
 
+    // dimensions of op(a) @ op(b), the leading dimensions are as stored
+    int m = trans_a ? shape_a[l - 1] : shape_a[l - 2];
+    int k = trans_a ? shape_a[l - 2] : shape_a[l - 1];
+    int n = trans_b ? shape_b[r - 2] : shape_b[r - 1];
+
     // for batched matrix multiplication, only the last two dimensions are considered in the multiplication
-    // the rest of the dimenions just serve to act as groupings of matrices
+    // the rest of the dimenions just serve to act as groupings of matrices, broadcast against each other
     //
     // NOTE: shape verification is performed in `allocation.cpp`
-    size_t matrix_count = 1;
-    for (int i = 0; i < shape_a.size() - 2; i++) {
-        matrix_count *= shape_a[i];
-    }
+    std::vector<int> l_batch_shape(shape_a.begin(), shape_a.end() - 2);
+    std::vector<int> r_batch_shape(shape_b.begin(), shape_b.end() - 2);
+
+    // a lone product is a batch of one
+    int padding_size = std::max({(size_t)1, l_batch_shape.size(), r_batch_shape.size()});
+    l_batch_shape = broadcasting::padVector(l_batch_shape, padding_size);
+    r_batch_shape = broadcasting::padVector(r_batch_shape, padding_size);
 
-    std::vector<int> l_batch_shape;
-    std::vector<int> r_batch_shape;
+    std::vector<int> batch_shape(padding_size);
+    for (int i = 0; i < padding_size; i++) {
+        batch_shape[i] = std::max(l_batch_shape[i], r_batch_shape[i]);
+    }
 
-    for (int i = 0; i < shape_a.size() - 2 || i < shape_b.size() - 2; i++) {
-        if (i < shape_a.size() - 2) {
-            l_batch_shape.push_back(shape_a[i]);
+    // (left, right, out) matrix offsets of every product in the batch
+    // an operand's dimension of 1 is broadcast by staying put along it
+    std::vector<std::array<size_t, 3>> products;
+    for (iterators::IndexIterator it(batch_shape); !it.end(); it.increment()) {
+        std::vector<int> indices = it.getIndices();
+
+        size_t left_index = 0;
+        size_t right_index = 0;
+        for (int i = 0; i < padding_size; i++) {
+            left_index = left_index * l_batch_shape[i] + (l_batch_shape[i] == 1 ? 0 : indices[i]);
+            right_index = right_index * r_batch_shape[i] + (r_batch_shape[i] == 1 ? 0 : indices[i]);
         }
 
-        if (i < shape_b.size() - 2) {
-            r_batch_shape.push_back(shape_b[i]);
-        }
+        products.push_back(
+            {left_index * l_matrix_size, right_index * r_matrix_size, products.size() * o_matrix_size});
     }
 
-    bool l_is_lesser = false;
-
-    int padding_size = std::max(l_batch_shape.size(), r_batch_shape.size());
-    l_batch_shape = broadcasting::padVector(l_batch_shape, padding_size);
-    r_batch_shape = broadcasting::padVector(r_batch_shape, padding_size);
+    // every product multiplying its own matrix of A by the one B is a single product, with the batch stacked up in M
+    // consecutive matrices of A and of the output are consecutive rows already, unless A is read transposed
+    bool stacked = !trans_a && products.size() > 1;
+    for (size_t p = 0; p < products.size() && stacked; p++) {
+        stacked = products[p] == std::array<size_t, 3>{p * l_matrix_size, 0, p * o_matrix_size};
+    }
 
-    for (int i = 0; i < l_batch_shape.size(); i++) {
-        if (l_batch_shape[i] < r_batch_shape[i]) {
-            l_is_lesser = true;
-        } else {
-            l_is_lesser = false;
-        }
+    if (stacked) {
+        m *= products.size();
+        products = {{0, 0, 0}};
     }
 
-    if (l_batch_shape.size() == 0) {
-        l_batch_shape = {1};
-        l_is_lesser = true;
+    // small products are handed out a few at a time, large ones get split up inside `gemm::sgemm` instead
+    size_t work = std::max((size_t)1, (size_t)m * n * k);
+    size_t grain = std::max((size_t)1, MATMUL_GRAIN_WORK / work);
+
+    if (out->dtype() != DTYPE::float32 &&
+        (epilogue.bias_ != nullptr || epilogue.activation_ != gemm::Activation::none || epilogue.scale_ != 1)) {
+        std::cerr << strings::error("buffer_ops::matmul error: ") << "epilogues are float32 only" << std::endl;
+        exit(-1);
     }
 
-    if (r_batch_shape.size() == 0) {
-        r_batch_shape = {1};
-        l_is_lesser = false;
+    // half precision products are accumulated into a float32 copy of the output, rounded down once at the end
+    std::shared_ptr<GraphBuffer> accumulated;
+    if (dtypes::isHalf(out->dtype())) {
+        accumulated = std::shared_ptr<GraphBuffer>(new GraphBuffer(out->shape_, DTYPE::float32));
+        if (beta != 0) {
+            copy(out, accumulated);
+        }
     }
 
-    iterators::BroadcastIterator it = l_is_lesser ? iterators::BroadcastIterator(l_batch_shape, r_batch_shape)
-                                                  : iterators::BroadcastIterator(r_batch_shape, l_batch_shape);
+    bool plain = epilogue.bias_ == nullptr && epilogue.activation_ == gemm::Activation::none &&
+                 epilogue.mask_ == nullptr && epilogue.scale_ == 1;
 
-    while (!it.end()) {
-        auto [lesser_index, greater_index] = it.getIndices();
-        size_t left_index = l_is_lesser ? lesser_index : greater_index;
-        size_t right_index = l_is_lesser ? greater_index : lesser_index;
-        size_t out_index = greater_index;
+    // a batch of tiny products costs less to run directly than to pack, see gemm::sgemmBatched
+    bool small = plain && !trans_a && !trans_b && alpha == 1 && beta == 0 && products.size() > 1 &&
+                 m <= gemm::SMALL && n <= gemm::SMALL && k <= gemm::SMALL;
 
-        for (int i = 0; i < shape_a[l - 2]; i++) {
-            for (int j = 0; j < shape_b[r - 1]; j++) {
-                float dot = 0;
-                for (int k = 0; k < shape_b[r - 2]; k++) {
-                    float avalue = a->getIndex<float>((left_index * l_matrix_size) + (i * shape_a[l - 1]) + k);
-                    float bvalue = b->getIndex<float>((right_index * r_matrix_size) + (k * shape_b[r - 1]) + j);
+    dtypes::dispatch(a->dtype(), [&]<typename T>() {
+        using A = dtypes::Accumulate<T>;
 
-                    dot += avalue * bvalue;
+        const T* a_data = (const T*)a->getData();
+        const T* b_data = (const T*)b->getData();
+        A* out_data = (A*)(accumulated == nullptr ? out->getData() : accumulated->getData());
+
+        parallel::parallelFor(0, products.size(), grain, [&](size_t first, size_t last) {
+            if constexpr (std::is_same_v<T, float>) {
+                if (small) {
+                    gemm::sgemmBatched(m, n, k, a_data, shape_a[l - 1], b_data, shape_b[r - 1], out_data,
+                                       shape_out[o - 1], products.data() + first, last - first);
+                    return;
+                }
+            } else if constexpr (std::is_same_v<T, double>) {
+                if (small) {
+                    gemm::dgemmBatched(m, n, k, a_data, shape_a[l - 1], b_data, shape_b[r - 1], out_data,
+                                       shape_out[o - 1], products.data() + first, last - first);
+                    return;
                 }
+            }
 
-                out->setIndex((out_index * o_matrix_size) + (i * shape_out[o - 1]) + j, (void*)(&dot));
+            for (size_t p = first; p < last; p++) {
+                auto [left_offset, right_offset, out_offset] = products[p];
+
+                if constexpr (std::is_same_v<T, double>) {
+                    gemm::dgemm(trans_a, trans_b, m, n, k, alpha, a_data + left_offset, shape_a[l - 1],
+                                b_data + right_offset, shape_b[r - 1], beta, out_data + out_offset, shape_out[o - 1]);
+                } else if (plain) {
+                    gemm::sgemm(trans_a, trans_b, m, n, k, alpha, a_data + left_offset, shape_a[l - 1],
+                                b_data + right_offset, shape_b[r - 1], beta, out_data + out_offset, shape_out[o - 1]);
+                } else {
+                    // the epilogue's mask is laid out like the output
+                    gemm::Epilogue matrix_epilogue = epilogue;
+                    if (epilogue.mask_ != nullptr) {
+                        matrix_epilogue.mask_ = epilogue.mask_ + out_offset;
+                    }
+
+                    gemm::sgemm(m, n, k, a_data + left_offset, shape_a[l - 1], b_data + right_offset, shape_b[r - 1],
+                                out_data + out_offset, shape_out[o - 1], matrix_epilogue);
+                }
             }
-        }
+        });
+    });
 
-        it.increment();
+    if (accumulated != nullptr) {
+        copy(accumulated, out);
     }
 }
 
-float reduceSum(std::shared_ptr<Buffer> a) {
-    float output = 0;
-    for (size_t i = 0; i < a->size(); i++) {
-        output += a->getIndex<float>(i);
+void matmul(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
+            const std::vector<int>& shape_a, const std::vector<int>& shape_b, const std::vector<int>& shape_out) {
+    _matmul(a, false, b, false, out, shape_a, shape_b, shape_out, gemm::none(), 1, 0);
+}
+
+void matmul(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
+            const std::vector<int>& shape_a, const std::vector<int>& shape_b, const std::vector<int>& shape_out,
+            const gemm::Epilogue& epilogue) {
+    _matmul(a, false, b, false, out, shape_a, shape_b, shape_out, epilogue, 1, 0);
+}
+
+void matmul(std::shared_ptr<Buffer> a, bool trans_a, std::shared_ptr<Buffer> b, bool trans_b,
+            std::shared_ptr<Buffer> out, const std::vector<int>& shape_a, const std::vector<int>& shape_b,
+            const std::vector<int>& shape_out, float alpha, float beta) {
+    _matmul(a, trans_a, b, trans_b, out, shape_a, shape_b, shape_out, gemm::none(), alpha, beta);
+}
+
+void matmul(std::shared_ptr<Buffer> a, const gemm::PackedB& b, std::shared_ptr<Buffer> out,
+            const gemm::Epilogue& epilogue) {
+    _assert_equal_dtypes("matmul", a, out);
+
+    if (a->dtype() != DTYPE::float32 || a->size() % b.k_ != 0 || out->size() != a->size() / b.k_ * b.n_) {
+        std::cerr << strings::error("buffer_ops::matmul error: ") << "can't multiply "
+                  << strings::info(strings::vecToString(a->shape())) << " by a packed "
+                  << strings::info(std::to_string(b.k_) + " x " + std::to_string(b.n_)) << " into "
+                  << strings::info(strings::vecToString(out->shape())) << std::endl;
+        exit(-1);
     }
 
-    return output;
+    gemm::sgemm(a->size() / b.k_, (const float*)a->getData(), b.k_, b, (float*)out->getData(), b.n_, epilogue);
+}
+
+double reduceSum(std::shared_ptr<Buffer> a) {
+    return reduction::reduce(reduction::Op::sum, a);
 }
 
-// this is naive and can most definitely be optimized
 void reduceSum(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, const std::vector<int>& indices) {
     if (a->shape().size() != out->shape().size()) {
         std::cerr << strings::error("buffer_ops::reduceSum error: ")
@@ -392,55 +507,12 @@ void reduceSum(std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, const std
         exit(-1);
     }
 
-    const std::vector<int>& a_shape = a->shape();
-    const std::vector<int>& out_shape = out->shape();
-
-    for (int i : indices) {
-        if (i >= a_shape.size()) {
-            std::cerr << strings::error("buffer_ops::reduceSum error: ") << "index " << strings::info(std::to_string(i))
-                      << " out of range for shape " << strings::info(strings::vecToString(a_shape)) << std::endl;
-            exit(-1);
-        }
-
-        if (out_shape[i] != 1) {
-            std::cerr << strings::error("buffer_ops::reduceSum error: ") << "index " << strings::info(std::to_string(i))
-                      << " of output shape " << strings::info(strings::vecToString(out_shape)) << " must be 1"
-                      << std::endl;
-            exit(-1);
-        }
-    }
-
-    iterators::IndexIterator it(a_shape);
-
-    while (!it.end()) {
-        std::vector<int> a_indices = it.getIndices();
-        size_t a_index = iterators::getFlatIndex(a_shape, a_indices);
-
-        // fill `out_indices`, set reduced indices to 0
-        std::vector<int> out_indices(a_indices.size());
-        for (int i = 0, j = 0; i < a_indices.size(); i++) {
-            if (j < indices.size() && i == indices[j]) {
-                j++;
-                out_indices[i] = 0;
-            } else {
-                out_indices[i] = a_indices[i];
-            }
-        }
-
-        size_t out_index = iterators::getFlatIndex(out_shape, out_indices);
-
-        float value = out->getIndex<float>(out_index);
-        value += a->getIndex<float>(a_index);
-
-        out->setIndex(out_index, (void*)(&value));
-
-        it.increment();
-    }
+    reduction::reduce(reduction::Op::sum, a, out, indices, true);
 }
 
 void set(std::shared_ptr<Buffer> a, float value) {
     for (size_t i = 0; i < a->size(); i++) {
-        a->setIndex(i, (void*)(&value));
+        a->setValue(i, value);
     }
 }
 
@@ -452,9 +524,14 @@ void copy(std::shared_ptr<Buffer> from, std::shared_ptr<Buffer> to) {
         exit(-1);
     }
 
+    if (from->dtype() == to->dtype()) {
+        std::memcpy(to->getData(), from->getData(), from->size() * dtypes::dtypeSize(from->dtype()));
+        return;
+    }
+
+    // converting, e.g. between float64 and float32 copies of the same weights
     for (size_t i = 0; i < from->size(); i++) {
-        float value = from->getIndex<float>(i);
-        to->setIndex(i, (void*)(&value));
+        to->setValue(i, from->getValue<double>(i));
     }
 }
 
@@ -0,0 +1,278 @@
+#include "checkpoint.h"
+
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "allocation.h"
+#include "graph.h"
+#include "kernel.h"
+#include "ops.h"
+#include "scheduler.h"
+#include "string_utils.h"
+
+namespace checkpoint {
+
+// computed from the inputs, as opposed to a parameter or an input
+bool _activation(std::shared_ptr<Node> node) {
+    return !node->isParameter() && node->operation_type_ != operations::input;
+}
+
+// activations nothing outside the forward pass needs to see
+bool _releasable(std::shared_ptr<Node> node, std::shared_ptr<Node> loss, const std::map<int, int>& consumers) {
+    return _activation(node) && !node->checkpoint_ && !node->shared_ && node != loss &&
+           consumers.find(node->getId()) != consumers.end();
+}
+
+std::map<int, int> _consumer_counts(Graph& graph, const std::set<int>* subgraph = nullptr) {
+    std::map<int, int> counts;
+    for (auto& [id, consumers] : graph.consumers()) {
+        for (std::shared_ptr<Node> consumer : consumers) {
+            if (subgraph == nullptr || subgraph->count(consumer->getId()) > 0) {
+                counts[id]++;
+            }
+        }
+    }
+
+    return counts;
+}
+
+// the nodes the loss depends on, in topological order
+std::vector<std::shared_ptr<Node>> _order(Graph& graph) {
+    std::vector<std::shared_ptr<Node>> order;
+    graph.topologicalSort([&](std::shared_ptr<Node> node) { order.push_back(node); }, graph.dependencies({}));
+
+    return order;
+}
+
+// each ends with a checkpoint, except possibly the last
+std::vector<std::vector<std::shared_ptr<Node>>> _segments(const std::vector<std::shared_ptr<Node>>& order) {
+    std::vector<std::vector<std::shared_ptr<Node>>> segments(1);
+    for (std::shared_ptr<Node> node : order) {
+        segments.back().push_back(node);
+        if (node->checkpoint_) {
+            segments.push_back({});
+        }
+    }
+
+    if (segments.back().empty()) {
+        segments.pop_back();
+    }
+
+    return segments;
+}
+
+// the gradient outlives the output, it's accumulated into while the output comes and goes
+void _allocate(std::shared_ptr<Node> node) {
+    std::shared_ptr<GraphBuffer> gradient = node->gradient_;
+    allocation::allocateNode(node);
+
+    if (gradient != nullptr) {
+        node->gradient_ = gradient;
+    }
+}
+
+void _recompute(std::shared_ptr<Node> node) {
+    if (node->output_ != nullptr) {
+        return;
+    }
+
+    for (auto& [name, child] : node->children_) {
+        _recompute(child);
+    }
+
+    _allocate(node);
+    kernel::computeNode(node);
+}
+
+void _release(std::shared_ptr<Node> node) {
+    node->output_ = nullptr;
+    node->saved_ = nullptr;
+}
+
+size_t _bytes(std::shared_ptr<Node> node) {
+    size_t size = 1;
+    for (int dim : node->shape_) {
+        size *= dim;
+    }
+
+    return size * dtypes::dtypeSize(node->dtype_);
+}
+
+void _forward(Graph& graph, std::function<void(std::shared_ptr<Node>)> visit, const std::set<int>* subgraph) {
+    std::shared_ptr<Node> loss = graph.getLossNode();
+    std::map<int, int> consumers = _consumer_counts(graph, subgraph);
+
+    std::vector<std::shared_ptr<Node>> nodes;
+    std::map<int, std::atomic<int>> remaining;
+    for (auto& [id, node] : graph.nodes_) {
+        if (subgraph != nullptr && subgraph->count(id) == 0) {
+            continue;
+        }
+
+        nodes.push_back(node);
+        auto it = consumers.find(id);
+        remaining[id].store(it == consumers.end() ? 0 : it->second);
+    }
+
+    std::function<void(std::shared_ptr<Node>)> step = [&](std::shared_ptr<Node> node) {
+        if (node->output_ == nullptr) {
+            _allocate(node);
+        }
+
+        visit(node);
+
+        // whoever computes a child's last consumer frees it
+        for (auto& [name, child] : node->children_) {
+            if (--remaining.at(child->getId()) == 0 && _releasable(child, loss, consumers)) {
+                _release(child);
+            }
+        }
+    };
+
+    // a memory-aware order only holds if the nodes run one at a time, their kernels can still use the pool
+    const std::vector<int>& order = graph.executionOrder();
+    if (!order.empty()) {
+        for (int id : order) {
+            if (subgraph == nullptr || subgraph->count(id) > 0) {
+                step(graph.nodes_[id]);
+            }
+        }
+    } else {
+        scheduler::forward(nodes, step);
+    }
+}
+
+void forward(Graph& graph, std::function<void(std::shared_ptr<Node>)> visit) {
+    _forward(graph, visit, nullptr);
+}
+
+void forward(Graph& graph, std::function<void(std::shared_ptr<Node>)> visit, const std::set<int>& subgraph) {
+    _forward(graph, visit, &subgraph);
+}
+
+std::set<int> releasable(Graph& graph) {
+    std::shared_ptr<Node> loss = graph.getLossNode();
+    std::map<int, int> consumers = _consumer_counts(graph);
+
+    std::set<int> ids;
+    for (auto& [id, node] : graph.nodes_) {
+        if (_releasable(node, loss, consumers)) {
+            ids.insert(id);
+        }
+    }
+
+    return ids;
+}
+
+void backward(Graph& graph, std::function<void(std::shared_ptr<Node>)> visit) {
+    std::shared_ptr<Node> loss = graph.getLossNode();
+    std::map<int, int> consumers = _consumer_counts(graph);
+
+    std::vector<std::vector<std::shared_ptr<Node>>> segments = _segments(_order(graph));
+    for (int s = segments.size() - 1; s >= 0; s--) {
+        // anything an earlier segment freed that this one reads is recomputed along the way
+        for (std::shared_ptr<Node> node : segments[s]) {
+            _recompute(node);
+        }
+
+        // every consumer outside the segment comes later in the order and is done already
+        scheduler::backward(segments[s], visit);
+
+        for (auto& [id, node] : graph.nodes_) {
+            if (node->output_ != nullptr && _releasable(node, loss, consumers)) {
+                _release(node);
+            }
+        }
+    }
+}
+
+Report automatic(std::shared_ptr<Graph> graph) {
+    std::shared_ptr<Node> loss = graph->getLossNode();
+    std::map<int, int> consumers = _consumer_counts(*graph);
+
+    std::vector<std::shared_ptr<Node>> candidates;
+    for (std::shared_ptr<Node> node : _order(*graph)) {
+        if (_releasable(node, loss, consumers)) {
+            candidates.push_back(node);
+        }
+    }
+
+    int every = std::max(1, (int)std::round(std::sqrt((double)candidates.size())));
+    for (int i = every - 1; i < candidates.size(); i += every) {
+        candidates[i]->checkpoint_ = true;
+    }
+
+    graph->setCheckpointing(true);
+
+    return report(graph);
+}
+
+Report report(std::shared_ptr<Graph> graph) {
+    std::shared_ptr<Node> loss = graph->getLossNode();
+    std::map<int, int> consumers = _consumer_counts(*graph);
+    std::vector<std::shared_ptr<Node>> order = _order(*graph);
+
+    Report report = {0, 0, 0, 0, 0, 0, 0};
+
+    size_t total_cost = 0;
+    size_t recompute_cost = 0;
+    for (std::shared_ptr<Node> node : order) {
+        if (!_activation(node)) {
+            continue;
+        }
+
+        size_t cost = scheduler::cost(node);
+        total_cost += cost;
+
+        report.nodes_++;
+        report.checkpoints_ += node->checkpoint_;
+        report.full_bytes_ += _bytes(node);
+
+        if (_releasable(node, loss, consumers)) {
+            recompute_cost += cost;
+        } else {
+            report.kept_bytes_ += _bytes(node);
+        }
+    }
+
+    std::vector<std::vector<std::shared_ptr<Node>>> segments = _segments(order);
+    report.segments_ = segments.size();
+    for (const std::vector<std::shared_ptr<Node>>& segment : segments) {
+        size_t bytes = 0;
+        for (std::shared_ptr<Node> node : segment) {
+            if (_releasable(node, loss, consumers)) {
+                bytes += _bytes(node);
+            }
+        }
+
+        report.peak_segment_bytes_ = std::max(report.peak_segment_bytes_, bytes);
+    }
+
+    report.recompute_ = total_cost == 0 ? 0 : (double)recompute_cost / total_cost;
+
+    return report;
+}
+
+void printReport(const Report& report) {
+    std::cout << strings::debug("Checkpointing:") << std::endl;
+    std::cout << strings::debug("- activations: ") << strings::info(std::to_string(report.nodes_)) << std::endl;
+    std::cout << strings::debug("- checkpoints: ") << strings::info(std::to_string(report.checkpoints_)) << std::endl;
+    std::cout << strings::debug("- segments: ") << strings::info(std::to_string(report.segments_)) << std::endl;
+    std::cout << strings::debug("- bytes without checkpointing: ") << strings::info(std::to_string(report.full_bytes_))
+              << std::endl;
+    std::cout << strings::debug("- bytes kept: ") << strings::info(std::to_string(report.kept_bytes_)) << std::endl;
+    std::cout << strings::debug("- largest segment in bytes: ")
+              << strings::info(std::to_string(report.peak_segment_bytes_)) << std::endl;
+    std::cout << strings::debug("- recomputed work: ")
+              << strings::info(std::to_string((int)std::round(report.recompute_ * 100)) + "% of a forward pass")
+              << std::endl;
+}
+
+}  // namespace checkpoint
@@ -0,0 +1,134 @@
+#include "data_parallel.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "buffer_ops.h"
+#include "graph.h"
+#include "parallel.h"
+#include "string_utils.h"
+
+namespace data_parallel {
+
+Trainer::Trainer(std::shared_ptr<Graph> graph, int replicas) : graph_(graph), batch_size_(0) {
+    if (replicas < 1) {
+        std::cerr << strings::error("data_parallel::Trainer error: ") << "need at least one replica, got "
+                  << strings::info(std::to_string(replicas)) << std::endl;
+        exit(-1);
+    }
+
+    for (std::shared_ptr<Node> input : graph_->getInputs()) {
+        if (input->shape_.empty()) {
+            continue;
+        }
+
+        if (batch_size_ != 0 && input->shape_[0] != batch_size_) {
+            std::cerr << strings::error("data_parallel::Trainer error: ") << "inputs disagree on the batch size, "
+                      << strings::info(std::to_string(batch_size_)) << " vs "
+                      << strings::info(std::to_string(input->shape_[0])) << std::endl;
+            exit(-1);
+        }
+
+        batch_size_ = input->shape_[0];
+    }
+
+    if (batch_size_ == 0 || batch_size_ % replicas != 0) {
+        std::cerr << strings::error("data_parallel::Trainer error: ") << "a batch of "
+                  << strings::info(std::to_string(batch_size_)) << " can't be split evenly between "
+                  << strings::info(std::to_string(replicas)) << " replicas" << std::endl;
+        exit(-1);
+    }
+
+    shard_size_ = batch_size_ / replicas;
+    for (int i = 0; i < replicas; i++) {
+        replicas_.push_back(graph_->replicate(shard_size_, true));
+    }
+
+    for (auto& [id, node] : graph_->nodes_) {
+        if (node->trainable_ && node->gradient_ != nullptr) {
+            parameters_.push_back(id);
+        }
+    }
+}
+
+int Trainer::replicas() {
+    return replicas_.size();
+}
+
+int Trainer::batchSize() {
+    return batch_size_;
+}
+
+float Trainer::step(const std::unordered_map<std::string, std::vector<float>>& batch, float learning_rate) {
+    int n = replicas_.size();
+
+    // each replica runs its passes single threaded, the replicas themselves are what's spread over the pool
+    std::vector<float> losses(n, 0);
+    parallel::parallelFor(0, n, 1, [&](size_t first, size_t last) {
+        for (size_t r = first; r < last; r++) {
+            parallel::SerialScope serial;
+
+            std::shared_ptr<Graph> replica = replicas_[r];
+            replica->reset();
+            replica->evaluate(shard(batch, r, n));
+            replica->calculateGradient();
+
+            losses[r] = replica->getLoss();
+        }
+    });
+
+    // pairwise, so the reduction takes log2(replicas) rounds and the additions within a round run side by side
+    for (int stride = 1; stride < n; stride *= 2) {
+        int pairs = (n + 2 * stride - 1) / (2 * stride);
+        parallel::parallelFor(0, pairs, 1, [&](size_t first, size_t last) {
+            for (size_t p = first; p < last; p++) {
+                int left = p * 2 * stride;
+                int right = left + stride;
+                if (right >= n) {
+                    continue;
+                }
+
+                for (int id : parameters_) {
+                    std::shared_ptr<GraphBuffer> sum = replicas_[left]->nodes_[id]->gradient_;
+                    buffer_ops::add(sum, replicas_[right]->nodes_[id]->gradient_, sum);
+                }
+            }
+        });
+    }
+
+    for (int id : parameters_) {
+        buffer_ops::copy(replicas_[0]->nodes_[id]->gradient_, graph_->nodes_[id]->gradient_);
+    }
+
+    graph_->applyGradients(batch_size_, learning_rate);
+
+    float loss = 0;
+    for (float l : losses) {
+        loss += l;
+    }
+
+    return loss;
+}
+
+std::unordered_map<std::string, std::vector<float>> shard(
+    const std::unordered_map<std::string, std::vector<float>>& batch, int index, int replicas) {
+    std::unordered_map<std::string, std::vector<float>> slice;
+    for (auto& [name, values] : batch) {
+        if (values.size() % replicas != 0) {
+            std::cerr << strings::error("data_parallel::shard error: ") << "input " << strings::info(name) << " of "
+                      << strings::info(std::to_string(values.size())) << " values can't be split evenly between "
+                      << strings::info(std::to_string(replicas)) << " replicas" << std::endl;
+            exit(-1);
+        }
+
+        size_t size = values.size() / replicas;
+        slice[name] = std::vector<float>(values.begin() + index * size, values.begin() + (index + 1) * size);
+    }
+
+    return slice;
+}
+
+}  // namespace data_parallel
@@ -0,0 +1,262 @@
+#include "dense.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "allocation.h"
+#include "broadcasting.h"
+#include "buffer.h"
+#include "buffer_ops.h"
+#include "gemm.h"
+#include "grad.h"
+#include "graph.h"
+#include "ops.h"
+#include "packing.h"
+#include "parallel.h"
+#include "string_utils.h"
+
+namespace dense {
+
+bool _plain(std::shared_ptr<Node> node, const std::set<int>& kept) {
+    return !node->trainable_ && !node->const_ && kept.find(node->getId()) == kept.end();
+}
+
+// one value per output column, with nothing to broadcast the product up by
+//
+// before allocation only declared shapes are known, x's shape may not be yet but the product has at least w's rank
+bool _is_bias(std::shared_ptr<Node> bias, std::shared_ptr<Node> x, std::shared_ptr<Node> w) {
+    if (bias->shape_.empty() || w->shape_.empty()) {
+        return false;
+    }
+
+    size_t size = 1;
+    for (int dim : bias->shape_) {
+        size *= dim;
+    }
+
+    return size == bias->shape_.back() && bias->shape_.back() == w->shape_.back() &&
+           bias->shape_.size() <= std::max(x->shape_.size(), w->shape_.size());
+}
+
+Report run(std::shared_ptr<Graph> graph, const std::vector<std::string>& keep) {
+    Report report = {0, 0};
+
+    std::set<int> kept;
+    for (const std::string& name : keep) {
+        kept.insert(graph->getNode(name)->getId());
+    }
+
+    std::map<int, int> uses = graph->useCounts();
+    std::map<int, std::vector<std::shared_ptr<Node>>> consumer_map = graph->consumers();
+
+    std::vector<std::shared_ptr<Node>> adds;
+    for (auto& [id, node] : graph->nodes_) {
+        if (node->operation_type_ == operations::add && node->arg_order_.size() == 2 &&
+            node->arg_order_[0] != node->arg_order_[1] && _plain(node, {})) {
+            adds.push_back(node);
+        }
+    }
+
+    for (std::shared_ptr<Node> add : adds) {
+        std::shared_ptr<Node> product;
+        std::shared_ptr<Node> bias;
+        for (int i = 0; i < 2 && product == nullptr; i++) {
+            std::shared_ptr<Node> candidate = add->children_[add->arg_order_[i]];
+            if (candidate->operation_type_ != operations::matmul || candidate->arg_order_.size() != 2 ||
+                uses[candidate->getId()] != 1 || !_plain(candidate, kept)) {
+                continue;
+            }
+
+            std::shared_ptr<Node> x = candidate->children_[candidate->arg_order_[0]];
+            std::shared_ptr<Node> w = candidate->children_[candidate->arg_order_[1]];
+            std::shared_ptr<Node> other = add->children_[add->arg_order_[1 - i]];
+            if (_is_bias(other, x, w)) {
+                product = candidate;
+                bias = other;
+            }
+        }
+
+        if (product == nullptr) {
+            continue;
+        }
+
+        // the activation comes along if the add feeds nothing else
+        std::shared_ptr<Node> root = add;
+        std::string operation = operations::dense;
+        if (uses[add->getId()] == 1 && _plain(add, kept)) {
+            std::shared_ptr<Node> consumer = consumer_map[add->getId()].front();
+            if (consumer->arg_order_.size() == 1 && _plain(consumer, {})) {
+                if (consumer->operation_type_ == operations::relu) {
+                    root = consumer;
+                    operation = operations::dense_relu;
+                } else if (consumer->operation_type_ == operations::sigmoid) {
+                    root = consumer;
+                    operation = operations::dense_sigmoid;
+                }
+            }
+        }
+
+        std::shared_ptr<Node> x = product->children_[product->arg_order_[0]];
+        std::shared_ptr<Node> w = product->children_[product->arg_order_[1]];
+
+        std::shared_ptr<Node> fused = graph->createNode(root->name_ + "_dense", operation, {x, w, bias});
+        if (root->output_ != nullptr) {
+            allocation::allocateNode(fused);
+        }
+
+        graph->replaceNode(root, fused);
+        graph->removeNode(product);
+        if (root != add) {
+            graph->removeNode(add);
+        }
+
+        report.layers_++;
+        report.nodes_fused_ += root == add ? 2 : 3;
+    }
+
+    return report;
+}
+
+Report run(std::shared_ptr<Graph> graph) {
+    return run(graph, {});
+}
+
+void printReport(const Report& report) {
+    std::cout << strings::debug("Dense fusion:") << std::endl;
+    std::cout << strings::debug("- dense layers: ") << strings::info(std::to_string(report.layers_)) << std::endl;
+    std::cout << strings::debug("- nodes absorbed: ") << strings::info(std::to_string(report.nodes_fused_))
+              << std::endl;
+}
+
+gemm::Activation _activation(std::shared_ptr<Node> node) {
+    if (node->operation_type_ == operations::dense_relu) {
+        return gemm::Activation::relu;
+    } else if (node->operation_type_ == operations::dense_sigmoid) {
+        return gemm::Activation::sigmoid;
+    }
+
+    return gemm::Activation::none;
+}
+
+// the gemm epilogue is float32 only, other dtypes add the bias and apply the activation in a second pass
+template <typename T>
+void _forward_unfused(std::shared_ptr<Node> node) {
+    std::shared_ptr<Node> x = node->children_[node->arg_order_[0]];
+    std::shared_ptr<Node> w = node->children_[node->arg_order_[1]];
+    std::shared_ptr<Node> bias = node->children_[node->arg_order_[2]];
+
+    buffer_ops::matmul(x->output_, w->output_, node->output_, x->shape_, w->shape_, node->shape_);
+
+    T* out = (T*)node->output_->getData();
+    const T* b = (const T*)bias->output_->getData();
+    T* mask = node->saved_ == nullptr ? nullptr : (T*)node->saved_->getData();
+
+    size_t columns = node->shape_.back();
+    gemm::Activation activation = _activation(node);
+
+    parallel::parallelFor(0, node->output_->size(), parallel::GRAIN, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            dtypes::Accumulate<T> value = out[i] + b[i % columns];
+            if (activation == gemm::Activation::relu) {
+                if (mask != nullptr) {
+                    mask[i] = value > 0 ? 1 : 0;
+                }
+
+                value = value > 0 ? value : 0;
+            } else if (activation == gemm::Activation::sigmoid) {
+                value = 1 / (1 + std::exp(-value));
+            }
+
+            out[i] = value;
+        }
+    });
+}
+
+void forward(std::shared_ptr<Node> node) {
+    if (node->dtype_ != DTYPE::float32) {
+        dtypes::dispatch(node->dtype_, [&]<typename T>() { _forward_unfused<T>(node); });
+        return;
+    }
+
+    std::shared_ptr<Node> x = node->children_[node->arg_order_[0]];
+    std::shared_ptr<Node> w = node->children_[node->arg_order_[1]];
+    std::shared_ptr<Node> bias = node->children_[node->arg_order_[2]];
+
+    gemm::Epilogue epilogue = gemm::none();
+    epilogue.bias_ = (const float*)bias->output_->getData();
+    epilogue.activation_ = _activation(node);
+    if (node->saved_ != nullptr) {
+        epilogue.mask_ = (float*)node->saved_->getData();
+    }
+
+    if (packing::packable(w)) {
+        buffer_ops::matmul(x->output_, *packing::get(w, false), node->output_, epilogue);
+        return;
+    }
+
+    buffer_ops::matmul(x->output_, w->output_, node->output_, x->shape_, w->shape_, node->shape_, epilogue);
+}
+
+void backward(std::shared_ptr<Node> node) {
+    std::shared_ptr<Node> bias = node->children_[node->arg_order_[2]];
+
+    // gradient wrt the pre-activation, i.e. the product + bias
+    std::shared_ptr<GraphBuffer> upstream(new GraphBuffer(node->gradient_->shape(), node->gradient_->dtype()));
+
+    dtypes::dispatch(node->dtype_, [&]<typename T>() {
+        const T* grad = (const T*)node->gradient_->getData();
+        T* out = (T*)upstream->getData();
+        size_t size = upstream->size();
+
+        switch (_activation(node)) {
+            case gemm::Activation::relu: {
+                const T* mask = (const T*)node->saved_->getData();
+                for (size_t i = 0; i < size; i++) {
+                    out[i] = grad[i] * mask[i];
+                }
+
+                break;
+            }
+            case gemm::Activation::sigmoid: {
+                const T* y = (const T*)node->output_->getData();
+                for (size_t i = 0; i < size; i++) {
+                    out[i] = grad[i] * y[i] * (1 - y[i]);
+                }
+
+                break;
+            }
+            default:
+                for (size_t i = 0; i < size; i++) {
+                    out[i] = grad[i];
+                }
+        }
+    });
+
+    gradient::_matmul_gradient(node, upstream);
+
+    if (bias->operation_type_ == operations::constant) {
+        return;
+    }
+
+    // summed over every row the bias was broadcast across
+    std::vector<int> bias_shape = broadcasting::padVector(bias->gradient_->shape(), upstream->shape().size());
+
+    std::vector<int> reduction_indices;
+    for (int i = 0; i < bias_shape.size(); i++) {
+        if (bias_shape[i] == 1) {
+            reduction_indices.push_back(i);
+        }
+    }
+
+    std::shared_ptr<GraphBuffer> reduced(new GraphBuffer(bias_shape, upstream->dtype()));
+    buffer_ops::reduceSum(upstream, reduced, reduction_indices);
+    buffer_ops::multiply(reduced, bias->gradient_, bias->gradient_);
+}
+
+}  // namespace dense
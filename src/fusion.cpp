@@ -0,0 +1,578 @@
+#include "fusion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "allocation.h"
+#include "broadcasting.h"
+#include "buffer.h"
+#include "buffer_ops.h"
+#include "graph.h"
+#include "kernel.h"
+#include "ops.h"
+#include "parallel.h"
+#include "string_utils.h"
+
+namespace fusion {
+
+// elements per tile
+// small enough that a tile of every value in the program stays in L1
+static const size_t TILE = 256;
+
+// tiles handed to a thread at a time
+static const size_t GRAIN_TILES = 16;
+
+static const std::map<std::string, Opcode> OPCODES = {
+    {operations::add, Opcode::add},         {operations::subtract, Opcode::subtract},
+    {operations::multiply, Opcode::multiply}, {operations::divide, Opcode::divide},
+    {operations::relu, Opcode::relu},       {operations::sigmoid, Opcode::sigmoid},
+    {operations::exp, Opcode::exp},         {operations::ln, Opcode::ln},
+    {operations::sqrt, Opcode::sqrt},       {operations::pow, Opcode::pow},
+};
+
+static const std::map<Opcode, std::string> OPCODE_NAMES = {
+    {Opcode::add, "add"},         {Opcode::subtract, "subtract"}, {Opcode::multiply, "multiply"},
+    {Opcode::divide, "divide"},   {Opcode::relu, "relu"},         {Opcode::sigmoid, "sigmoid"},
+    {Opcode::exp, "exp"},         {Opcode::ln, "ln"},             {Opcode::sqrt, "sqrt"},
+    {Opcode::pow, "pow"},
+};
+
+std::string Program::toString() {
+    std::stringstream stream;
+    for (int i = 0; i < instructions_.size(); i++) {
+        const Instruction& instruction = instructions_[i];
+
+        stream << "v" << leaves_ + i << " = " << OPCODE_NAMES.at(instruction.op_) << "(v" << instruction.a_;
+        if (instruction.op_ == Opcode::pow) {
+            stream << ", " << instruction.scalar_;
+        } else if (instruction.b_ >= 0) {
+            stream << ", v" << instruction.b_;
+        }
+
+        stream << ")" << (i < instructions_.size() - 1 ? "; " : "");
+    }
+
+    return stream.str();
+}
+
+bool fusible(std::shared_ptr<Node> node) {
+    auto it = OPCODES.find(node->operation_type_);
+    if (it == OPCODES.end() || node->trainable_ || node->const_) {
+        return false;
+    }
+
+    switch (it->second) {
+        case Opcode::add:
+        case Opcode::subtract:
+        case Opcode::multiply:
+        case Opcode::divide:
+            return node->arg_order_.size() == 2;
+        case Opcode::pow:
+            return node->arg_order_.size() == 2 &&
+                   node->children_[node->arg_order_[1]]->operation_type_ == operations::constant;
+        default:
+            return node->arg_order_.size() == 1;
+    }
+}
+
+struct _Group {
+    std::vector<std::shared_ptr<Node>> leaves_;
+    std::map<int, int> values_;  // node id -> value index
+
+    std::vector<std::shared_ptr<Node>> absorbed_;
+    std::vector<Instruction> instructions_;
+};
+
+// first pass, figures out the leaves so instruction values can be numbered after them
+void _collect(std::shared_ptr<Node> node, std::function<bool(std::shared_ptr<Node>)> absorbable, _Group& group) {
+    for (int i = 0; i < node->arg_order_.size(); i++) {
+        std::shared_ptr<Node> child = node->children_[node->arg_order_[i]];
+
+        if (node->operation_type_ == operations::pow && i == 1) {
+            continue;
+        }
+
+        if (absorbable(child)) {
+            if (std::find(group.absorbed_.begin(), group.absorbed_.end(), child) == group.absorbed_.end()) {
+                group.absorbed_.push_back(child);
+                _collect(child, absorbable, group);
+            }
+        } else if (group.values_.find(child->getId()) == group.values_.end()) {
+            group.values_[child->getId()] = group.leaves_.size();
+            group.leaves_.push_back(child);
+        }
+    }
+}
+
+// second pass, emits instructions in dependency order
+int _emit(std::shared_ptr<Node> node, _Group& group) {
+    auto it = group.values_.find(node->getId());
+    if (it != group.values_.end()) {
+        return it->second;
+    }
+
+    Instruction instruction = {OPCODES.at(node->operation_type_), -1, -1, 0};
+
+    instruction.a_ = _emit(node->children_[node->arg_order_[0]], group);
+    if (instruction.op_ == Opcode::pow) {
+        instruction.scalar_ = std::stof(node->children_[node->arg_order_[1]]->name_);
+    } else if (node->arg_order_.size() == 2) {
+        instruction.b_ = _emit(node->children_[node->arg_order_[1]], group);
+    }
+
+    group.instructions_.push_back(instruction);
+
+    int value = group.leaves_.size() + group.instructions_.size() - 1;
+    group.values_[node->getId()] = value;
+
+    return value;
+}
+
+Report run(std::shared_ptr<Graph> graph, const std::vector<std::string>& keep) {
+    Report report = {0, 0};
+
+    std::set<int> kept;
+    for (const std::string& name : keep) {
+        kept.insert(graph->getNode(name)->getId());
+    }
+
+    std::map<int, std::vector<std::shared_ptr<Node>>> consumer_map = graph->consumers();
+
+    // absorbed into whichever group its consumer ends up in
+    // repeated use by that one consumer is fine, the value is computed once in the program
+    auto absorbable = [&](std::shared_ptr<Node> node) {
+        auto it = consumer_map.find(node->getId());
+        return fusible(node) && kept.find(node->getId()) == kept.end() && it != consumer_map.end() &&
+               it->second.size() == 1 && fusible(it->second.front());
+    };
+
+    std::vector<std::shared_ptr<Node>> roots;
+    for (auto& [id, node] : graph->nodes_) {
+        if (fusible(node) && !absorbable(node)) {
+            roots.push_back(node);
+        }
+    }
+
+    for (std::shared_ptr<Node> root : roots) {
+        _Group group;
+        _collect(root, absorbable, group);
+
+        // a lone node gains nothing
+        if (group.absorbed_.empty()) {
+            continue;
+        }
+
+        _emit(root, group);
+
+        std::shared_ptr<Program> program(new Program());
+        program->leaves_ = group.leaves_.size();
+        program->instructions_ = group.instructions_;
+
+        std::shared_ptr<Node> fused = graph->createNode(root->name_ + "_fused", operations::fused, group.leaves_);
+        fused->program_ = program;
+
+        // fusing an allocated graph, the intermediates' buffers are released along with them
+        if (root->output_ != nullptr) {
+            allocation::allocateNode(fused);
+        }
+
+        graph->replaceNode(root, fused);
+        for (std::shared_ptr<Node> node : group.absorbed_) {
+            graph->removeNode(node);
+        }
+
+        report.groups_++;
+        report.nodes_fused_ += group.absorbed_.size() + 1;
+    }
+
+    return report;
+}
+
+Report run(std::shared_ptr<Graph> graph) {
+    return run(graph, {});
+}
+
+void printReport(const Report& report) {
+    std::cout << strings::debug("Fusion:") << std::endl;
+    std::cout << strings::debug("- fused nodes: ") << strings::info(std::to_string(report.groups_)) << std::endl;
+    std::cout << strings::debug("- element-wise nodes absorbed: ") << strings::info(std::to_string(report.nodes_fused_))
+              << std::endl;
+}
+
+// how each leaf maps onto the (broadcasted) output
+class _Layout {
+   public:
+    _Layout(std::shared_ptr<Node> node) {
+        shape_ = node->output_->shape();
+        size_ = node->output_->size();
+
+        for (const std::string& arg : node->arg_order_) {
+            std::shared_ptr<GraphBuffer> buffer = node->children_[arg]->output_;
+            std::vector<int> padded = broadcasting::padVector(buffer->shape(), shape_.size());
+
+            std::vector<size_t> strides(shape_.size(), 0);
+            size_t stride = 1;
+            for (int i = shape_.size() - 1; i > -1; i--) {
+                strides[i] = padded[i] == 1 ? 0 : stride;
+                stride *= padded[i];
+            }
+
+            strides_.push_back(strides);
+            contiguous_.push_back(buffer->size() == size_);
+        }
+    }
+
+    // offsets of `leaf` for the output elements [start, start + n)
+    void offsets(int leaf, size_t start, size_t n, size_t* out) {
+        std::vector<int> index(shape_.size());
+        size_t remainder = start;
+        size_t offset = 0;
+        for (int i = shape_.size() - 1; i > -1; i--) {
+            index[i] = remainder % shape_[i];
+            remainder /= shape_[i];
+            offset += index[i] * strides_[leaf][i];
+        }
+
+        const std::vector<size_t>& strides = strides_[leaf];
+        for (size_t e = 0; e < n; e++) {
+            out[e] = offset;
+
+            for (int i = shape_.size() - 1; i > -1; i--) {
+                index[i]++;
+                offset += strides[i];
+
+                if (index[i] < shape_[i]) {
+                    break;
+                }
+
+                offset -= strides[i] * shape_[i];
+                index[i] = 0;
+            }
+        }
+    }
+
+    std::vector<int> shape_;
+    size_t size_;
+
+    std::vector<std::vector<size_t>> strides_;
+    std::vector<bool> contiguous_;
+};
+
+template <typename T>
+void _apply(const Instruction& instruction, const T* a, const T* b, T* out, size_t n) {
+    switch (instruction.op_) {
+        case Opcode::add:
+            for (size_t i = 0; i < n; i++) out[i] = a[i] + b[i];
+            break;
+        case Opcode::subtract:
+            for (size_t i = 0; i < n; i++) out[i] = a[i] - b[i];
+            break;
+        case Opcode::multiply:
+            for (size_t i = 0; i < n; i++) out[i] = a[i] * b[i];
+            break;
+        case Opcode::divide:
+            for (size_t i = 0; i < n; i++) out[i] = a[i] / b[i];
+            break;
+        case Opcode::relu:
+            for (size_t i = 0; i < n; i++) out[i] = a[i] > 0 ? a[i] : 0;
+            break;
+        case Opcode::sigmoid:
+            for (size_t i = 0; i < n; i++) out[i] = 1 / (1 + std::exp(-a[i]));
+            break;
+        case Opcode::exp:
+            for (size_t i = 0; i < n; i++) out[i] = std::exp(a[i]);
+            break;
+        case Opcode::ln:
+            for (size_t i = 0; i < n; i++) out[i] = std::log(a[i]);
+            break;
+        case Opcode::sqrt:
+            for (size_t i = 0; i < n; i++) out[i] = std::sqrt(a[i]);
+            break;
+        case Opcode::pow:
+            if (instruction.scalar_ == 2) {
+                for (size_t i = 0; i < n; i++) out[i] = a[i] * a[i];
+            } else {
+                for (size_t i = 0; i < n; i++) out[i] = std::pow(a[i], instruction.scalar_);
+            }
+            break;
+    }
+}
+
+// adds the derivative of `instruction` wrt its operands, scaled by `grad`, into `a_grad` and `b_grad`
+// `out` is the instruction's forward result
+template <typename T>
+void _apply_gradient(const Instruction& instruction, const T* a, const T* b, const T* out,
+                     const T* grad, T* a_grad, T* b_grad, size_t n) {
+    switch (instruction.op_) {
+        case Opcode::add:
+            for (size_t i = 0; i < n; i++) a_grad[i] += grad[i];
+            for (size_t i = 0; i < n; i++) b_grad[i] += grad[i];
+            break;
+        case Opcode::subtract:
+            for (size_t i = 0; i < n; i++) a_grad[i] += grad[i];
+            for (size_t i = 0; i < n; i++) b_grad[i] -= grad[i];
+            break;
+        case Opcode::multiply:
+            for (size_t i = 0; i < n; i++) a_grad[i] += grad[i] * b[i];
+            for (size_t i = 0; i < n; i++) b_grad[i] += grad[i] * a[i];
+            break;
+        case Opcode::divide:
+            for (size_t i = 0; i < n; i++) a_grad[i] += grad[i] / b[i];
+            for (size_t i = 0; i < n; i++) b_grad[i] -= grad[i] * out[i] / b[i];
+            break;
+        case Opcode::relu:
+            for (size_t i = 0; i < n; i++) a_grad[i] += a[i] > EPSILON ? grad[i] : 0;
+            break;
+        case Opcode::sigmoid:
+            for (size_t i = 0; i < n; i++) a_grad[i] += grad[i] * out[i] * (1 - out[i]);
+            break;
+        case Opcode::exp:
+            for (size_t i = 0; i < n; i++) a_grad[i] += grad[i] * out[i];
+            break;
+        case Opcode::ln:
+            for (size_t i = 0; i < n; i++) a_grad[i] += grad[i] / a[i];
+            break;
+        case Opcode::sqrt:
+            for (size_t i = 0; i < n; i++) a_grad[i] += grad[i] * (T)0.5 / out[i];
+            break;
+        case Opcode::pow: {
+            T p = instruction.scalar_;
+            if (p == 2) {
+                for (size_t i = 0; i < n; i++) a_grad[i] += grad[i] * 2 * a[i];
+            } else {
+                for (size_t i = 0; i < n; i++) a_grad[i] += grad[i] * p * std::pow(a[i], p - 1);
+            }
+            break;
+        }
+    }
+}
+
+// points `values[leaf]` at the leaf's elements for the tile [start, start + n)
+// contiguous leaves are read in place, everything else is gathered into `scratch`
+//
+// the program runs in `A`, leaves stored as anything else (i.e. half precision) are converted on the way in
+template <typename T, typename A>
+void _load_leaves(std::shared_ptr<Node> node, _Layout& layout, size_t start, size_t n,
+                  std::vector<const A*>& values, A* scratch, size_t* offsets) {
+    for (int leaf = 0; leaf < node->program_->leaves_; leaf++) {
+        const T* data = (T*)node->children_[node->arg_order_[leaf]]->output_->getData();
+
+        if constexpr (std::is_same_v<T, A>) {
+            if (layout.contiguous_[leaf]) {
+                values[leaf] = data + start;
+                continue;
+            }
+        }
+
+        A* gathered = scratch + leaf * TILE;
+        if (layout.contiguous_[leaf]) {
+            std::copy(data + start, data + start + n, gathered);
+            values[leaf] = gathered;
+            continue;
+        }
+
+        layout.offsets(leaf, start, n, offsets);
+        for (size_t i = 0; i < n; i++) {
+            gathered[i] = data[offsets[i]];
+        }
+
+        values[leaf] = gathered;
+    }
+}
+
+template <typename T>
+void _forward(std::shared_ptr<Node> node) {
+    using A = dtypes::Accumulate<T>;
+
+    const Program& program = *node->program_;
+    _Layout layout(node);
+
+    int value_count = program.leaves_ + program.instructions_.size();
+    T* output = (T*)node->output_->getData();
+
+    size_t tiles = (layout.size_ + TILE - 1) / TILE;
+    parallel::parallelFor(0, tiles, GRAIN_TILES, [&](size_t first, size_t last) {
+        std::vector<A> scratch(value_count * TILE);
+        std::vector<size_t> offsets(TILE);
+        std::vector<const A*> values(value_count);
+
+        for (size_t start = first * TILE; start < std::min(layout.size_, last * TILE); start += TILE) {
+            size_t n = std::min(TILE, layout.size_ - start);
+
+            _load_leaves<T, A>(node, layout, start, n, values, scratch.data(), offsets.data());
+
+            for (int i = 0; i < program.instructions_.size(); i++) {
+                const Instruction& instruction = program.instructions_[i];
+                int value = program.leaves_ + i;
+
+                // the last instruction writes straight into the output unless it has to be rounded down to it
+                A* out = scratch.data() + value * TILE;
+                if constexpr (std::is_same_v<T, A>) {
+                    if (i == program.instructions_.size() - 1) {
+                        out = output + start;
+                    }
+                }
+
+                _apply(instruction, values[instruction.a_], instruction.b_ >= 0 ? values[instruction.b_] : nullptr,
+                       out, n);
+
+                values[value] = out;
+            }
+
+            if constexpr (!std::is_same_v<T, A>) {
+                std::copy(values[value_count - 1], values[value_count - 1] + n, output + start);
+            }
+        }
+    });
+}
+
+template <typename T>
+void _backward(std::shared_ptr<Node> node) {
+    using A = dtypes::Accumulate<T>;
+
+    const Program& program = *node->program_;
+    _Layout layout(node);
+
+    int value_count = program.leaves_ + program.instructions_.size();
+
+    // gradients wrt each leaf, reduced down to the leaf's shape
+    // summed in `A`, and only rounded down to the leaf's dtype once they're complete
+    DTYPE accumulate_dtype = dtypes::isHalf(node->dtype_) ? DTYPE::float32 : node->dtype_;
+
+    std::vector<std::shared_ptr<GraphBuffer>> leaf_grads;
+    for (const std::string& arg : node->arg_order_) {
+        std::shared_ptr<Node> leaf = node->children_[arg];
+        leaf_grads.push_back(std::shared_ptr<GraphBuffer>(new GraphBuffer(leaf->gradient_->shape(), accumulate_dtype)));
+    }
+
+    const T* upstream = (T*)node->gradient_->getData();
+
+    size_t tiles = (layout.size_ + TILE - 1) / TILE;
+    size_t chunk = parallel::chunkSize(tiles, GRAIN_TILES);
+    size_t chunks = (tiles + chunk - 1) / chunk;
+
+    // contiguous leaves are written by one tile each, broadcasted leaves are shared between tiles
+    // so each chunk accumulates those privately and they're summed in chunk order afterwards
+    std::vector<std::vector<std::vector<A>>> partials(chunks, std::vector<std::vector<A>>(program.leaves_));
+
+    parallel::parallelFor(0, chunks, 1, [&](size_t first_chunk, size_t last_chunk) {
+        std::vector<A> scratch(value_count * TILE);
+        std::vector<A> grads(value_count * TILE);
+        std::vector<size_t> offsets(TILE);
+        std::vector<const A*> values(value_count);
+
+        for (size_t c = first_chunk; c < last_chunk; c++) {
+            std::vector<A*> leaf_targets(program.leaves_);
+            for (int leaf = 0; leaf < program.leaves_; leaf++) {
+                if (layout.contiguous_[leaf]) {
+                    leaf_targets[leaf] = (A*)leaf_grads[leaf]->getData();
+                } else {
+                    partials[c][leaf].assign(leaf_grads[leaf]->size(), 0);
+                    leaf_targets[leaf] = partials[c][leaf].data();
+                }
+            }
+
+            for (size_t start = c * chunk * TILE; start < std::min(layout.size_, (c + 1) * chunk * TILE);
+                 start += TILE) {
+                size_t n = std::min(TILE, layout.size_ - start);
+
+                // recompute the tile's intermediates
+                _load_leaves<T, A>(node, layout, start, n, values, scratch.data(), offsets.data());
+                for (int i = 0; i < program.instructions_.size(); i++) {
+                    const Instruction& instruction = program.instructions_[i];
+                    int value = program.leaves_ + i;
+
+                    A* out = scratch.data() + value * TILE;
+                    _apply(instruction, values[instruction.a_],
+                           instruction.b_ >= 0 ? values[instruction.b_] : nullptr, out, n);
+
+                    values[value] = out;
+                }
+
+                // reverse sweep
+                std::fill(grads.begin(), grads.end(), 0);
+                std::copy(upstream + start, upstream + start + n, grads.data() + (value_count - 1) * TILE);
+
+                for (int i = program.instructions_.size() - 1; i > -1; i--) {
+                    const Instruction& instruction = program.instructions_[i];
+                    int value = program.leaves_ + i;
+
+                    A* b_grad = instruction.b_ >= 0 ? grads.data() + instruction.b_ * TILE : nullptr;
+                    _apply_gradient(instruction, values[instruction.a_],
+                                    instruction.b_ >= 0 ? values[instruction.b_] : nullptr, values[value],
+                                    grads.data() + value * TILE, grads.data() + instruction.a_ * TILE, b_grad, n);
+                }
+
+                // broadcasted leaves accumulate into their own shape
+                for (int leaf = 0; leaf < program.leaves_; leaf++) {
+                    A* leaf_grad = leaf_targets[leaf];
+                    const A* grad = grads.data() + leaf * TILE;
+
+                    if (layout.contiguous_[leaf]) {
+                        for (size_t i = 0; i < n; i++) {
+                            leaf_grad[start + i] += grad[i];
+                        }
+                    } else {
+                        layout.offsets(leaf, start, n, offsets.data());
+                        for (size_t i = 0; i < n; i++) {
+                            leaf_grad[offsets[i]] += grad[i];
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    for (int leaf = 0; leaf < program.leaves_; leaf++) {
+        if (layout.contiguous_[leaf]) {
+            continue;
+        }
+
+        A* leaf_grad = (A*)leaf_grads[leaf]->getData();
+        for (size_t c = 0; c < chunks; c++) {
+            for (size_t i = 0; i < partials[c][leaf].size(); i++) {
+                leaf_grad[i] += partials[c][leaf][i];
+            }
+        }
+    }
+
+    for (int leaf = 0; leaf < program.leaves_; leaf++) {
+        std::shared_ptr<Node> child = node->children_[node->arg_order_[leaf]];
+        if (child->operation_type_ == operations::constant) {
+            continue;
+        }
+
+        std::shared_ptr<GraphBuffer> leaf_grad = leaf_grads[leaf];
+        if (leaf_grad->dtype() != child->gradient_->dtype()) {
+            leaf_grad = std::shared_ptr<GraphBuffer>(new GraphBuffer(leaf_grad->shape(), child->gradient_->dtype()));
+            buffer_ops::copy(leaf_grads[leaf], leaf_grad);
+        }
+
+        buffer_ops::multiply(leaf_grad, child->gradient_, child->gradient_);
+    }
+}
+
+void forward(std::shared_ptr<Node> node) {
+    if (node->program_ == nullptr) {
+        std::cerr << strings::error("fusion::forward error: ") << "node " << strings::info(node->name_)
+                  << " has no fused program, fused nodes are created by fusion::run" << std::endl;
+        exit(-1);
+    }
+
+    dtypes::dispatch(node->dtype_, [&]<typename T>() { _forward<T>(node); });
+}
+
+void backward(std::shared_ptr<Node> node) {
+    dtypes::dispatch(node->dtype_, [&]<typename T>() { _backward<T>(node); });
+}
+
+}  // namespace fusion
@@ -0,0 +1,910 @@
+#include "gemm.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "parallel.h"
+#include "simd.h"
+
+namespace gemm {
+
+// register tile, MR rows of NR columns
+constexpr int MR = 4;
+constexpr int NR = 2 * simd::WIDTH;
+constexpr int NV = NR / simd::WIDTH;
+
+// cache blocking, MC and NC must be multiples of MR and NR respectively
+constexpr int MC = 128;
+constexpr int KC = 256;
+constexpr int NC = 2048;
+
+// multiply-adds below which a product isn't split across threads
+constexpr size_t PARALLEL_WORK = 64 * 64 * 64;
+
+// multiply-adds handed to a thread at a time by dgemm, whose rows are split up directly
+constexpr size_t GRAIN_WORK = 32 * 32 * 32;
+
+// matrix-vector products: rows of A read at once, columns of y summed into a block in L1 at once,
+// and how far ahead of the row being read it's prefetched, in floats
+constexpr int GEMV_ROWS = 4;
+constexpr int GEMV_COLUMNS = 1024;
+constexpr int PREFETCH = 128;
+
+// quantized dot product tile, QM rows of QR columns
+constexpr int QM = 2;
+constexpr int QR = 4;
+
+Epilogue none() {
+    return {1, nullptr, Activation::none, nullptr};
+}
+
+std::vector<float>& _a_pack() {
+    static thread_local std::vector<float> pack(MC * KC);
+    return pack;
+}
+
+std::vector<float>& _b_pack() {
+    static thread_local std::vector<float> pack(KC * NC);
+    return pack;
+}
+
+// micro-panels of MR rows, each laid out k-major and zero padded past the last row
+// half precision operands are converted here, so everything past packing is float32
+// `alpha` is multiplied in on the way, so it scales the product and nothing else
+template <typename TI>
+void _pack_a(int mc, int kc, const TI* a, int rsa, int csa, float alpha, float* out) {
+    for (int ir = 0; ir < mc; ir += MR) {
+        int mr = std::min(MR, mc - ir);
+        for (int p = 0; p < kc; p++) {
+            for (int r = 0; r < MR; r++) {
+                *out++ = r < mr ? (float)a[(ir + r) * rsa + p * csa] * alpha : 0;
+            }
+        }
+    }
+}
+
+// micro-panels of NR columns, each laid out k-major and zero padded past the last column
+template <typename TI>
+void _pack_b(int kc, int nc, const TI* b, int rsb, int csb, float* out) {
+    for (int jr = 0; jr < nc; jr += NR) {
+        int nr = std::min(NR, nc - jr);
+        for (int p = 0; p < kc; p++) {
+            for (int c = 0; c < NR; c++) {
+                *out++ = c < nr ? (float)b[p * rsb + (jr + c) * csb] : 0;
+            }
+        }
+    }
+}
+
+float _sigmoid(float x) {
+    return 1 / (1 + std::exp(-x));
+}
+
+// `bias` and `mask` are already offset to the value's position
+float _epilogue(float x, const Epilogue& epilogue, const float* bias, float* mask) {
+    x *= epilogue.scale_;
+    if (bias != nullptr) {
+        x += *bias;
+    }
+
+    switch (epilogue.activation_) {
+        case Activation::relu:
+            if (mask != nullptr) {
+                *mask = x > 0 ? 1 : 0;
+            }
+
+            return x > 0 ? x : 0;
+        case Activation::sigmoid:
+            return _sigmoid(x);
+        default:
+            return x;
+    }
+}
+
+// computes the [mr x nr] tile of C at `c` from packed micro-panels
+//
+// `accumulate` adds onto what's already in C, i.e. the partial sums of the previous k blocks
+// `epilogue` is only given on the last k block, with `bias` and `mask` offset to the tile
+void _micro_kernel(int kc, const float* ap, const float* bp, float* c, int ldc, int mr, int nr, bool accumulate,
+                   const Epilogue* epilogue, const float* bias, float* mask) {
+    simd::vec acc[MR][NV];
+    for (int r = 0; r < MR; r++) {
+        for (int v = 0; v < NV; v++) {
+            acc[r][v] = simd::zero();
+        }
+    }
+
+    for (int p = 0; p < kc; p++) {
+        simd::vec b[NV];
+        for (int v = 0; v < NV; v++) {
+            b[v] = simd::load(bp + v * simd::WIDTH);
+        }
+
+        for (int r = 0; r < MR; r++) {
+            simd::vec a = simd::broadcast(ap[r]);
+            for (int v = 0; v < NV; v++) {
+                acc[r][v] = simd::fmadd(a, b[v], acc[r][v]);
+            }
+        }
+
+        ap += MR;
+        bp += NR;
+    }
+
+    // edge tiles go through a scratch tile and the scalar epilogue
+    if (mr < MR || nr < NR) {
+        float tile[MR * NR];
+        for (int r = 0; r < MR; r++) {
+            for (int v = 0; v < NV; v++) {
+                simd::store(tile + r * NR + v * simd::WIDTH, acc[r][v]);
+            }
+        }
+
+        for (int r = 0; r < mr; r++) {
+            for (int j = 0; j < nr; j++) {
+                float x = tile[r * NR + j];
+                if (accumulate) {
+                    x += c[r * ldc + j];
+                }
+
+                if (epilogue != nullptr) {
+                    x = _epilogue(x, *epilogue, bias == nullptr ? nullptr : bias + j,
+                                  mask == nullptr ? nullptr : mask + r * ldc + j);
+                }
+
+                c[r * ldc + j] = x;
+            }
+        }
+
+        return;
+    }
+
+    simd::vec scale = simd::broadcast(epilogue == nullptr ? 1 : epilogue->scale_);
+    for (int r = 0; r < MR; r++) {
+        for (int v = 0; v < NV; v++) {
+            float* out = c + r * ldc + v * simd::WIDTH;
+
+            simd::vec x = acc[r][v];
+            if (accumulate) {
+                x = simd::add(x, simd::load(out));
+            }
+
+            if (epilogue != nullptr) {
+                x = simd::mul(x, scale);
+                if (bias != nullptr) {
+                    x = simd::add(x, simd::load(bias + v * simd::WIDTH));
+                }
+
+                if (epilogue->activation_ == Activation::relu) {
+                    if (mask != nullptr) {
+                        simd::store(mask + r * ldc + v * simd::WIDTH, simd::step(x));
+                    }
+
+                    x = simd::max(x, simd::zero());
+                }
+            }
+
+            simd::store(out, x);
+
+            // there's no vector exp to lean on, the values are still in L1 at least
+            if (epilogue != nullptr && epilogue->activation_ == Activation::sigmoid) {
+                for (int j = 0; j < simd::WIDTH; j++) {
+                    out[j] = _sigmoid(out[j]);
+                }
+            }
+        }
+    }
+}
+
+int _round_up(int x, int multiple) {
+    return (x + multiple - 1) / multiple * multiple;
+}
+
+// C = alpha * A @ B + beta * C, then the epilogue
+//
+// A is addressed as a[i * rsa + p * csa], B as b[p * rsb + j * csb], so a transposed operand is just swapped strides
+// `packed` is all of B already packed (see gemm::pack), in which case `b` isn't read
+template <typename TI>
+void _sgemm(int m, int n, int k, float alpha, const TI* a, int rsa, int csa, const TI* b, int rsb, int csb,
+            float beta, float* c, int ldc, const Epilogue& epilogue, const float* packed) {
+    if (m <= 0 || n <= 0) {
+        return;
+    }
+
+    // C is then accumulated onto as if it were the partial sum of an earlier k block
+    // a beta of 0 never reads C, whatever's in it
+    if (beta != 0 && beta != 1) {
+        for (int i = 0; i < m; i++) {
+            for (int j = 0; j < n; j++) {
+                c[i * ldc + j] *= beta;
+            }
+        }
+    }
+
+    if (k <= 0) {
+        for (int i = 0; i < m; i++) {
+            for (int j = 0; j < n; j++) {
+                c[i * ldc + j] = _epilogue(beta == 0 ? 0 : c[i * ldc + j], epilogue,
+                                           epilogue.bias_ == nullptr ? nullptr : epilogue.bias_ + j,
+                                           epilogue.mask_ == nullptr ? nullptr : epilogue.mask_ + i * ldc + j);
+            }
+        }
+
+        return;
+    }
+
+    // too little work to be worth handing out, everything runs on the calling thread
+    bool serial = (size_t)m * n * k < PARALLEL_WORK;
+
+    // a thread waiting on a parallel product can pick up another product's work in the meantime,
+    // so a parallel product can't share the thread's B panel
+    std::vector<float> b_local;
+    float* b_pack = _b_pack().data();
+    if (!serial && packed == nullptr) {
+        b_local.resize(KC * ((std::min(NC, n) + NR - 1) / NR) * NR);
+        b_pack = b_local.data();
+    }
+
+    for (int jc = 0; jc < n; jc += NC) {
+        int nc = std::min(NC, n - jc);
+
+        // output tiles are split into row blocks of MC, and then into column groups if that's not enough to go around
+        int panels = (nc + NR - 1) / NR;
+        int row_blocks = (m + MC - 1) / MC;
+        int column_groups = serial ? 1 : std::max(1, std::min(panels, parallel::threadCount() / row_blocks));
+        int group_panels = (panels + column_groups - 1) / column_groups;
+
+        for (int pc = 0; pc < k; pc += KC) {
+            int kc = std::min(KC, k - pc);
+            bool last = pc + kc == k;
+
+            const float* b_panel = b_pack;
+            if (packed != nullptr) {
+                b_panel = packed + (size_t)jc * k + (size_t)pc * _round_up(nc, NR);
+            } else {
+                parallel::parallelFor(0, panels, serial ? panels : 1, [&](size_t first, size_t end) {
+                    int width = std::min(nc, (int)end * NR) - first * NR;
+                    _pack_b(kc, width, b + pc * rsb + (jc + first * NR) * csb, rsb, csb, b_pack + first * NR * kc);
+                });
+            }
+
+            int blocks = row_blocks * column_groups;
+            parallel::parallelFor(0, blocks, serial ? blocks : 1, [&](size_t first, size_t end) {
+                // packed on whichever thread picks up the block
+                float* a_pack = _a_pack().data();
+
+                for (size_t block = first; block < end; block++) {
+                    int ic = (block / column_groups) * MC;
+                    int mc = std::min(MC, m - ic);
+
+                    int jr_begin = (block % column_groups) * group_panels * NR;
+                    int jr_end = std::min(nc, jr_begin + group_panels * NR);
+
+                    // the same row block is packed once for consecutive column groups on this thread
+                    if (block == first || block % column_groups == 0) {
+                        _pack_a(mc, kc, a + ic * rsa + pc * csa, rsa, csa, alpha, a_pack);
+                    }
+
+                    for (int jr = jr_begin; jr < jr_end; jr += NR) {
+                        for (int ir = 0; ir < mc; ir += MR) {
+                            int row = ic + ir;
+                            int col = jc + jr;
+
+                            const float* bias = epilogue.bias_ == nullptr ? nullptr : epilogue.bias_ + col;
+                            float* mask = epilogue.mask_ == nullptr ? nullptr : epilogue.mask_ + row * ldc + col;
+
+                            _micro_kernel(kc, a_pack + ir * kc, b_panel + jr * kc, c + row * ldc + col, ldc,
+                                          std::min(MR, mc - ir), std::min(NR, nc - jr), pc > 0 || beta != 0,
+                                          last ? &epilogue : nullptr, bias, mask);
+                        }
+                    }
+                }
+            });
+        }
+    }
+}
+
+// y = alpha * value + beta * y, a beta of 0 never reads y
+void _gemv_store(float* y, float value, float alpha, float beta) {
+    *y = beta == 0 ? alpha * value : alpha * value + beta * *y;
+}
+
+// `dots` are R consecutive rows of A each dotted with x, x is loaded once for all of them
+template <int R>
+void _gemv_dots(int n, const float* a, int lda, const float* x, float* dots) {
+    simd::vec acc[R];
+    for (int r = 0; r < R; r++) {
+        acc[r] = simd::zero();
+    }
+
+    int j = 0;
+    for (; j + simd::WIDTH <= n; j += simd::WIDTH) {
+        simd::vec xv = simd::load(x + j);
+        for (int r = 0; r < R; r++) {
+            const float* row = a + (size_t)r * lda + j;
+            __builtin_prefetch(row + PREFETCH);
+            acc[r] = simd::fmadd(simd::load(row), xv, acc[r]);
+        }
+    }
+
+    for (int r = 0; r < R; r++) {
+        float dot = simd::sum(acc[r]);
+        for (int q = j; q < n; q++) {
+            dot += a[(size_t)r * lda + q] * x[q];
+        }
+
+        dots[r] = dot;
+    }
+}
+
+// y[first, last) of x^T A, summed into a block held in L1 as the rows of A stream past, GEMV_ROWS rows at a time
+// at most GEMV_COLUMNS wide
+void _gemv_columns(int first, int last, int m, const float* a, int lda, const float* x, float alpha, float beta,
+                   float* y, int incy) {
+    int width = last - first;
+
+    float block[GEMV_COLUMNS];
+    std::fill(block, block + width, 0.f);
+
+    int i = 0;
+    for (; i + GEMV_ROWS <= m; i += GEMV_ROWS) {
+        const float* rows = a + (size_t)i * lda + first;
+
+        simd::vec xv[GEMV_ROWS];
+        for (int r = 0; r < GEMV_ROWS; r++) {
+            xv[r] = simd::broadcast(x[i + r]);
+        }
+
+        int j = 0;
+        for (; j + simd::WIDTH <= width; j += simd::WIDTH) {
+            simd::vec acc = simd::load(block + j);
+            for (int r = 0; r < GEMV_ROWS; r++) {
+                const float* row = rows + (size_t)r * lda + j;
+                __builtin_prefetch(row + PREFETCH);
+                acc = simd::fmadd(xv[r], simd::load(row), acc);
+            }
+
+            simd::store(block + j, acc);
+        }
+
+        for (; j < width; j++) {
+            for (int r = 0; r < GEMV_ROWS; r++) {
+                block[j] += x[i + r] * rows[(size_t)r * lda + j];
+            }
+        }
+    }
+
+    for (; i < m; i++) {
+        const float* row = a + (size_t)i * lda + first;
+        for (int j = 0; j < width; j++) {
+            block[j] += x[i] * row[j];
+        }
+    }
+
+    for (int j = 0; j < width; j++) {
+        _gemv_store(y + (size_t)(first + j) * incy, block[j], alpha, beta);
+    }
+}
+
+void sgemv(bool trans, int m, int n, float alpha, const float* a, int lda, const float* x, int incx, float beta,
+           float* y, int incy) {
+    int y_size = trans ? n : m;
+    int x_size = trans ? m : n;
+    if (y_size <= 0) {
+        return;
+    }
+
+    std::vector<float> x_local;
+    if (incx != 1) {
+        x_local.resize(x_size);
+        for (int i = 0; i < x_size; i++) {
+            x_local[i] = x[(size_t)i * incx];
+        }
+
+        x = x_local.data();
+    }
+
+    // all of A is read exactly once either way, so threads only pay off once it's large
+    bool serial = (size_t)m * n < PARALLEL_WORK;
+
+    if (!trans) {
+        size_t blocks = (m + GEMV_ROWS - 1) / GEMV_ROWS;
+        size_t grain = serial ? blocks : std::max((size_t)1, GRAIN_WORK / ((size_t)GEMV_ROWS * std::max(n, 1)));
+
+        parallel::parallelFor(0, blocks, grain, [&](size_t first, size_t last) {
+            for (size_t block = first; block < last; block++) {
+                int i = block * GEMV_ROWS;
+                const float* rows = a + (size_t)i * lda;
+
+                float dots[GEMV_ROWS];
+                int count = std::min(GEMV_ROWS, m - i);
+                if (count == GEMV_ROWS) {
+                    _gemv_dots<GEMV_ROWS>(n, rows, lda, x, dots);
+                } else {
+                    for (int r = 0; r < count; r++) {
+                        _gemv_dots<1>(n, rows + (size_t)r * lda, lda, x, dots + r);
+                    }
+                }
+
+                for (int r = 0; r < count; r++) {
+                    _gemv_store(y + (size_t)(i + r) * incy, dots[r], alpha, beta);
+                }
+            }
+        });
+
+        return;
+    }
+
+    size_t blocks = (n + GEMV_COLUMNS - 1) / GEMV_COLUMNS;
+    size_t grain = serial ? blocks : std::max((size_t)1, GRAIN_WORK / ((size_t)GEMV_COLUMNS * std::max(m, 1)));
+
+    parallel::parallelFor(0, blocks, grain, [&](size_t first, size_t last) {
+        for (size_t block = first; block < last; block++) {
+            int j = block * GEMV_COLUMNS;
+            _gemv_columns(j, std::min(n, j + GEMV_COLUMNS), m, a, lda, x, alpha, beta, y, incy);
+        }
+    });
+}
+
+// a product with a single row or column of output is a matrix-vector product, which sgemv streams through
+// without packing anything, false for everything else
+bool _sgemv(bool trans_a, bool trans_b, int m, int n, int k, float alpha, const float* a, int lda, const float* b,
+            int ldb, float beta, float* c, int ldc) {
+    if (m == 1) {
+        // the row of C is op(B)^T times the row of op(A)
+        sgemv(!trans_b, trans_b ? n : k, trans_b ? k : n, alpha, b, ldb, a, trans_a ? lda : 1, beta, c, 1);
+        return true;
+    }
+
+    if (n == 1) {
+        // the column of C is op(A) times the column of op(B)
+        sgemv(trans_a, trans_a ? k : m, trans_a ? m : k, alpha, a, lda, b, trans_b ? 1 : ldb, beta, c, ldc);
+        return true;
+    }
+
+    return false;
+}
+
+// a single row of A against all of a packed B, panel by panel, each panel's NR columns of C held in registers
+// the panels are read in the order they're laid out, so B streams through once
+void _sgemv_packed(const float* a, const PackedB& b, float* c, const Epilogue& epilogue) {
+    int n = b.n_;
+    int k = b.k_;
+
+    // independent accumulators for consecutive k, so the fmadds don't wait on each other
+    constexpr int U = 4;
+
+    size_t panels = (n + NR - 1) / NR;
+    size_t grain = (size_t)n * k < PARALLEL_WORK ? panels : std::max((size_t)1, GRAIN_WORK / ((size_t)NR * k));
+
+    parallel::parallelFor(0, panels, grain, [&](size_t first, size_t last) {
+        for (size_t panel = first; panel < last; panel++) {
+            int col = panel * NR;
+            int jc = col / NC * NC;
+            int nc = std::min(NC, n - jc);
+
+            simd::vec acc[U][NV];
+            for (int u = 0; u < U; u++) {
+                for (int v = 0; v < NV; v++) {
+                    acc[u][v] = simd::zero();
+                }
+            }
+
+            for (int pc = 0; pc < k; pc += KC) {
+                int kc = std::min(KC, k - pc);
+                const float* bp = b.data_.data() + (size_t)jc * k + (size_t)pc * _round_up(nc, NR) +
+                                  (size_t)(col - jc) * kc;
+                const float* ap = a + pc;
+
+                int p = 0;
+                for (; p + U <= kc; p += U) {
+                    __builtin_prefetch(bp + (p + U) * NR + PREFETCH);
+                    for (int u = 0; u < U; u++) {
+                        simd::vec x = simd::broadcast(ap[p + u]);
+                        for (int v = 0; v < NV; v++) {
+                            acc[u][v] = simd::fmadd(x, simd::load(bp + (p + u) * NR + v * simd::WIDTH), acc[u][v]);
+                        }
+                    }
+                }
+
+                for (; p < kc; p++) {
+                    simd::vec x = simd::broadcast(ap[p]);
+                    for (int v = 0; v < NV; v++) {
+                        acc[0][v] = simd::fmadd(x, simd::load(bp + p * NR + v * simd::WIDTH), acc[0][v]);
+                    }
+                }
+            }
+
+            float tile[NR];
+            for (int v = 0; v < NV; v++) {
+                simd::vec sum = acc[0][v];
+                for (int u = 1; u < U; u++) {
+                    sum = simd::add(sum, acc[u][v]);
+                }
+
+                simd::store(tile + v * simd::WIDTH, sum);
+            }
+
+            for (int j = 0; j < std::min(NR, n - col); j++) {
+                c[col + j] = _epilogue(tile[j], epilogue, epilogue.bias_ == nullptr ? nullptr : epilogue.bias_ + col + j,
+                                       epilogue.mask_ == nullptr ? nullptr : epilogue.mask_ + col + j);
+            }
+        }
+    });
+}
+
+void sgemm(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc) {
+    if (_sgemv(false, false, m, n, k, 1.f, a, lda, b, ldb, 0.f, c, ldc)) {
+        return;
+    }
+
+    _sgemm(m, n, k, 1.f, a, lda, 1, b, ldb, 1, 0.f, c, ldc, none(), nullptr);
+}
+
+void sgemm(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc,
+           const Epilogue& epilogue) {
+    _sgemm(m, n, k, 1.f, a, lda, 1, b, ldb, 1, 0.f, c, ldc, epilogue, nullptr);
+}
+
+std::shared_ptr<PackedB> pack(int k, int n, const float* b, int rsb, int csb) {
+    std::shared_ptr<PackedB> packed(new PackedB());
+    packed->k_ = k;
+    packed->n_ = n;
+    packed->data_.resize((size_t)_round_up(n, NR) * k);
+
+    // every block before column jc is NC wide, a multiple of NR, so the blocks from jc on start at jc * k
+    for (int jc = 0; jc < n; jc += NC) {
+        int nc = std::min(NC, n - jc);
+        for (int pc = 0; pc < k; pc += KC) {
+            int kc = std::min(KC, k - pc);
+            _pack_b(kc, nc, b + pc * rsb + jc * csb, rsb, csb,
+                    packed->data_.data() + (size_t)jc * k + (size_t)pc * _round_up(nc, NR));
+        }
+    }
+
+    return packed;
+}
+
+void sgemm(int m, const float* a, int lda, const PackedB& b, float* c, int ldc, const Epilogue& epilogue) {
+    if (m == 1) {
+        _sgemv_packed(a, b, c, epilogue);
+        return;
+    }
+
+    _sgemm(m, b.n_, b.k_, 1.f, a, lda, 1, (const float*)nullptr, 0, 0, 0.f, c, ldc, epilogue, b.data_.data());
+}
+
+void sgemm(int m, int n, int k, const bfloat16* a, int lda, const bfloat16* b, int ldb, float* c, int ldc,
+           const Epilogue& epilogue) {
+    _sgemm(m, n, k, 1.f, a, lda, 1, b, ldb, 1, 0.f, c, ldc, epilogue, nullptr);
+}
+
+void sgemm(int m, int n, int k, const float16* a, int lda, const float16* b, int ldb, float* c, int ldc,
+           const Epilogue& epilogue) {
+    _sgemm(m, n, k, 1.f, a, lda, 1, b, ldb, 1, 0.f, c, ldc, epilogue, nullptr);
+}
+
+// row and column strides of a row-major operand with row stride `ld`, as seen through an optional transpose
+int _row_stride(bool trans, int ld) {
+    return trans ? 1 : ld;
+}
+
+int _column_stride(bool trans, int ld) {
+    return trans ? ld : 1;
+}
+
+void sgemm(bool trans_a, bool trans_b, int m, int n, int k, float alpha, const float* a, int lda, const float* b,
+           int ldb, float beta, float* c, int ldc) {
+    if (_sgemv(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc)) {
+        return;
+    }
+
+    _sgemm(m, n, k, alpha, a, _row_stride(trans_a, lda), _column_stride(trans_a, lda), b, _row_stride(trans_b, ldb),
+           _column_stride(trans_b, ldb), beta, c, ldc, none(), nullptr);
+}
+
+void sgemm(bool trans_a, bool trans_b, int m, int n, int k, float alpha, const bfloat16* a, int lda,
+           const bfloat16* b, int ldb, float beta, float* c, int ldc) {
+    _sgemm(m, n, k, alpha, a, _row_stride(trans_a, lda), _column_stride(trans_a, lda), b, _row_stride(trans_b, ldb),
+           _column_stride(trans_b, ldb), beta, c, ldc, none(), nullptr);
+}
+
+void sgemm(bool trans_a, bool trans_b, int m, int n, int k, float alpha, const float16* a, int lda, const float16* b,
+           int ldb, float beta, float* c, int ldc) {
+    _sgemm(m, n, k, alpha, a, _row_stride(trans_a, lda), _column_stride(trans_a, lda), b, _row_stride(trans_b, ldb),
+           _column_stride(trans_b, ldb), beta, c, ldc, none(), nullptr);
+}
+
+void dgemm(int m, int n, int k, const double* a, int lda, const double* b, int ldb, double* c, int ldc) {
+    dgemm(false, false, m, n, k, 1, a, lda, b, ldb, 0, c, ldc);
+}
+
+void dgemm(bool trans_a, bool trans_b, int m, int n, int k, double alpha, const double* a, int lda, const double* b,
+           int ldb, double beta, double* c, int ldc) {
+    if (m <= 0 || n <= 0) {
+        return;
+    }
+
+    int rsa = _row_stride(trans_a, lda);
+    int csa = _column_stride(trans_a, lda);
+    int rsb = _row_stride(trans_b, ldb);
+    int csb = _column_stride(trans_b, ldb);
+
+    size_t row_work = std::max((size_t)1, (size_t)n * k);
+    size_t grain = (size_t)m * n * k < PARALLEL_WORK ? m : std::max((size_t)1, GRAIN_WORK / row_work);
+
+    parallel::parallelFor(0, m, grain, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            double* row = c + i * ldc;
+            for (int j = 0; j < n; j++) {
+                row[j] = beta == 0 ? 0 : row[j] * beta;
+            }
+
+            for (int p = 0; p < k; p++) {
+                double x = alpha * a[i * rsa + p * csa];
+                const double* b_row = b + p * rsb;
+                for (int j = 0; j < n; j++) {
+                    row[j] += x * b_row[j * csb];
+                }
+            }
+        }
+    });
+}
+
+// products of at most SMALL, one row of C at a time
+// N and K are either the exact sizes, fixed at compile time so both loops unroll, or 0 for the sizes given at runtime
+template <typename T, int N, int K>
+void _small(int m, int n, int k, const T* a, int lda, const T* b, int ldb, T* c, int ldc,
+            const std::array<size_t, 3>* offsets, size_t count) {
+    if constexpr (N > 0) {
+        n = N;
+        k = K;
+    }
+
+    for (size_t product = 0; product < count; product++) {
+        const T* ap = a + offsets[product][0];
+        const T* bp = b + offsets[product][1];
+        T* cp = c + offsets[product][2];
+
+        for (int i = 0; i < m; i++) {
+            T acc[N > 0 ? N : SMALL] = {};
+            for (int p = 0; p < k; p++) {
+                T x = ap[i * lda + p];
+                for (int j = 0; j < n; j++) {
+                    acc[j] += x * bp[p * ldb + j];
+                }
+            }
+
+            for (int j = 0; j < n; j++) {
+                cp[i * ldc + j] = acc[j];
+            }
+        }
+    }
+}
+
+template <typename T>
+using _small_kernel = void (*)(int, int, int, const T*, int, const T*, int, T*, int, const std::array<size_t, 3>*,
+                               size_t);
+
+template <typename T, int N>
+_small_kernel<T> _small_for(int k) {
+    switch (k) {
+        case 1:
+            return _small<T, N, 1>;
+        case 2:
+            return _small<T, N, 2>;
+        case 4:
+            return _small<T, N, 4>;
+        case 8:
+            return _small<T, N, 8>;
+        case 16:
+            return _small<T, N, 16>;
+        default:
+            return _small<T, 0, 0>;
+    }
+}
+
+template <typename T>
+_small_kernel<T> _small_for(int n, int k) {
+    switch (n) {
+        case 1:
+            return _small_for<T, 1>(k);
+        case 2:
+            return _small_for<T, 2>(k);
+        case 4:
+            return _small_for<T, 4>(k);
+        case 8:
+            return _small_for<T, 8>(k);
+        case 16:
+            return _small_for<T, 16>(k);
+        default:
+            return _small<T, 0, 0>;
+    }
+}
+
+void sgemmBatched(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc,
+                  const std::array<size_t, 3>* offsets, size_t count) {
+    _small_for<float>(n, k)(m, n, k, a, lda, b, ldb, c, ldc, offsets, count);
+}
+
+void dgemmBatched(int m, int n, int k, const double* a, int lda, const double* b, int ldb, double* c, int ldc,
+                  const std::array<size_t, 3>* offsets, size_t count) {
+    _small_for<double>(n, k)(m, n, k, a, lda, b, ldb, c, ldc, offsets, count);
+}
+
+// u8 x s8 -> s32 dot product steps, QWIDTH bytes of each operand at a time
+//
+// VNNI does it in one instruction; otherwise both operands are widened to 16 bits before multiplying,
+// so unlike a saturating u8 x s8 multiply (e.g. pmaddubsw) nothing is lost, 255 * 127 * 2 still fits the int32
+// pairs madd produces
+#if defined(__AVXVNNI__) || (defined(__AVX512VNNI__) && defined(__AVX512VL__))
+
+typedef __m256i qvec;
+constexpr int QWIDTH = 32;
+
+inline qvec _qzero() {
+    return _mm256_setzero_si256();
+}
+
+inline qvec _qload(const void* p) {
+    return _mm256_loadu_si256((const __m256i*)p);
+}
+
+inline qvec _qmadd(qvec acc, qvec a, qvec b) {
+#if defined(__AVXVNNI__)
+    return _mm256_dpbusd_avx_epi32(acc, a, b);
+#else
+    return _mm256_dpbusd_epi32(acc, a, b);
+#endif
+}
+
+#elif defined(__AVX2__)
+
+typedef __m256i qvec;
+constexpr int QWIDTH = 16;
+
+inline qvec _qzero() {
+    return _mm256_setzero_si256();
+}
+
+// 16 bytes, not yet widened
+inline qvec _qload(const void* p) {
+    return _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)p));
+}
+
+inline qvec _qmadd(qvec acc, qvec a, qvec b) {
+    __m256i x = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(a));
+    __m256i y = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(b));
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(x, y));
+}
+
+#elif defined(__SSE2__)
+
+typedef __m128i qvec;
+constexpr int QWIDTH = 16;
+
+inline qvec _qzero() {
+    return _mm_setzero_si128();
+}
+
+inline qvec _qload(const void* p) {
+    return _mm_loadu_si128((const __m128i*)p);
+}
+
+inline qvec _qmadd(qvec acc, qvec a, qvec b) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i x_lo = _mm_unpacklo_epi8(a, zero);
+    __m128i x_hi = _mm_unpackhi_epi8(a, zero);
+
+    // sign extended by unpacking each byte into the top of a 16-bit lane and shifting it back down
+    __m128i y_lo = _mm_srai_epi16(_mm_unpacklo_epi8(b, b), 8);
+    __m128i y_hi = _mm_srai_epi16(_mm_unpackhi_epi8(b, b), 8);
+
+    return _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(x_lo, y_lo), _mm_madd_epi16(x_hi, y_hi)));
+}
+
+#endif
+
+// the [QM x QR] tile of int32 dot products between rows of A and rows of B^T, the first `mr` x `nr` of which are kept
+// rows past either edge repeat the last one and are thrown away
+void _qtile(int k, const uint8_t* a, int lda, int mr, const int8_t* bt, int ldb, int nr, int32_t acc[QM][QR]) {
+    const uint8_t* a_rows[QM];
+    for (int r = 0; r < QM; r++) {
+        a_rows[r] = a + std::min(r, mr - 1) * lda;
+    }
+
+    const int8_t* b_rows[QR];
+    for (int c = 0; c < QR; c++) {
+        b_rows[c] = bt + std::min(c, nr - 1) * ldb;
+    }
+
+    for (int r = 0; r < QM; r++) {
+        for (int c = 0; c < QR; c++) {
+            acc[r][c] = 0;
+        }
+    }
+
+    int p = 0;
+#if defined(__SSE2__)
+    qvec sums[QM][QR];
+    for (int r = 0; r < QM; r++) {
+        for (int c = 0; c < QR; c++) {
+            sums[r][c] = _qzero();
+        }
+    }
+
+    for (; p + QWIDTH <= k; p += QWIDTH) {
+        qvec x[QM];
+        for (int r = 0; r < QM; r++) {
+            x[r] = _qload(a_rows[r] + p);
+        }
+
+        for (int c = 0; c < QR; c++) {
+            qvec y = _qload(b_rows[c] + p);
+            for (int r = 0; r < QM; r++) {
+                sums[r][c] = _qmadd(sums[r][c], x[r], y);
+            }
+        }
+    }
+
+    for (int r = 0; r < QM; r++) {
+        for (int c = 0; c < QR; c++) {
+            int32_t lanes[sizeof(qvec) / sizeof(int32_t)];
+            std::memcpy(lanes, &sums[r][c], sizeof(qvec));
+            for (int32_t lane : lanes) {
+                acc[r][c] += lane;
+            }
+        }
+    }
+#endif
+
+    for (; p < k; p++) {
+        for (int r = 0; r < QM; r++) {
+            for (int c = 0; c < QR; c++) {
+                acc[r][c] += (int32_t)a_rows[r][p] * b_rows[c][p];
+            }
+        }
+    }
+}
+
+void qgemm(int m, int n, int k, const uint8_t* a, int lda, uint8_t a_zero_point, const int8_t* bt, int ldb,
+           const int32_t* b_sums, const float* b_scales, float* c, int ldc, const Epilogue& epilogue) {
+    if (m <= 0 || n <= 0) {
+        return;
+    }
+
+    // row blocks of QM, each sweeping all of B^T so it's read from cache by every block after the first
+    size_t blocks = (m + QM - 1) / QM;
+    size_t block_work = std::max((size_t)1, (size_t)QM * n * k);
+    size_t grain = (size_t)m * n * k < PARALLEL_WORK ? blocks : std::max((size_t)1, PARALLEL_WORK / block_work);
+
+    parallel::parallelFor(0, blocks, grain, [&](size_t first, size_t last) {
+        int32_t acc[QM][QR];
+        for (size_t block = first; block < last; block++) {
+            int i = block * QM;
+            int mr = std::min(QM, m - i);
+
+            for (int j = 0; j < n; j += QR) {
+                int nr = std::min(QR, n - j);
+                _qtile(k, a + i * lda, lda, mr, bt + j * ldb, ldb, nr, acc);
+
+                for (int r = 0; r < mr; r++) {
+                    for (int col = j; col < j + nr; col++) {
+                        int32_t sum = acc[r][col - j] - (int32_t)a_zero_point * b_sums[col];
+                        size_t index = (size_t)(i + r) * ldc + col;
+
+                        const float* bias = epilogue.bias_ == nullptr ? nullptr : epilogue.bias_ + col;
+                        float* mask = epilogue.mask_ == nullptr ? nullptr : epilogue.mask_ + index;
+                        c[index] = _epilogue(sum * b_scales[col], epilogue, bias, mask);
+                    }
+                }
+            }
+        }
+    });
+}
+
+}  // namespace gemm
@@ -16,8 +16,7 @@ void fillNormal(std::shared_ptr<Buffer> buffer) {
     std::uniform_real_distribution<float> dis(-1 * range, range);
 
     for (int i = 0; i < buffer->size(); i++) {
-        float x = dis(gen);
-        buffer->setIndex(i, (void*)(&x));
+        buffer->setValue(i, dis(gen));
     }
 }
 
@@ -5,10 +5,17 @@
 #include "broadcasting.h"
 #include "buffer.h"
 #include "buffer_ops.h"
+#include "dense.h"
+#include "fusion.h"
 #include "graph.h"
 #include "kernel.h"
+#include "normalization.h"
 #include "ops.h"
+#include "packing.h"
+#include "reduction.h"
+#include "softmax.h"
 #include "string_utils.h"
+#include "views.h"
 
 // TODO: implement the unimplemented
 // TODO: these can probably be heavily optimized
@@ -58,7 +65,7 @@ void _propagate_current_grad(std::shared_ptr<Node> node, std::shared_ptr<Node> c
                 }
             }
 
-            std::shared_ptr<GraphBuffer> reduced_grad(new GraphBuffer(child_shape, DTYPE::float32));
+            std::shared_ptr<GraphBuffer> reduced_grad(new GraphBuffer(child_shape, child->gradient_->dtype()));
 
             buffer_ops::reduceSum(node->gradient_, reduced_grad, reduction_indices);
             buffer_ops::multiply(reduced_grad, child->gradient_, child->gradient_);
@@ -101,8 +108,12 @@ void multiplyGradient(std::shared_ptr<Node> node) {
     }
 
     // d{node} / d{children}
+    //
+    // multiply(x, x) only has the one child to propagate to
     _propagate_current_grad(node, child);
-    _propagate_current_grad(node, other_child);
+    if (name != other_name) {
+        _propagate_current_grad(node, other_child);
+    }
 }
 
 void inputGradient(std::shared_ptr<Node> node) {
@@ -173,6 +184,17 @@ void expGradient(std::shared_ptr<Node> node) {
     _propagate_current_grad(node, arg);
 }
 
+void lnGradient(std::shared_ptr<Node> node) {
+    // f(a) = ln(a)
+    // df/da = 1 / a
+
+    std::shared_ptr<Node> arg = node->children_[node->arg_order_[0]];
+
+    buffer_ops::reciprocal(arg->output_, arg->gradient_);
+
+    _propagate_current_grad(node, arg);
+}
+
 void powGradient(std::shared_ptr<Node> node) {
     // f(a, b) = a ^ b
     // df/da = ba ^ (b - 1)
@@ -183,7 +205,7 @@ void powGradient(std::shared_ptr<Node> node) {
 
     // df/da
     std::shared_ptr<GraphBuffer> minus_one(new GraphBuffer(power->output_->shape(), power->output_->dtype()));
-    std::shared_ptr<GraphBuffer> base_grad_staging(new GraphBuffer(base->gradient_->shape(), DTYPE::float32));
+    std::shared_ptr<GraphBuffer> base_grad_staging(new GraphBuffer(base->gradient_->shape(), base->gradient_->dtype()));
 
     buffer_ops::add(power->output_, -1, minus_one);
     buffer_ops::pow(base->output_, minus_one, base_grad_staging);
@@ -191,12 +213,12 @@ void powGradient(std::shared_ptr<Node> node) {
     buffer_ops::copy(base_grad_staging, base->gradient_);
 
     // df/db
-    std::shared_ptr<GraphBuffer> power_grad_staging(new GraphBuffer(power->gradient_->shape(), DTYPE::float32));
+    std::shared_ptr<GraphBuffer> power_grad_staging(
+        new GraphBuffer(power->gradient_->shape(), power->gradient_->dtype()));
     if (power->gradient_->size() == 1) {
         std::shared_ptr<GraphBuffer> temp(new GraphBuffer(base->output_->shape(), base->output_->dtype()));
         buffer_ops::ln(base->output_, temp);
-        float grad_sum = buffer_ops::reduceSum(temp);
-        power->gradient_->setIndex(0, (void*)(&grad_sum));
+        power->gradient_->setValue(0, buffer_ops::reduceSum(temp));
     } else {
         buffer_ops::ln(base->output_, power_grad_staging);
         buffer_ops::multiplyAndReduce(power_grad_staging, node->output_, power_grad_staging);
@@ -207,30 +229,32 @@ void powGradient(std::shared_ptr<Node> node) {
     _propagate_current_grad(node, power);
 }
 
-// TODO: broadcasting
-// TODO: this can definitely be optimized
-// TODO: lotta repeated code here...
-void matmulGradient(std::shared_ptr<Node> node) {
-    // basing this off https://github.com/tensorflow/tensorflow/blob/master/tensorflow/python/ops/math_grad.py#L1694
-    //
-    // A = [n x m]
-    // B = [m x p]
-    // f(A, B) = A @ B [n x p]
-    // grad = [n x p]
-    // df/dA = grad @ B ^ T
-    // df/dB = A ^ T @ grad
+// how many matrices are stacked up in a tensor of `shape`, i.e. the product of all but its last two dimensions
+size_t _matrices(const std::vector<int>& shape) {
+    size_t matrices = 1;
+    for (int i = 0; i + 2 < shape.size(); i++) {
+        matrices *= shape[i];
+    }
+
+    return matrices;
+}
 
+// materializes the transposes, for products where an operand was broadcast across only some of the batch
+void _broadcast_matmul_gradient(std::shared_ptr<Node> node, std::shared_ptr<GraphBuffer> upstream,
+                                std::shared_ptr<GraphBuffer> a_staging_grad,
+                                std::shared_ptr<GraphBuffer> b_staging_grad, bool a_gradient, bool b_gradient) {
     std::shared_ptr<Node> a = node->children_[node->arg_order_[0]];
     std::shared_ptr<Node> b = node->children_[node->arg_order_[1]];
 
-    auto [a_transpose_shape, b_transpose_shape] = broadcasting::padVectors(a->output_->shape(), b->output_->shape());
+    // the transposes below read their inputs as flat arrays
+    std::shared_ptr<GraphBuffer> a_output = views::contiguous(a->output_);
+    std::shared_ptr<GraphBuffer> b_output = views::contiguous(b->output_);
+
+    auto [a_transpose_shape, b_transpose_shape] = broadcasting::padVectors(a_output->shape(), b_output->shape());
 
     std::swap(a_transpose_shape[a_transpose_shape.size() - 2], a_transpose_shape[a_transpose_shape.size() - 1]);
     std::swap(b_transpose_shape[b_transpose_shape.size() - 2], b_transpose_shape[b_transpose_shape.size() - 1]);
 
-    std::shared_ptr<GraphBuffer> a_transpose(new GraphBuffer(a_transpose_shape, a->output_->dtype()));
-    std::shared_ptr<GraphBuffer> b_transpose(new GraphBuffer(b_transpose_shape, b->output_->dtype()));
-
     std::vector<int> perm(a->gradient_->shape().size());
     for (int i = 0; i < a->gradient_->shape().size(); i++) {
         perm[i] = i;
@@ -238,24 +262,24 @@ void matmulGradient(std::shared_ptr<Node> node) {
 
     std::swap(perm[perm.size() - 2], perm[perm.size() - 1]);
 
-    std::shared_ptr<GraphBuffer> a_staging_grad(new GraphBuffer(a->gradient_->shape(), DTYPE::float32));
-    std::shared_ptr<GraphBuffer> b_staging_grad(new GraphBuffer(b->gradient_->shape(), DTYPE::float32));
-
-    // df/dA
-    buffer_ops::transpose(b->output_, b_transpose, perm);
-    buffer_ops::matmul(node->gradient_, b_transpose, a_staging_grad, node->shape_, b_transpose->shape_, a->shape_);
+    if (a_gradient) {
+        std::shared_ptr<GraphBuffer> b_transpose(new GraphBuffer(b_transpose_shape, b_output->dtype()));
+        buffer_ops::transpose(b_output, b_transpose, perm);
+        buffer_ops::matmul(upstream, b_transpose, a_staging_grad, node->shape_, b_transpose->shape_, a->shape_);
+    }
 
-    buffer_ops::multiply(a_staging_grad, a->gradient_, a->gradient_);
+    if (!b_gradient) {
+        return;
+    }
 
-    // df/dB
-    buffer_ops::transpose(a->output_, a_transpose, perm);
+    std::shared_ptr<GraphBuffer> a_transpose(new GraphBuffer(a_transpose_shape, a_output->dtype()));
+    buffer_ops::transpose(a_output, a_transpose, perm);
     if (b->gradient_->shape().size() == a_transpose->shape().size()) {
-        buffer_ops::matmul(a_transpose, node->gradient_, b_staging_grad, a_transpose->shape_, node->shape_, b->shape_);
-        buffer_ops::multiply(b_staging_grad, b->gradient_, b->gradient_);
+        buffer_ops::matmul(a_transpose, upstream, b_staging_grad, a_transpose->shape_, node->shape_, b->shape_);
     }
     // happened in the forward pass, for e.g. batches
     else {
-        const std::vector<int> gradient_shape = node->gradient_->shape();
+        const std::vector<int> gradient_shape = upstream->shape();
         const std::vector<int>& transpose_shape = a_transpose->shape();
 
         std::vector<int> transpose_matmul_shape;
@@ -266,25 +290,94 @@ void matmulGradient(std::shared_ptr<Node> node) {
         transpose_matmul_shape.push_back(transpose_shape[transpose_shape.size() - 2]);
         transpose_matmul_shape.push_back(gradient_shape.back());
 
-        std::vector<int> reduced;
-        for (int i = 1; i < transpose_matmul_shape.size(); i++) {
-            reduced.push_back(transpose_matmul_shape[i]);
-        }
-
-        std::shared_ptr<GraphBuffer> transpose_matmul(new GraphBuffer(transpose_matmul_shape, DTYPE::float32));
+        std::shared_ptr<GraphBuffer> transpose_matmul(new GraphBuffer(transpose_matmul_shape, upstream->dtype()));
 
-        buffer_ops::matmul(a_transpose, node->gradient_, transpose_matmul, a_transpose->shape_, node->shape_,
+        buffer_ops::matmul(a_transpose, upstream, transpose_matmul, a_transpose->shape_, node->shape_,
                            transpose_matmul_shape);
 
+        // reduced into a view of the staging gradient padded up to the rank of the products
         const std::vector<int> b_gradient_shape = b->gradient_->shape();
-        // this is gross and I'd really rather we not do this
         std::vector<int> temp_shape = broadcasting::padVector(b_gradient_shape, transpose_matmul_shape.size());
-        b_staging_grad->shape_ = temp_shape;
 
         // why is the reduction index array just `{0}` ???
-        buffer_ops::reduceSum(transpose_matmul, b_staging_grad, {0});
-        buffer_ops::multiply(b_staging_grad, b->gradient_, b->gradient_);
+        buffer_ops::reduceSum(transpose_matmul, views::reshape(b_staging_grad, temp_shape), {0});
+    }
+}
+
+// TODO: broadcasting
+// TODO: this can definitely be optimized
+// TODO: lotta repeated code here...
+void _matmul_gradient(std::shared_ptr<Node> node, std::shared_ptr<GraphBuffer> upstream) {
+    // basing this off https://github.com/tensorflow/tensorflow/blob/master/tensorflow/python/ops/math_grad.py#L1694
+    //
+    // A = [n x m]
+    // B = [m x p]
+    // f(A, B) = A @ B [n x p]
+    // grad = [n x p], `upstream`
+    // df/dA = grad @ B ^ T
+    // df/dB = A ^ T @ grad
+    //
+    // the transposes are never materialized, the gemms read the operands transposed instead
+
+    std::shared_ptr<Node> a = node->children_[node->arg_order_[0]];
+    std::shared_ptr<Node> b = node->children_[node->arg_order_[1]];
+
+    std::vector<int> a_shape = a->output_->shape();
+    std::vector<int> b_shape = b->output_->shape();
+    std::vector<int> out_shape = upstream->shape();
+
+    // an operand that's a transposed view (see views.h) already holds its transpose, so its flags flip
+    // `_stored` shapes are the operands' data as laid out in memory
+    bool a_transposed = !a->output_->contiguous();
+    bool b_transposed = !b->output_->contiguous();
+
+    std::vector<int> a_stored = a_shape;
+    if (a_transposed) {
+        std::swap(a_stored[a_stored.size() - 2], a_stored[a_stored.size() - 1]);
+    }
+
+    std::vector<int> b_stored = b_shape;
+    if (b_transposed) {
+        std::swap(b_stored[b_stored.size() - 2], b_stored[b_stored.size() - 1]);
+    }
+
+    std::shared_ptr<GraphBuffer> a_staging_grad(new GraphBuffer(a->gradient_->shape(), a->gradient_->dtype()));
+    std::shared_ptr<GraphBuffer> b_staging_grad(new GraphBuffer(b->gradient_->shape(), b->gradient_->dtype()));
+
+    // df/dA
+    // weights have their transpose packed once rather than transposed on every backward pass, see packing.h
+    if (packing::packable(b)) {
+        buffer_ops::matmul(upstream, *packing::get(b, true), a_staging_grad, gemm::none());
+    } else if (_matrices(a_shape) == _matrices(out_shape)) {
+        // A wasn't broadcast, each product's gradient is one of A's own matrices
+        buffer_ops::matmul(upstream, false, b->output_, !b_transposed, a_staging_grad, out_shape, b_stored, a_shape, 1,
+                           0);
+    } else {
+        _broadcast_matmul_gradient(node, upstream, a_staging_grad, b_staging_grad, true, false);
+    }
+
+    buffer_ops::multiply(a_staging_grad, a->gradient_, a->gradient_);
+
+    // df/dB
+    if (_matrices(b_shape) == 1 && !a_transposed) {
+        // every product used the same B, so its gradient is summed over all of them
+        // stacking the batch up along the reduction makes that a single [p x batch * n] @ [batch * n x m] product,
+        // with no batch of per-product gradients to reduce afterwards
+        int rows = upstream->size() / out_shape.back();
+        buffer_ops::matmul(a->output_, true, upstream, false, b_staging_grad, {rows, a_shape.back()},
+                           {rows, out_shape.back()}, {b_shape[b_shape.size() - 2], b_shape.back()}, 1, 0);
+    } else if (_matrices(b_shape) == _matrices(out_shape)) {
+        buffer_ops::matmul(a->output_, !a_transposed, upstream, false, b_staging_grad, a_stored, out_shape, b_shape, 1,
+                           0);
+    } else {
+        _broadcast_matmul_gradient(node, upstream, a_staging_grad, b_staging_grad, false, true);
     }
+
+    buffer_ops::multiply(b_staging_grad, b->gradient_, b->gradient_);
+}
+
+void matmulGradient(std::shared_ptr<Node> node) {
+    _matmul_gradient(node, node->gradient_);
 }
 
 void constantGradient(std::shared_ptr<Node> node) {
@@ -308,21 +401,90 @@ void sigmoidGradient(std::shared_ptr<Node> node) {
 
 void reluGradient(std::shared_ptr<Node> node) {
     std::shared_ptr<Node> a = node->children_[node->arg_order_[0]];
-    kernel::_element_wise(
-        [](std::shared_ptr<Buffer> _a, std::shared_ptr<Buffer> _out, size_t index) {
-            float output = _a->getIndex<float>(index) > EPSILON ? 1 : 0;
-            _out->setIndex(index, (void*)(&output));
-        },
-        a->output_, a->gradient_);
+    dtypes::dispatch(a->gradient_->dtype(), [&]<typename T>() {
+        kernel::_element_wise(
+            [](std::shared_ptr<Buffer> _a, std::shared_ptr<Buffer> _out, size_t index) {
+                T output = _a->getIndex<T>(index) > EPSILON ? 1 : 0;
+                _out->setIndex(index, (void*)(&output));
+            },
+            a->output_, a->gradient_);
+    });
 
     _propagate_current_grad(node, a);
 }
 
 void reduce_sumGradient(std::shared_ptr<Node> node) {
-    _propagate_current_grad(node, node->children_[node->arg_order_[0]]);
+    reduction::backward(node);
+}
+
+void reduce_meanGradient(std::shared_ptr<Node> node) {
+    reduction::backward(node);
+}
+
+void reduce_maxGradient(std::shared_ptr<Node> node) {
+    reduction::backward(node);
+}
+
+void softmaxGradient(std::shared_ptr<Node> node) {
+    softmax::backward(node);
+}
+
+void softmax_cross_entropyGradient(std::shared_ptr<Node> node) {
+    softmax::backward(node);
+}
+
+void layer_normGradient(std::shared_ptr<Node> node) {
+    normalization::backward(node);
+}
+
+void rms_normGradient(std::shared_ptr<Node> node) {
+    normalization::backward(node);
+}
+
+void fusedGradient(std::shared_ptr<Node> node) {
+    fusion::backward(node);
+}
+
+void denseGradient(std::shared_ptr<Node> node) {
+    dense::backward(node);
+}
+
+void dense_reluGradient(std::shared_ptr<Node> node) {
+    dense::backward(node);
+}
+
+void dense_sigmoidGradient(std::shared_ptr<Node> node) {
+    dense::backward(node);
 }
 
 void conv2dGradient(std::shared_ptr<Node> node) {
 }
 
+void transposeGradient(std::shared_ptr<Node> node) {
+    views::backward(node);
+}
+
+void reshapeGradient(std::shared_ptr<Node> node) {
+    views::backward(node);
+}
+
+void sliceGradient(std::shared_ptr<Node> node) {
+    views::backward(node);
+}
+
+void expandGradient(std::shared_ptr<Node> node) {
+    views::backward(node);
+}
+
+void squeezeGradient(std::shared_ptr<Node> node) {
+    views::backward(node);
+}
+
+// the int8 weights can't take an update, see quantize.h
+void qmatmulGradient(std::shared_ptr<Node> node) {
+    std::cerr << strings::error("gradient::qmatmulGradient error: ") << "quantized node "
+              << strings::info(node->name_) << " is inference only" << std::endl;
+    exit(-1);
+}
+
 }  // namespace gradient
@@ -4,30 +4,47 @@
 #include <climits>
 #include <fstream>
 #include <functional>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <queue>
 #include <random>
 #include <set>
+#include <sstream>
 #include <utility>
 #include <vector>
 
 #include "allocation.h"
 #include "buffer.h"
 #include "buffer_ops.h"
+#include "checkpoint.h"
 #include "grad.h"
 #include "iterators.h"
 #include "kernel.h"
 #include "logging.h"
 #include "ops.h"
+#include "packing.h"
+#include "parallel.h"
+#include "scheduler.h"
 #include "string_utils.h"
 
 // TODO: there NEEDS to be some sort of differentiator between differentiable variables and constant numbers
 //       this is probably a language problem. new keyword? const vs var?
 
-Node::Node(int id) : id_(id), external_input_(false), trainable_(false) {
+Node::Node(int id)
+    : id_(id),
+      packed_(new packing::Cache()),
+      external_input_(false),
+      trainable_(false),
+      const_(false),
+      shared_(false),
+      checkpoint_(false),
+      materialize_(false),
+      dtype_(DTYPE::float32) {
 }
 
 Node::Node(std::shared_ptr<Node> node)
@@ -36,13 +53,27 @@ Node::Node(std::shared_ptr<Node> node)
       name_(node->name_),
       arg_order_(node->arg_order_),
       shape_(node->shape_),
-      trainable_(node->trainable_) {
+      program_(node->program_),
+      quantized_(node->quantized_),
+      packed_(new packing::Cache()),
+      external_input_(node->external_input_),
+      trainable_(node->trainable_),
+      const_(node->const_),
+      shared_(false),
+      checkpoint_(node->checkpoint_),
+      materialize_(node->materialize_),
+      dtype_(node->dtype_) {
 }
 
 int Node::getId() {
     return id_;
 }
 
+bool Node::isParameter() {
+    return trainable_ || const_ || operation_type_ == operations::constant || operation_type_ == operations::tensor ||
+           operation_type_ == operations::normal || operation_type_ == operations::ones;
+}
+
 std::string _node_format(float x) {
     constexpr int precision = 6;
     constexpr int width = precision + 4;  // decimal point + integer part (assuming 2 digits) + sign
@@ -59,7 +90,7 @@ std::string _node_format(float x) {
 void Node::printOutput(std::ostream& stream) {
     if (shape_.size() < 2) {
         for (size_t i = 0; i < output_->size(); i++) {
-            stream << output_->getIndex<float>(i) << ", ";
+            stream << output_->getValue<float>(i) << ", ";
         }
 
         stream << std::endl;
@@ -89,7 +120,7 @@ void Node::printOutput(std::ostream& stream) {
             for (int r = 0; r < m && !it.end(); r++) {
                 for (int c = 0; c < n && !it.end(); c++) {
                     size_t index = it.getIndex();
-                    std::string output = std::to_string(output_->getIndex<float>(index));
+                    std::string output = std::to_string(output_->getValue<float>(index));
                     stream << output << ", ";
 
                     it.increment();
@@ -105,7 +136,7 @@ void Node::printOutput(std::ostream& stream) {
 
         for (int r = 0; r < m; r++) {
             for (int c = 0; c < n; c++) {
-                stream << output_->getIndex<float>(r * n + c) << ", ";
+                stream << output_->getValue<float>(r * n + c) << ", ";
             }
 
             stream << std::endl;
@@ -118,7 +149,7 @@ void Node::printOutput(std::ostream& stream) {
 void Node::printGradient(std::ostream& stream) {
     if (shape_.size() < 2) {
         for (size_t i = 0; i < gradient_->size(); i++) {
-            stream << gradient_->getIndex<float>(i) << ", ";
+            stream << gradient_->getValue<float>(i) << ", ";
         }
 
         stream << std::endl;
@@ -148,7 +179,7 @@ void Node::printGradient(std::ostream& stream) {
 
             for (int r = 0; r < m; r++) {
                 for (int c = 0; c < n; c++) {
-                    std::string output = std::to_string(gradient_->getIndex<float>(index + (r * n) + c));
+                    std::string output = std::to_string(gradient_->getValue<float>(index + (r * n) + c));
                     stream << output << ", ";
                 }
             }
@@ -160,7 +191,7 @@ void Node::printGradient(std::ostream& stream) {
     } else if (shape_.size() == 2) {
         for (int r = 0; r < m; r++) {
             for (int c = 0; c < n; c++) {
-                stream << gradient_->getIndex<float>(r * n + c) << ", ";
+                stream << gradient_->getValue<float>(r * n + c) << ", ";
             }
 
             stream << std::endl;
@@ -203,6 +234,77 @@ Graph::Graph(std::shared_ptr<Graph> graph) {
     }
 
     alias_map_ = graph->alias_map_;
+    dtype_ = graph->dtype_;
+}
+
+std::shared_ptr<Graph> Graph::replicate(int batch_size, bool gradients) {
+    std::shared_ptr<Graph> replica(new Graph());
+    for (auto& [id, node] : nodes_) {
+        replica->nodes_[id] = std::shared_ptr<Node>(new Node(node));
+    }
+
+    for (auto& [id, node] : nodes_) {
+        std::shared_ptr<Node> copy_node = replica->nodes_[id];
+        for (auto& [name, child] : node->children_) {
+            copy_node->children_[name] = replica->nodes_[child->getId()];
+        }
+
+        copy_node->graph_ = node->graph_;
+    }
+
+    for (auto& [name, node] : variable_map_) {
+        replica->variable_map_[name] = replica->nodes_[node->getId()];
+    }
+
+    for (auto& [constant, node] : constant_map_) {
+        replica->constant_map_[constant] = replica->nodes_[node->getId()];
+    }
+
+    for (auto& [name, node] : inputs_) {
+        replica->inputs_[name] = replica->nodes_[node->getId()];
+    }
+
+    replica->alias_map_ = alias_map_;
+    replica->loss_node_ = loss_node_;
+    replica->node_index_ = node_index_;
+    replica->dtype_ = dtype_;
+
+    for (auto& [id, node] : nodes_) {
+        std::shared_ptr<Node> copy_node = replica->nodes_[id];
+        if (node->output_ == nullptr || !node->isParameter()) {
+            continue;
+        }
+
+        copy_node->output_ = node->output_;
+        copy_node->packed_ = node->packed_;
+        copy_node->shared_ = true;
+
+        // allocation looks at the children's gradient shapes, so forward-only replicas drop theirs afterwards
+        copy_node->gradient_ =
+            std::shared_ptr<GraphBuffer>(new GraphBuffer(node->gradient_->shape(), node->gradient_->dtype()));
+    }
+
+    for (auto& [name, node] : replica->inputs_) {
+        if (batch_size > 0 && !node->shape_.empty()) {
+            node->shape_[0] = batch_size;
+        }
+    }
+
+    replica->topologicalSort([&](std::shared_ptr<Node> node) {
+        if (node->shared_ || nodes_[node->getId()]->output_ == nullptr) {
+            return;
+        }
+
+        allocation::allocateNode(node);
+    });
+
+    if (!gradients) {
+        for (auto& [id, node] : replica->nodes_) {
+            node->gradient_ = nullptr;
+        }
+    }
+
+    return replica;
 }
 
 std::string Graph::getUniqueNodeName(const std::string& name) {
@@ -216,9 +318,11 @@ std::string Graph::getUniqueNodeName(const std::string& name) {
 
 std::shared_ptr<Node> Graph::newNode() {
     std::shared_ptr<Node> node(new Node(node_index_));
+    node->dtype_ = dtype_;
     node_index_++;
 
     nodes_[node->getId()] = node;
+    execution_order_.clear();
 
     return node;
 }
@@ -395,12 +499,68 @@ void Graph::setLossNode(const std::string& name) {
     loss_node_ = name;
 }
 
+void Graph::setExecutionOrder(const std::vector<int>& order) {
+    execution_order_ = order;
+}
+
+const std::vector<int>& Graph::executionOrder() {
+    return execution_order_;
+}
+
+std::shared_ptr<Node> Graph::getLossNode() {
+    return getNode(loss_node_);
+}
+
+void Graph::markCheckpoint(const std::string& name) {
+    getNode(name)->checkpoint_ = true;
+    checkpointing_ = true;
+}
+
+void Graph::setCheckpointing(bool checkpointing) {
+    // the activations freed while checkpointing aren't reallocated by the forward pass otherwise
+    if (checkpointing_ && !checkpointing) {
+        unallocated_ = true;
+    }
+
+    checkpointing_ = checkpointing;
+}
+
+bool Graph::checkpointing() {
+    return checkpointing_;
+}
+
+void Graph::setDtype(DTYPE dtype) {
+    dtype_ = dtype;
+    for (auto& [id, node] : nodes_) {
+        if (node->output_ != nullptr) {
+            std::cerr << strings::error("Graph::setDtype error: ") << "node " << strings::info(node->name_)
+                      << " is already allocated, the dtype must be set before allocation" << std::endl;
+            exit(-1);
+        }
+
+        node->dtype_ = dtype;
+        if (node->graph_ != nullptr && node->graph_->dtype_ != dtype) {
+            node->graph_->setDtype(dtype);
+        }
+    }
+
+    for (std::shared_ptr<Graph> subgraph : subgraphs_) {
+        if (subgraph->dtype_ != dtype) {
+            subgraph->setDtype(dtype);
+        }
+    }
+}
+
+DTYPE Graph::dtype() {
+    return dtype_;
+}
+
 float Graph::getLoss() {
     std::shared_ptr<Node> loss_node = getNode(loss_node_);
 
     float loss = 0;
     for (int i = 0; i < loss_node->output_->size(); i++) {
-        loss += loss_node->output_->getIndex<float>(i);
+        loss += loss_node->output_->getValue<float>(i);
     }
 
     return loss;
@@ -437,7 +597,7 @@ std::string Graph::createFunctionVariable(const std::string& name, const std::ve
         node->id_ = node_index_;
         node_index_++;
 
-        nodes_[node_index_] = node;
+        nodes_[node->id_] = node;
         variable_map_[node->name_] = node;
         alias_map_[node->name_] = node->name_;
 
@@ -507,6 +667,10 @@ bool Graph::isVariable(const std::string& name) {
 
 void Graph::log(std::ofstream& log_file) {
     for (auto& [id, node] : nodes_) {
+        if (node->output_ == nullptr) {
+            continue;
+        }
+
         log_file << node->name_ << " " << strings::vecToString(node->shape_) << std::endl;
         node->printOutput(log_file);
     }
@@ -514,24 +678,61 @@ void Graph::log(std::ofstream& log_file) {
 
 void Graph::gradLog(std::ofstream& log_file) {
     for (auto& [id, node] : nodes_) {
+        if (node->gradient_ == nullptr) {
+            continue;
+        }
+
         log_file << node->name_ << " " << strings::vecToString(node->shape_) << std::endl;
         node->printGradient(log_file);
     }
 }
 
+// allocates `node` if a previous partial allocation (see Graph::allocate(outputs)) skipped it
+void _allocate_skipped(std::shared_ptr<Node> node) {
+    if (node->output_ == nullptr) {
+        allocation::allocateNode(node);
+    }
+}
+
 void Graph::evaluate() {
     if (inputs_.size() > 0) {
         std::cerr << strings::error("Graph::evaluate error: ") << "missing values for inputs" << std::endl;
         exit(-1);
     }
 
-    topologicalSort(kernel::computeNode);
+    _compute(nullptr);
 }
 
 // TODO: this will need adjusted for batches
 //       the input loading here ONLY accounts for 1-D values
 //       no tensors or batched values yet
 void Graph::evaluate(std::unordered_map<std::string, std::vector<float>> inputs) {
+    _load_inputs(inputs);
+    _compute(nullptr);
+}
+
+void Graph::_compute(std::function<void(std::shared_ptr<Node>)> on_node) {
+    std::function<void(std::shared_ptr<Node>)> visit = [&](std::shared_ptr<Node> node) {
+        kernel::computeNode(node);
+        if (on_node) {
+            on_node(node);
+        }
+    };
+
+    if (checkpointing_) {
+        // allocates every node as it's reached
+        checkpoint::forward(*this, visit);
+    } else {
+        if (unallocated_) {
+            topologicalSort(_allocate_skipped);
+            unallocated_ = false;
+        }
+
+        parallelTopologicalSort(visit);
+    }
+}
+
+void Graph::_load_inputs(const std::unordered_map<std::string, std::vector<float>>& inputs) {
     for (auto& [name, value] : inputs) {
         if (inputs_.find(name) == inputs_.end()) {
             std::cerr << strings::error("Graph::evaluate error: ") << "input " << strings::info(name)
@@ -540,16 +741,137 @@ void Graph::evaluate(std::unordered_map<std::string, std::vector<float>> inputs)
         }
 
         std::shared_ptr<Node> input_node = inputs_[name];
+        _allocate_skipped(input_node);
         for (int i = 0; i < value.size(); i++) {
-            input_node->output_->setIndex(i, (void*)(&value[i]));
+            input_node->output_->setValue(i, value[i]);
         }
     }
+}
 
-    topologicalSort(kernel::computeNode);
+// with a single thread the pool has no workers to pick the task up, so it gets a thread of its own
+std::future<void> _run_async(std::function<void()> task) {
+    if (parallel::threadCount() == 1) {
+        return std::async(std::launch::async, task);
+    }
+
+    std::shared_ptr<std::promise<void>> done(new std::promise<void>());
+    parallel::pool().submit([task, done] {
+        task();
+        done->set_value();
+    });
+
+    return done->get_future();
+}
+
+std::future<void> Graph::evaluateAsync(std::unordered_map<std::string, std::vector<float>> inputs,
+                                       std::function<void(std::shared_ptr<Node>)> on_node) {
+    if (inputs.empty() && inputs_.size() > 0) {
+        std::cerr << strings::error("Graph::evaluateAsync error: ") << "missing values for inputs" << std::endl;
+        exit(-1);
+    }
+
+    return _run_async([this, inputs, on_node] {
+        _load_inputs(inputs);
+        _compute(on_node);
+    });
+}
+
+std::future<void> Graph::calculateGradientAsync(std::function<void(std::shared_ptr<Node>)> on_node) {
+    if (getNode(loss_node_)->output_ == nullptr) {
+        std::cerr << strings::error("Graph::calculateGradientAsync error: ") << "loss node "
+                  << strings::info(loss_node_) << " was never allocated, was it left out of a partial evaluate?"
+                  << std::endl;
+        exit(-1);
+    }
+
+    return _run_async([this, on_node] {
+        inverseTopologicalSort([&](std::shared_ptr<Node> node) {
+            gradient::propagateNode(node);
+            if (on_node) {
+                on_node(node);
+            }
+        });
+    });
+}
+
+void Graph::evaluate(std::unordered_map<std::string, std::vector<float>> inputs,
+                     const std::vector<std::string>& outputs) {
+    std::set<int> subgraph = dependencies(outputs);
+
+    // pick up anything a previous partial allocation skipped, checkpointing allocates nodes as it reaches them
+    if (unallocated_ && !checkpointing_) {
+        topologicalSort(_allocate_skipped, subgraph);
+    }
+
+    for (auto& [name, value] : inputs) {
+        if (inputs_.find(name) == inputs_.end()) {
+            std::cerr << strings::error("Graph::evaluate error: ") << "input " << strings::info(name)
+                      << " not found in Graph" << std::endl;
+            exit(-1);
+        }
+
+        // e.g. labels when only the prediction is requested
+        std::shared_ptr<Node> input_node = inputs_[name];
+        if (subgraph.find(input_node->getId()) == subgraph.end()) {
+            continue;
+        }
+
+        _allocate_skipped(input_node);
+        for (int i = 0; i < value.size(); i++) {
+            input_node->output_->setValue(i, value[i]);
+        }
+    }
+
+    if (checkpointing_) {
+        checkpoint::forward(*this, kernel::computeNode, subgraph);
+    } else {
+        parallelTopologicalSort(kernel::computeNode, subgraph);
+    }
 }
 
 void Graph::allocate() {
     topologicalSort(allocation::allocateNode);
+    unallocated_ = false;
+}
+
+void Graph::allocate(const std::vector<std::string>& outputs) {
+    topologicalSort(allocation::allocateNode, dependencies(outputs));
+    unallocated_ = true;
+}
+
+std::set<int> Graph::dependencies(const std::vector<std::string>& outputs) {
+    std::vector<std::string> roots = outputs;
+    if (roots.empty()) {
+        if (loss_node_.empty()) {
+            std::cerr << strings::error("Graph::dependencies error: ")
+                      << "no outputs requested and no loss node has been set" << std::endl;
+            exit(-1);
+        }
+
+        roots.push_back(loss_node_);
+    }
+
+    std::set<int> subgraph;
+    std::queue<std::shared_ptr<Node>> q;
+    for (const std::string& name : roots) {
+        q.push(getNode(name));
+    }
+
+    std::shared_ptr<Node> current;
+    while (!q.empty()) {
+        current = q.front();
+        q.pop();
+
+        if (!subgraph.insert(current->getId()).second) {
+            continue;
+        }
+
+        for (auto& [name, child] : current->children_) {
+            q.push(child);
+        }
+    }
+
+    return subgraph;
 }
 
 void _print_node(std::shared_ptr<Node> node) {
@@ -568,17 +890,21 @@ void Graph::serialize(const std::string& filepath) {
 
     int variables = 0;
     for (auto [id, node] : nodes_) {
-        variables += node->trainable_;
+        variables += node->trainable_ && node->output_ != nullptr;
     }
 
     for (auto [id, node] : nodes_) {
-        if (node->trainable_) {
+        if (node->trainable_ && node->output_ != nullptr) {
+            // enough digits to read the weights back without losing anything
+            file << std::setprecision(node->dtype_ == DTYPE::float64 ? std::numeric_limits<double>::max_digits10
+                                                                     : std::numeric_limits<float>::max_digits10);
+
             file << "\"" << node->name_ << "\": [";
             for (size_t i = 0; i < node->output_->size() - 1; i++) {
-                file << node->output_->getIndex<float>(i) << ", ";
+                file << node->output_->getValue<double>(i) << ", ";
             }
 
-            file << node->output_->getIndex<float>(node->output_->size() - 1) << "]" << (variables > 1 ? "," : "");
+            file << node->output_->getValue<double>(node->output_->size() - 1) << "]" << (variables > 1 ? "," : "");
             variables--;
         }
     }
@@ -589,32 +915,43 @@ void Graph::serialize(const std::string& filepath) {
 
 // bfs to propagate the gradient calculation down from the head
 void Graph::calculateGradient() {
+    if (getNode(loss_node_)->output_ == nullptr) {
+        std::cerr << strings::error("Graph::calculateGradient error: ") << "loss node "
+                  << strings::info(loss_node_) << " was never allocated, was it left out of a partial evaluate?"
+                  << std::endl;
+        exit(-1);
+    }
+
     inverseTopologicalSort(gradient::propagateNode);
 }
 
 void Graph::inverseTopologicalSort(std::function<void(std::shared_ptr<Node>)> visit_function) {
-    std::queue<std::shared_ptr<Node>> q;
-    q.push(getNode(loss_node_));
-
-    std::stringstream log_stream;
+    std::set<int> subgraph = dependencies({loss_node_});
 
-    std::shared_ptr<Node> current;
-    while (!q.empty()) {
-        current = q.front();
-        q.pop();
+    std::vector<std::shared_ptr<Node>> nodes;
+    for (int id : subgraph) {
+        nodes.push_back(nodes_[id]);
+    }
 
+    // replicas backpropagate concurrently, see Graph::replicate
+    static std::mutex log_mutex;
+    std::function<void(std::shared_ptr<Node>)> visit = [&](std::shared_ptr<Node> current) {
         visit_function(current);
 
         if (current->trainable_) {
+            std::stringstream log_stream;
             log_stream << current->name_ << " " << strings::vecToString(current->shape_) << std::endl;
             current->printGradient(log_stream);
+
+            std::lock_guard<std::mutex> lock(log_mutex);
             INFO(log_stream.str());
-            log_stream.flush();
         }
+    };
 
-        for (auto& [name, child] : current->children_) {
-            q.push(child);
-        }
+    if (checkpointing_) {
+        checkpoint::backward(*this, visit);
+    } else {
+        scheduler::backward(nodes, visit);
     }
 }
 
@@ -633,21 +970,32 @@ std::unordered_map<std::string, std::shared_ptr<Node>> Graph::getGradient() {
 // TODO: where's Adam?
 void Graph::applyGradients(int batch_size, float learning_rate) {
     for (auto& [id, node] : nodes_) {
+        // skipped by a partial allocation, nothing to update
+        if (node->gradient_ == nullptr) {
+            continue;
+        }
+
         if (node->trainable_) {
             buffer_ops::multiply(node->gradient_, learning_rate, node->gradient_);
             buffer_ops::divide(node->gradient_, batch_size, node->gradient_);
             buffer_ops::subtract(node->output_, node->gradient_, node->output_);
+            packing::invalidate(node);
         }
     }
 }
 
 void Graph::reset() {
     for (auto& [id, node] : nodes_) {
-        if (!node->trainable_ && node->operation_type_ != operations::constant && !node->const_) {
+        // outputs released by checkpointing are reallocated when they're next computed
+        // views are left alone, zeroing them would zero whatever they're viewing
+        if (node->output_ != nullptr && !node->trainable_ && node->operation_type_ != operations::constant &&
+            !node->const_ && !node->shared_ && !node->output_->isView()) {
             buffer_ops::set(node->output_, 0.);
         }
 
-        buffer_ops::set(node->gradient_, 1.);
+        if (node->gradient_ != nullptr) {
+            buffer_ops::set(node->gradient_, 1.);
+        }
     }
 }
 
@@ -656,12 +1004,46 @@ void Graph::reset() {
 // e.g. if a connected node has a fully calculated value, its edge is not taken into consideration
 //      for topological sort
 void Graph::topologicalSort(std::function<void(std::shared_ptr<Node>)> visit_function) {
+    _topological_sort(visit_function, nullptr);
+}
+
+void Graph::topologicalSort(std::function<void(std::shared_ptr<Node>)> visit_function,
+                            const std::set<int>& subgraph) {
+    _topological_sort(visit_function, &subgraph);
+}
+
+void Graph::parallelTopologicalSort(std::function<void(std::shared_ptr<Node>)> visit_function) {
+    std::vector<std::shared_ptr<Node>> nodes;
+    for (auto& [id, node] : nodes_) {
+        nodes.push_back(node);
+    }
+
+    scheduler::forward(nodes, visit_function);
+}
+
+void Graph::parallelTopologicalSort(std::function<void(std::shared_ptr<Node>)> visit_function,
+                                    const std::set<int>& subgraph) {
+    std::vector<std::shared_ptr<Node>> nodes;
+    for (int id : subgraph) {
+        nodes.push_back(nodes_[id]);
+    }
+
+    scheduler::forward(nodes, visit_function);
+}
+
+// `subgraph == nullptr` means the whole graph
+void Graph::_topological_sort(std::function<void(std::shared_ptr<Node>)> visit_function,
+                              const std::set<int>* subgraph) {
     std::map<std::string, int> degrees;
     std::queue<std::shared_ptr<Node>> q;
 
     std::map<std::string, std::set<std::string>> dependency_map;
 
     for (const auto& p : nodes_) {
+        if (subgraph != nullptr && subgraph->find(p.second->getId()) == subgraph->end()) {
+            continue;
+        }
+
         degrees[p.second->name_] = p.second->children_.size();
         if (p.second->children_.empty()) {
             q.push(p.second);
@@ -732,6 +1114,123 @@ std::shared_ptr<Node> Graph::getHead() {
     return current;
 }
 
+std::shared_ptr<Node> Graph::createNode(const std::string& name, const std::string& operation_type,
+                                        const std::vector<std::shared_ptr<Node>>& arguments) {
+    std::shared_ptr<Node> new_node = newNode();
+
+    new_node->name_ = getUniqueNodeName(name);
+    new_node->operation_type_ = operation_type;
+    new_node->trainable_ = false;
+    new_node->const_ = false;
+
+    for (std::shared_ptr<Node> argument : arguments) {
+        new_node->arg_order_.push_back(argument->name_);
+        new_node->children_[argument->name_] = argument;
+        edges_[new_node->id_].insert(argument->id_);
+    }
+
+    variable_map_[new_node->name_] = new_node;
+    alias_map_[new_node->name_] = new_node->name_;
+
+    return new_node;
+}
+
+std::map<int, std::vector<std::shared_ptr<Node>>> Graph::consumers() {
+    std::map<int, std::vector<std::shared_ptr<Node>>> consumer_map;
+    for (auto& [id, node] : nodes_) {
+        for (auto& [name, child] : node->children_) {
+            consumer_map[child->getId()].push_back(node);
+        }
+    }
+
+    return consumer_map;
+}
+
+std::map<int, int> Graph::useCounts() {
+    std::map<int, int> uses;
+    for (auto& [id, node] : nodes_) {
+        // function inputs are wired through `children_` alone
+        if (node->arg_order_.empty()) {
+            for (auto& [name, child] : node->children_) {
+                uses[child->getId()]++;
+            }
+        } else {
+            // input nodes keep their declaration arguments in `arg_order_` without any children behind them
+            for (const std::string& arg : node->arg_order_) {
+                auto it = node->children_.find(arg);
+                if (it != node->children_.end()) {
+                    uses[it->second->getId()]++;
+                }
+            }
+        }
+    }
+
+    return uses;
+}
+
+void Graph::replaceNode(std::shared_ptr<Node> node, std::shared_ptr<Node> replacement) {
+    for (auto& [id, consumer] : nodes_) {
+        std::vector<std::string> stale_names;
+        for (auto& [name, child] : consumer->children_) {
+            if (child == node) {
+                stale_names.push_back(name);
+            }
+        }
+
+        for (const std::string& name : stale_names) {
+            consumer->children_.erase(name);
+            consumer->children_[replacement->name_] = replacement;
+
+            for (std::string& arg : consumer->arg_order_) {
+                if (arg == name) {
+                    arg = replacement->name_;
+                }
+            }
+        }
+
+        if (stale_names.size() > 0) {
+            edges_[consumer->id_].erase(node->id_);
+            edges_[consumer->id_].insert(replacement->id_);
+        }
+    }
+
+    // anything aliased to `node` now resolves to `replacement`, including names left by earlier replacements, so
+    // removeNode has nothing of it left to drop
+    variable_map_[node->name_] = replacement;
+    for (auto& [name, variable] : variable_map_) {
+        if (variable == node) {
+            variable = replacement;
+        }
+    }
+
+    for (auto& [value, constant] : constant_map_) {
+        if (constant == node) {
+            constant = replacement;
+        }
+    }
+
+    removeNode(node);
+}
+
+void Graph::removeNode(std::shared_ptr<Node> node) {
+    nodes_.erase(node->id_);
+    edges_.erase(node->id_);
+    execution_order_.clear();
+
+    // constants are shared by value, make sure a later variable doesn't pick up the orphan
+    for (auto it = constant_map_.begin(); it != constant_map_.end(); it++) {
+        if (it->second == node) {
+            constant_map_.erase(it);
+            break;
+        }
+    }
+
+    // nor should anything still resolve its name to it, e.g. Graph::replicate
+    for (auto it = variable_map_.begin(); it != variable_map_.end();) {
+        it = it->second == node ? variable_map_.erase(it) : std::next(it);
+    }
+}
+
 void Graph::listNodes() {
     for (auto& p : variable_map_) {
         std::cout << strings::info(p.first + " " + strings::vecToString(p.second->shape_)) << ": " << std::endl;
@@ -0,0 +1,130 @@
+#include "hogwild.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "graph.h"
+#include "packing.h"
+#include "parallel.h"
+#include "string_utils.h"
+
+namespace hogwild {
+
+Trainer::Trainer(std::shared_ptr<Graph> graph, int workers) : graph_(graph), batch_size_(1) {
+    if (workers < 1) {
+        std::cerr << strings::error("hogwild::Trainer error: ") << "need at least one worker, got "
+                  << strings::info(std::to_string(workers)) << std::endl;
+        exit(-1);
+    }
+
+    for (std::shared_ptr<Node> input : graph_->getInputs()) {
+        if (!input->shape_.empty()) {
+            batch_size_ = input->shape_[0];
+        }
+    }
+
+    for (int i = 0; i < workers; i++) {
+        replicas_.push_back(graph_->replicate(0, true));
+    }
+
+    for (auto& [id, node] : graph_->nodes_) {
+        if (node->trainable_ && node->output_ != nullptr) {
+            parameters_.push_back(id);
+        }
+    }
+}
+
+// Graph::applyGradients, minus the writes to the gradient buffer and with every parameter store atomic
+// a relaxed load/store pair is a plain move on the usual targets, it only rules out torn or elided writes
+// `node` is a replica's parameter, its output is shared and its gradient private
+void _apply(std::shared_ptr<Node> node, float scale) {
+    dtypes::dispatch(node->dtype_, [&]<typename T>() {
+        T* weights = (T*)node->output_->getData();
+        const T* grads = (const T*)node->gradient_->getData();
+
+        size_t size = node->output_->size();
+        for (size_t i = 0; i < size; i++) {
+            std::atomic_ref<T> weight(weights[i]);
+            weight.store(weight.load(std::memory_order_relaxed) - scale * grads[i], std::memory_order_relaxed);
+        }
+    });
+}
+
+Report Trainer::run(std::function<std::unordered_map<std::string, std::vector<float>>()> sample, int steps,
+                    float learning_rate) {
+    Report report;
+    report.steps_ = steps;
+    report.losses_ = std::vector<float>(std::max(steps, 0), 0);
+
+    std::atomic<int> next_step(0);
+
+    // bumped once per applied update
+    std::atomic<long> version(0);
+
+    std::atomic<long> total_staleness(0);
+    std::atomic<int> max_staleness(0);
+
+    std::mutex sample_mutex;
+
+    float scale = learning_rate / batch_size_;
+
+    int workers = replicas_.size();
+    parallel::parallelFor(0, workers, 1, [&](size_t first, size_t last) {
+        for (size_t w = first; w < last; w++) {
+            parallel::SerialScope serial;
+            std::shared_ptr<Graph> replica = replicas_[w];
+
+            int step;
+            while ((step = next_step++) < steps) {
+                std::unordered_map<std::string, std::vector<float>> batch;
+                {
+                    std::lock_guard<std::mutex> lock(sample_mutex);
+                    batch = sample();
+                }
+
+                long read = version.load(std::memory_order_relaxed);
+
+                replica->reset();
+                replica->evaluate(batch);
+                replica->calculateGradient();
+
+                for (int id : parameters_) {
+                    _apply(replica->nodes_[id], scale);
+                    packing::invalidate(replica->nodes_[id]);
+                }
+
+                int staleness = version.fetch_add(1, std::memory_order_relaxed) - read;
+                total_staleness += staleness;
+
+                int seen = max_staleness.load();
+                while (staleness > seen && !max_staleness.compare_exchange_weak(seen, staleness)) {
+                }
+
+                report.losses_[step] = replica->getLoss();
+            }
+        }
+    });
+
+    report.mean_staleness_ = steps > 0 ? (double)total_staleness.load() / steps : 0;
+    report.max_staleness_ = max_staleness.load();
+
+    return report;
+}
+
+void printReport(const Report& report) {
+    std::cout << strings::debug("Hogwild:") << std::endl;
+    std::cout << strings::debug("- steps: ") << strings::info(std::to_string(report.steps_)) << std::endl;
+    std::cout << strings::debug("- mean staleness: ") << strings::info(std::to_string(report.mean_staleness_))
+              << std::endl;
+    std::cout << strings::debug("- max staleness: ") << strings::info(std::to_string(report.max_staleness_))
+              << std::endl;
+}
+
+}  // namespace hogwild
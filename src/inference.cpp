@@ -0,0 +1,127 @@
+#include "inference.h"
+
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dtypes.h"
+#include "graph.h"
+#include "quantize.h"
+#include "string_utils.h"
+#include "views.h"
+
+namespace inference {
+
+ContextPool::ContextPool(std::shared_ptr<Graph> graph, int contexts, const std::vector<std::string>& outputs)
+    : graph_(graph), outputs_(outputs) {
+    if (contexts < 1) {
+        std::cerr << strings::error("inference::ContextPool error: ") << "need at least one context, got "
+                  << strings::info(std::to_string(contexts)) << std::endl;
+        exit(-1);
+    }
+
+    if (outputs_.empty()) {
+        std::cerr << strings::error("inference::ContextPool error: ") << "no outputs requested" << std::endl;
+        exit(-1);
+    }
+
+    for (const std::string& name : outputs_) {
+        if (graph_->getNode(name)->output_ == nullptr) {
+            std::cerr << strings::error("inference::ContextPool error: ") << "output " << strings::info(name)
+                      << " was never allocated" << std::endl;
+            exit(-1);
+        }
+    }
+
+    for (int i = 0; i < contexts; i++) {
+        contexts_.push_back(graph_->replicate(0, false));
+    }
+
+    free_ = contexts_;
+}
+
+std::shared_ptr<Graph> ContextPool::_acquire() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    available_.wait(lock, [&] { return !free_.empty(); });
+
+    std::shared_ptr<Graph> context = free_.back();
+    free_.pop_back();
+
+    return context;
+}
+
+void ContextPool::_release(std::shared_ptr<Graph> context) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(context);
+    }
+
+    available_.notify_one();
+}
+
+std::unordered_map<std::string, std::vector<float>> ContextPool::evaluate(
+    const std::unordered_map<std::string, std::vector<float>>& inputs) {
+    std::shared_ptr<Graph> context = _acquire();
+
+    // the context starts from the same state every evaluation, as a graph does between training steps
+    // this only touches the context's own activations, shared parameters are skipped
+    context->reset();
+    context->evaluate(inputs, outputs_);
+
+    std::unordered_map<std::string, std::vector<float>> results;
+    for (const std::string& name : outputs_) {
+        std::shared_ptr<GraphBuffer> output = views::contiguous(context->getNode(name)->output_);
+
+        std::vector<float>& values = results[name];
+        values.resize(output->size());
+        for (size_t i = 0; i < output->size(); i++) {
+            values[i] = output->getValue<float>(i);
+        }
+    }
+
+    _release(context);
+
+    return results;
+}
+
+int ContextPool::size() {
+    return contexts_.size();
+}
+
+// views hold none of their own, see views.h
+size_t _bytes(std::shared_ptr<GraphBuffer> buffer) {
+    return buffer == nullptr || buffer->isView() ? 0 : buffer->size() * dtypes::dtypeSize(buffer->dtype());
+}
+
+size_t ContextPool::parameterBytes() {
+    size_t bytes = 0;
+    for (auto& [id, node] : contexts_[0]->nodes_) {
+        if (node->shared_) {
+            bytes += _bytes(node->output_);
+        }
+
+        // shared between contexts through the node, see quantize.h
+        if (node->quantized_ != nullptr) {
+            bytes += quantize::bytes(*node->quantized_);
+        }
+    }
+
+    return bytes;
+}
+
+size_t ContextPool::contextBytes() {
+    size_t bytes = 0;
+    for (auto& [id, node] : contexts_[0]->nodes_) {
+        if (!node->shared_) {
+            bytes += _bytes(node->output_) + _bytes(node->gradient_) + _bytes(node->saved_);
+        }
+    }
+
+    return bytes;
+}
+
+}  // namespace inference
@@ -72,6 +72,16 @@ void IndexIterator::increment() {
     }
 }
 
+void IndexIterator::seek(size_t index) {
+    inc_count_ = index;
+    end_ = index >= size_;
+
+    for (int i = shape_.size() - 1; i > -1; i--) {
+        current_[i] = index % shape_[i];
+        index /= shape_[i];
+    }
+}
+
 bool IndexIterator::end() {
     return inc_count_ >= size_;
 }
@@ -1,20 +1,29 @@
 #include "kernel.h"
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 
 #include "broadcasting.h"
 #include "buffer.h"
 #include "buffer_ops.h"
+#include "dense.h"
+#include "fusion.h"
 #include "graph.h"
 #include "iterators.h"
+#include "normalization.h"
 #include "ops.h"
+#include "packing.h"
+#include "parallel.h"
+#include "quantize.h"
+#include "reduction.h"
+#include "softmax.h"
 #include "string_utils.h"
+#include "views.h"
 
 namespace kernel {
 
-// TODO: figure something out with the float templates
-// TODO: parallelization
+// element-wise kernels are templated lambdas, dispatched once per node on `node->dtype_` (see dtypes.h)
 // TODO: gpu programming
 // TODO: is there anything we can do to manage precision? is that even an issue?
 //
@@ -39,12 +48,25 @@ void _element_wise(binary_lambda element_function, std::shared_ptr<Buffer> a, st
     auto [a_broadcasted, b_broadcasted] = broadcasting::makeBroadcastable(a, b);
     std::vector<int> out_shape_broadcasted = broadcasting::broadcastedOutputShape(a_broadcasted, b_broadcasted);
     std::shared_ptr<BroadcastedBuffer> out_broadcasted(new BroadcastedBuffer(out, out_shape_broadcasted));
-    iterators::IndexIterator it(out_shape_broadcasted);
 
-    while (!it.end()) {
-        element_function(a_broadcasted, b_broadcasted, out_broadcasted, it.getIndices());
-        it.increment();
+    size_t size = 1;
+    for (int dim : out_shape_broadcasted) {
+        size *= dim;
     }
+
+    // an output smaller than the broadcast, e.g. a gradient being accumulated into a broadcasted operand,
+    // has elements written more than once and has to stay on the one thread
+    size_t grain = out->size() == size ? parallel::GRAIN : size;
+
+    parallel::parallelFor(0, size, grain, [&](size_t first, size_t last) {
+        iterators::IndexIterator it(out_shape_broadcasted);
+        it.seek(first);
+
+        for (size_t i = first; i < last; i++) {
+            element_function(a_broadcasted, b_broadcasted, out_broadcasted, it.getIndices());
+            it.increment();
+        }
+    });
 }
 
 void _element_wise(std::function<void(std::shared_ptr<Buffer>, std::shared_ptr<Buffer>, size_t)> element_function,
@@ -57,9 +79,11 @@ void _element_wise(std::function<void(std::shared_ptr<Buffer>, std::shared_ptr<B
         exit(-1);
     }
 
-    for (size_t i = 0; i < a->size(); i++) {
-        element_function(a, out, i);
-    }
+    parallel::parallelFor(0, a->size(), parallel::GRAIN, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            element_function(a, out, i);
+        }
+    });
 }
 
 void _element_wise(
@@ -73,9 +97,11 @@ void _element_wise(
         exit(-1);
     }
 
-    for (size_t i = 0; i < out->size(); i++) {
-        element_function(a, b, out, i);
-    }
+    parallel::parallelFor(0, out->size(), parallel::GRAIN, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            element_function(a, b, out, i);
+        }
+    });
 }
 
 // naive implementation
@@ -84,10 +110,33 @@ void matmul(std::shared_ptr<Node> node) {
     std::shared_ptr<Node> left_node = node->children_[node->arg_order_[0]];
     std::shared_ptr<Node> right_node = node->children_[node->arg_order_[1]];
 
+    // weights are packed once instead of by every product, see packing.h
+    // the packed product reads its left operand flat, so transposed views go through the flags below
+    if (packing::packable(right_node) && left_node->output_->contiguous()) {
+        buffer_ops::matmul(left_node->output_, *packing::get(right_node, false), node->output_, gemm::none());
+        return;
+    }
+
     std::vector<int> l = left_node->shape_;
     std::vector<int> r = right_node->shape_;
     std::vector<int> o = node->shape_;
 
+    // transposed views are read in place through the gemm's transpose flags, see views.h
+    bool trans_l = !left_node->output_->contiguous();
+    bool trans_r = !right_node->output_->contiguous();
+    if (trans_l || trans_r) {
+        if (trans_l) {
+            std::swap(l[l.size() - 2], l[l.size() - 1]);
+        }
+
+        if (trans_r) {
+            std::swap(r[r.size() - 2], r[r.size() - 1]);
+        }
+
+        buffer_ops::matmul(left_node->output_, trans_l, right_node->output_, trans_r, node->output_, l, r, o, 1, 0);
+        return;
+    }
+
     buffer_ops::matmul(left_node->output_, right_node->output_, node->output_, l, r, o);
 }
 
@@ -107,110 +156,209 @@ void ones(std::shared_ptr<Node> node) {
 }
 
 void add(std::shared_ptr<Node> node) {
-    _element_wise(
-        [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
-           const std::vector<int>& indices) {
-            float output = a->getIndex<float>(indices) + b->getIndex<float>(indices);
-            out->setIndex(indices, (void*)(&output));
-        },
-        node->children_[node->arg_order_[0]]->output_, node->children_[node->arg_order_[1]]->output_, node->output_);
+    dtypes::dispatch(node->dtype_, [&]<typename T>() {
+        _element_wise(
+            [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
+               const std::vector<int>& indices) {
+                T output = a->getIndex<T>(indices) + b->getIndex<T>(indices);
+                out->setIndex(indices, (void*)(&output));
+            },
+            node->children_[node->arg_order_[0]]->output_, node->children_[node->arg_order_[1]]->output_,
+            node->output_);
+    });
 }
 
 void subtract(std::shared_ptr<Node> node) {
-    _element_wise(
-        [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
-           const std::vector<int>& indices) {
-            float output = a->getIndex<float>(indices) - b->getIndex<float>(indices);
-            out->setIndex(indices, (void*)(&output));
-        },
-        node->children_[node->arg_order_[0]]->output_, node->children_[node->arg_order_[1]]->output_, node->output_);
+    dtypes::dispatch(node->dtype_, [&]<typename T>() {
+        _element_wise(
+            [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
+               const std::vector<int>& indices) {
+                T output = a->getIndex<T>(indices) - b->getIndex<T>(indices);
+                out->setIndex(indices, (void*)(&output));
+            },
+            node->children_[node->arg_order_[0]]->output_, node->children_[node->arg_order_[1]]->output_,
+            node->output_);
+    });
 }
 
 void multiply(std::shared_ptr<Node> node) {
-    _element_wise(
-        [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
-           const std::vector<int>& indices) {
-            float output = a->getIndex<float>(indices) * b->getIndex<float>(indices);
-            out->setIndex(indices, (void*)(&output));
-        },
-        node->children_[node->arg_order_[0]]->output_, node->children_[node->arg_order_[1]]->output_, node->output_);
+    dtypes::dispatch(node->dtype_, [&]<typename T>() {
+        _element_wise(
+            [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
+               const std::vector<int>& indices) {
+                T output = a->getIndex<T>(indices) * b->getIndex<T>(indices);
+                out->setIndex(indices, (void*)(&output));
+            },
+            node->children_[node->arg_order_[0]]->output_, node->children_[node->arg_order_[1]]->output_,
+            node->output_);
+    });
 }
 
 void divide(std::shared_ptr<Node> node) {
-    _element_wise(
-        [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
-           const std::vector<int>& indices) {
-            if (std::fabs(b->getIndex<float>(indices)) < EPSILON) {
-                std::cerr << strings::error("kernel::divide error: ") << "divide by zero error." << std::endl;
-                exit(-1);
-            }
+    dtypes::dispatch(node->dtype_, [&]<typename T>() {
+        _element_wise(
+            [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
+               const std::vector<int>& indices) {
+                if (std::fabs(b->getIndex<T>(indices)) < EPSILON) {
+                    std::cerr << strings::error("kernel::divide error: ") << "divide by zero error." << std::endl;
+                    exit(-1);
+                }
 
-            float output = a->getIndex<float>(indices) / b->getIndex<float>(indices);
-            out->setIndex(indices, (void*)(&output));
-        },
-        node->children_[node->arg_order_[0]]->output_, node->children_[node->arg_order_[1]]->output_, node->output_);
+                T output = a->getIndex<T>(indices) / b->getIndex<T>(indices);
+                out->setIndex(indices, (void*)(&output));
+            },
+            node->children_[node->arg_order_[0]]->output_, node->children_[node->arg_order_[1]]->output_,
+            node->output_);
+    });
 }
 
 void sqrt(std::shared_ptr<Node> node) {
-    _element_wise(
-        [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, size_t index) {
-            if (a->getIndex<float>(index) < 0) {
-                std::cerr << strings::error("kernel::sqrt error: ")
-                          << "argument is less than zero. We don't support complex numbers yet!" << std::endl;
-                exit(-1);
-            }
+    dtypes::dispatch(node->dtype_, [&]<typename T>() {
+        _element_wise(
+            [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, size_t index) {
+                if (a->getIndex<T>(index) < 0) {
+                    std::cerr << strings::error("kernel::sqrt error: ")
+                              << "argument is less than zero. We don't support complex numbers yet!" << std::endl;
+                    exit(-1);
+                }
 
-            float output = std::sqrt(a->getIndex<float>(index));
-            out->setIndex(index, (void*)(&output));
-        },
-        node->children_[node->arg_order_[0]]->output_, node->output_);
+                T output = std::sqrt(a->getIndex<T>(index));
+                out->setIndex(index, (void*)(&output));
+            },
+            node->children_[node->arg_order_[0]]->output_, node->output_);
+    });
 }
 
 void exp(std::shared_ptr<Node> node) {
-    _element_wise(
-        [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, size_t index) {
-            float output = std::exp(a->getIndex<float>(index));
-            out->setIndex(index, (void*)(&output));
-        },
-        node->children_[node->arg_order_[0]]->output_, node->output_);
+    dtypes::dispatch(node->dtype_, [&]<typename T>() {
+        _element_wise(
+            [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, size_t index) {
+                T output = std::exp(a->getIndex<T>(index));
+                out->setIndex(index, (void*)(&output));
+            },
+            node->children_[node->arg_order_[0]]->output_, node->output_);
+    });
+}
+
+void ln(std::shared_ptr<Node> node) {
+    dtypes::dispatch(node->dtype_, [&]<typename T>() {
+        _element_wise(
+            [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, size_t index) {
+                if (a->getIndex<T>(index) <= 0) {
+                    std::cerr << strings::error("kernel::ln error: ") << "argument must be greater than zero"
+                              << std::endl;
+                    exit(-1);
+                }
+
+                T output = std::log(a->getIndex<T>(index));
+                out->setIndex(index, (void*)(&output));
+            },
+            node->children_[node->arg_order_[0]]->output_, node->output_);
+    });
 }
 
 void pow(std::shared_ptr<Node> node) {
-    _element_wise(
-        [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
-           const std::vector<int>& indices) {
-            float output = std::pow(a->getIndex<float>(indices), b->getIndex<float>(indices));
-            out->setIndex(indices, (void*)(&output));
-        },
-        node->children_[node->arg_order_[0]]->output_, node->children_[node->arg_order_[1]]->output_, node->output_);
+    dtypes::dispatch(node->dtype_, [&]<typename T>() {
+        _element_wise(
+            [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, std::shared_ptr<Buffer> out,
+               const std::vector<int>& indices) {
+                T output = std::pow(a->getIndex<T>(indices), b->getIndex<T>(indices));
+                out->setIndex(indices, (void*)(&output));
+            },
+            node->children_[node->arg_order_[0]]->output_, node->children_[node->arg_order_[1]]->output_,
+            node->output_);
+    });
 }
 
 void sigmoid(std::shared_ptr<Node> node) {
-    _element_wise(
-        [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, size_t index) {
-            float output = 1 / (1 + std::exp(-(a->getIndex<float>(index))));
-            out->setIndex(index, (void*)(&output));
-        },
-        node->children_[node->arg_order_[0]]->output_, node->output_);
+    dtypes::dispatch(node->dtype_, [&]<typename T>() {
+        _element_wise(
+            [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, size_t index) {
+                T output = 1 / (1 + std::exp(-(a->getIndex<T>(index))));
+                out->setIndex(index, (void*)(&output));
+            },
+            node->children_[node->arg_order_[0]]->output_, node->output_);
+    });
 }
 
 void relu(std::shared_ptr<Node> node) {
-    _element_wise(
-        [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, size_t index) {
-            float output = a->getIndex<float>(index);
-            output = output > 0 ? output : 0;
-            out->setIndex(index, (void*)(&output));
-        },
-        node->children_[node->arg_order_[0]]->output_, node->output_);
+    dtypes::dispatch(node->dtype_, [&]<typename T>() {
+        _element_wise(
+            [](std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, size_t index) {
+                T output = a->getIndex<T>(index);
+                output = output > 0 ? output : T(0);
+                out->setIndex(index, (void*)(&output));
+            },
+            node->children_[node->arg_order_[0]]->output_, node->output_);
+    });
 }
 
 void reduce_sum(std::shared_ptr<Node> node) {
-    std::shared_ptr<GraphBuffer> a = node->children_[node->arg_order_[0]]->output_;
-    std::shared_ptr<GraphBuffer> out = node->output_;
-    for (size_t i = 0; i < a->size(); i++) {
-        float output = a->getIndex<float>(i) + out->getIndex<float>(0);
-        out->setIndex(0, (void*)(&output));
-    }
+    reduction::forward(node);
+}
+
+void reduce_mean(std::shared_ptr<Node> node) {
+    reduction::forward(node);
+}
+
+void reduce_max(std::shared_ptr<Node> node) {
+    reduction::forward(node);
+}
+
+void softmax(std::shared_ptr<Node> node) {
+    softmax::forward(node);
+}
+
+void softmax_cross_entropy(std::shared_ptr<Node> node) {
+    softmax::forward(node);
+}
+
+void layer_norm(std::shared_ptr<Node> node) {
+    normalization::forward(node);
+}
+
+void rms_norm(std::shared_ptr<Node> node) {
+    normalization::forward(node);
+}
+
+void fused(std::shared_ptr<Node> node) {
+    fusion::forward(node);
+}
+
+void dense(std::shared_ptr<Node> node) {
+    dense::forward(node);
+}
+
+void dense_relu(std::shared_ptr<Node> node) {
+    dense::forward(node);
+}
+
+void dense_sigmoid(std::shared_ptr<Node> node) {
+    dense::forward(node);
+}
+
+void qmatmul(std::shared_ptr<Node> node) {
+    quantize::forward(node);
+}
+
+void transpose(std::shared_ptr<Node> node) {
+    views::forward(node);
+}
+
+void reshape(std::shared_ptr<Node> node) {
+    views::forward(node);
+}
+
+void slice(std::shared_ptr<Node> node) {
+    views::forward(node);
+}
+
+void expand(std::shared_ptr<Node> node) {
+    views::forward(node);
+}
+
+void squeeze(std::shared_ptr<Node> node) {
+    views::forward(node);
 }
 
 // `input_image` has shape [batch_dims..., hi, wi, c] where c is the number of channels
@@ -256,51 +404,60 @@ void conv2d(std::shared_ptr<Node> node) {
         output_image_size *= output_image->shape_[i];
     }
 
+    // output rows are independent of each other
+    size_t row_work = std::max(1, ox * kernel_channels * kx * ky * input_channels);
+
     // 7 for loops lol
-    for (int batch = 0; batch < batches; batch++) {
-        // iterate over pixels in the output image
-        for (int y = 0; y < oy; y++) {
-            for (int x = 0; x < ox; x++) {
-                float output_value = 0;
-
-                // mapping from output coordinates to input coordinates
-                int input_x = x + dk_x;
-                int input_y = y + dk_y;
-
-                // iterating over the kernel
-                for (int kc = 0; kc < kernel_channels; kc++) {
-                    for (int i = -std::ceil(ky / 2.) + 1; i < std::ceil(ky / 2.); i++) {
-                        for (int j = -std::ceil(kx / 2.) + 1; j < std::ceil(kx / 2.); j++) {
-                            int kernel_x = dk_x - j;
-                            int kernel_y = dk_y - i;
-
-                            // iterating over each channel
-                            for (int ic = 0; ic < input_channels; ic++) {
-                                float input_value =
-                                    input_image->getIndex<float>(batch * input_image_size +             // batch index
+    dtypes::dispatch(node->dtype_, [&]<typename T>() {
+        parallel::parallelFor(0, batches * oy, std::max((size_t)1, parallel::GRAIN / row_work), [&](size_t first, size_t last) {
+            for (size_t row = first; row < last; row++) {
+                int batch = row / oy;
+                int y = row % oy;
+
+                // iterate over pixels in the output image
+                for (int x = 0; x < ox; x++) {
+                    dtypes::Accumulate<T> output_value = 0;
+
+                    // mapping from output coordinates to input coordinates
+                    int input_x = x + dk_x;
+                    int input_y = y + dk_y;
+
+                    // iterating over the kernel
+                    for (int kc = 0; kc < kernel_channels; kc++) {
+                        for (int i = -std::ceil(ky / 2.) + 1; i < std::ceil(ky / 2.); i++) {
+                            for (int j = -std::ceil(kx / 2.) + 1; j < std::ceil(kx / 2.); j++) {
+                                int kernel_x = dk_x - j;
+                                int kernel_y = dk_y - i;
+
+                                // iterating over each channel
+                                for (int ic = 0; ic < input_channels; ic++) {
+                                    T input_value =
+                                        input_image->getIndex<T>(batch * input_image_size +             // batch index
                                                                  (input_y + i) * ix * input_channels +  // y index
                                                                  (input_x + j) * input_channels + ic);  // x index
 
-                                float kernel_value = kernel->getIndex<float>(kernel_y * kx * kernel_channels +
-                                                                             kernel_x * kernel_channels + kc);
+                                    T kernel_value = kernel->getIndex<T>(kernel_y * kx * kernel_channels +
+                                                                         kernel_x * kernel_channels + kc);
 
-                                output_value += input_value * kernel_value;
-                            }
+                                    output_value += input_value * kernel_value;
+                                }
 
-                            // output will be the average of each input channel
-                            output_value /= input_channels;
+                                // output will be the average of each input channel
+                                output_value /= input_channels;
 
-                            output_image->setIndex(batch * output_image_size +     // batch index
-                                                       y * ox * kernel_channels +  // y index
-                                                       x * kernel_channels +       // x index
-                                                       kc,                         // channel index
-                                                   (void*)(&output_value));
+                                T stored = output_value;
+                                output_image->setIndex(batch * output_image_size +     // batch index
+                                                           y * ox * kernel_channels +  // y index
+                                                           x * kernel_channels +       // x index
+                                                           kc,                         // channel index
+                                                       (void*)(&stored));
+                            }
                         }
                     }
                 }
             }
-        }
-    }
+        });
+    });
 }
 
 }  // namespace kernel
@@ -0,0 +1,202 @@
+#include "matmul_chain.h"
+
+#include <algorithm>
+#include <climits>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "allocation.h"
+#include "broadcasting.h"
+#include "graph.h"
+#include "ops.h"
+#include "string_utils.h"
+
+namespace matmul_chain {
+
+bool _is_matmul(std::shared_ptr<Node> node) {
+    return node->operation_type_ == operations::matmul && node->arg_order_.size() == 2 && node->output_ != nullptr;
+}
+
+size_t _product(const std::vector<int>& shape, int begin, int end) {
+    size_t product = 1;
+    for (int i = begin; i < end; i++) {
+        product *= shape[i];
+    }
+
+    return product;
+}
+
+// walks the chain rooted at `node`, collecting its operands left to right and the intermediates in between
+// returns the multiply-adds of the chain as it's currently written
+size_t _flatten(std::shared_ptr<Node> node, std::map<int, int>& uses, std::vector<std::shared_ptr<Node>>& operands,
+                std::vector<std::shared_ptr<Node>>& intermediates) {
+    size_t flops = 0;
+    for (const std::string& arg : node->arg_order_) {
+        std::shared_ptr<Node> child = node->children_[arg];
+
+        if (_is_matmul(child) && uses[child->getId()] == 1) {
+            intermediates.push_back(child);
+            flops += _flatten(child, uses, operands, intermediates);
+        } else {
+            operands.push_back(child);
+        }
+    }
+
+    const std::vector<int>& shape = node->shape_;
+    const std::vector<int>& left_shape = node->children_[node->arg_order_[0]]->shape_;
+
+    return flops + _product(shape, 0, shape.size()) * left_shape.back();
+}
+
+void optimalOrder(const std::vector<size_t>& dims, const std::vector<std::vector<size_t>>& batches,
+                  std::vector<std::vector<size_t>>& cost, std::vector<std::vector<int>>& split) {
+    int n = dims.size() - 1;
+
+    cost = std::vector<std::vector<size_t>>(n, std::vector<size_t>(n, 0));
+    split = std::vector<std::vector<int>>(n, std::vector<int>(n, 0));
+
+    for (int length = 2; length <= n; length++) {
+        for (int i = 0; i + length - 1 < n; i++) {
+            int j = i + length - 1;
+
+            cost[i][j] = ULLONG_MAX;
+            for (int k = i; k < j; k++) {
+                size_t candidate = cost[i][k] + cost[k + 1][j] + batches[i][j] * dims[i] * dims[k + 1] * dims[j + 1];
+                if (candidate < cost[i][j]) {
+                    cost[i][j] = candidate;
+                    split[i][j] = k;
+                }
+            }
+        }
+    }
+}
+
+std::shared_ptr<Node> _rebuild(std::shared_ptr<Graph> graph, std::shared_ptr<Node> head,
+                               const std::vector<std::shared_ptr<Node>>& operands,
+                               const std::vector<std::vector<int>>& split, int i, int j) {
+    if (i == j) {
+        return operands[i];
+    }
+
+    std::shared_ptr<Node> left = _rebuild(graph, head, operands, split, i, split[i][j]);
+    std::shared_ptr<Node> right = _rebuild(graph, head, operands, split, split[i][j] + 1, j);
+
+    // the head keeps its identity so consumers and outstanding references are untouched
+    if (i == 0 && j == operands.size() - 1) {
+        head->children_.clear();
+        head->children_[left->name_] = left;
+        head->children_[right->name_] = right;
+        head->arg_order_ = {left->name_, right->name_};
+
+        return head;
+    }
+
+    std::shared_ptr<Node> product = graph->createNode(head->name_ + "_chain", operations::matmul, {left, right});
+    allocation::allocateNode(product);
+
+    return product;
+}
+
+Report run(std::shared_ptr<Graph> graph) {
+    Report report = {0, 0, 0, 0};
+
+    std::map<int, int> uses = graph->useCounts();
+    std::map<int, std::vector<std::shared_ptr<Node>>> consumer_map = graph->consumers();
+
+    // heads are matmuls that aren't absorbed into a consuming matmul
+    std::vector<std::shared_ptr<Node>> heads;
+    for (auto& [id, node] : graph->nodes_) {
+        if (!_is_matmul(node)) {
+            continue;
+        }
+
+        bool absorbed = uses[id] == 1 && _is_matmul(consumer_map[id].front());
+        if (!absorbed) {
+            heads.push_back(node);
+        }
+    }
+
+    for (std::shared_ptr<Node> head : heads) {
+        std::vector<std::shared_ptr<Node>> operands;
+        std::vector<std::shared_ptr<Node>> intermediates;
+
+        size_t current_flops = _flatten(head, uses, operands, intermediates);
+        if (operands.size() < 3) {
+            continue;
+        }
+
+        report.chains_++;
+
+        int rank = 0;
+        for (std::shared_ptr<Node> operand : operands) {
+            rank = std::max(rank, (int)operand->shape_.size());
+        }
+
+        std::vector<size_t> dims;
+        std::vector<std::vector<int>> batch_shapes;
+        bool valid = true;
+        for (int i = 0; i < operands.size(); i++) {
+            std::vector<int> shape = broadcasting::padVector(operands[i]->shape_, rank);
+            if (i == 0) {
+                dims.push_back(shape[rank - 2]);
+            } else if (dims.back() != shape[rank - 2]) {
+                valid = false;
+            }
+
+            dims.push_back(shape[rank - 1]);
+            batch_shapes.push_back(std::vector<int>(shape.begin(), shape.end() - 2));
+        }
+
+        if (!valid) {
+            continue;
+        }
+
+        int n = operands.size();
+
+        // broadcasted batch size of every sub-chain
+        std::vector<std::vector<size_t>> batches(n, std::vector<size_t>(n, 1));
+        for (int i = 0; i < n; i++) {
+            std::vector<int> batch_shape = batch_shapes[i];
+            for (int j = i; j < n; j++) {
+                for (int d = 0; d < batch_shape.size(); d++) {
+                    batch_shape[d] = std::max(batch_shape[d], batch_shapes[j][d]);
+                }
+
+                batches[i][j] = _product(batch_shape, 0, batch_shape.size());
+            }
+        }
+
+        std::vector<std::vector<size_t>> cost;
+        std::vector<std::vector<int>> split;
+        optimalOrder(dims, batches, cost, split);
+
+        report.flops_before_ += current_flops;
+        if (cost[0][n - 1] >= current_flops) {
+            report.flops_after_ += current_flops;
+            continue;
+        }
+
+        _rebuild(graph, head, operands, split, 0, n - 1);
+        for (std::shared_ptr<Node> intermediate : intermediates) {
+            graph->removeNode(intermediate);
+        }
+
+        report.rewritten_++;
+        report.flops_after_ += cost[0][n - 1];
+    }
+
+    return report;
+}
+
+void printReport(const Report& report) {
+    std::cout << strings::debug("Matrix chains:") << std::endl;
+    std::cout << strings::debug("- chains found: ") << strings::info(std::to_string(report.chains_)) << std::endl;
+    std::cout << strings::debug("- chains reordered: ") << strings::info(std::to_string(report.rewritten_))
+              << std::endl;
+    std::cout << strings::debug("- multiply-adds: ") << strings::info(std::to_string(report.flops_before_))
+              << strings::debug(" -> ") << strings::info(std::to_string(report.flops_after_)) << std::endl;
+}
+
+}  // namespace matmul_chain
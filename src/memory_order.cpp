@@ -0,0 +1,195 @@
+#include "memory_order.h"
+
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "checkpoint.h"
+#include "graph.h"
+#include "ops.h"
+#include "string_utils.h"
+
+namespace memory_order {
+
+bool _resident(std::shared_ptr<Node> node) {
+    return node->isParameter() || node->operation_type_ == operations::input;
+}
+
+size_t _bytes(std::shared_ptr<Node> node) {
+    size_t size = 1;
+    for (int dim : node->shape_) {
+        size *= dim;
+    }
+
+    return size * dtypes::dtypeSize(node->dtype_);
+}
+
+// what a candidate order is being built from
+struct _State {
+    std::map<int, int> pending_;                        // id -> children not run yet
+    std::map<int, int> remaining_;                      // id -> consumers not run yet
+    std::map<int, std::vector<std::shared_ptr<Node>>> consumers_;
+    std::set<int> releasable_;
+};
+
+_State _state(std::shared_ptr<Graph> graph) {
+    _State state;
+    state.consumers_ = graph->consumers();
+    state.releasable_ = checkpoint::releasable(*graph);
+
+    for (auto& [id, node] : graph->nodes_) {
+        state.pending_[id] = node->children_.size();
+        state.remaining_[id] = state.consumers_[id].size();
+    }
+
+    return state;
+}
+
+// Kahn's algorithm, `pick` chooses which of the ready nodes runs next
+std::vector<int> _order(std::shared_ptr<Graph> graph,
+                        const std::function<size_t(const std::vector<int>&, _State&)>& pick) {
+    _State state = _state(graph);
+
+    std::vector<int> ready;
+    for (auto& [id, pending] : state.pending_) {
+        if (pending == 0) {
+            ready.push_back(id);
+        }
+    }
+
+    std::vector<int> order;
+    while (!ready.empty()) {
+        size_t index = pick(ready, state);
+        int id = ready[index];
+        ready.erase(ready.begin() + index);
+
+        order.push_back(id);
+        for (auto& [name, child] : graph->nodes_[id]->children_) {
+            state.remaining_[child->getId()]--;
+        }
+
+        for (std::shared_ptr<Node> consumer : state.consumers_[id]) {
+            if (--state.pending_[consumer->getId()] == 0) {
+                ready.push_back(consumer->getId());
+            }
+        }
+    }
+
+    return order;
+}
+
+std::vector<int> fifo(std::shared_ptr<Graph> graph) {
+    std::vector<int> order;
+    graph->topologicalSort([&](std::shared_ptr<Node> node) { order.push_back(node->getId()); });
+
+    return order;
+}
+
+std::vector<int> depthFirst(std::shared_ptr<Graph> graph) {
+    return _order(graph, [](const std::vector<int>& ready, _State& state) { return ready.size() - 1; });
+}
+
+std::vector<int> greedy(std::shared_ptr<Graph> graph) {
+    return _order(graph, [&](const std::vector<int>& ready, _State& state) {
+        size_t best = 0;
+        long best_score = 0;
+        for (size_t i = 0; i < ready.size(); i++) {
+            std::shared_ptr<Node> node = graph->nodes_[ready[i]];
+
+            long score = _resident(node) ? 0 : -(long)_bytes(node);
+            for (auto& [name, child] : node->children_) {
+                if (state.remaining_[child->getId()] == 1 && state.releasable_.count(child->getId())) {
+                    score += _bytes(child);
+                }
+            }
+
+            // ties go to whichever was readied first
+            if (i == 0 || score > best_score) {
+                best = i;
+                best_score = score;
+            }
+        }
+
+        return best;
+    });
+}
+
+size_t peakBytes(std::shared_ptr<Graph> graph, const std::vector<int>& order) {
+    _State state = _state(graph);
+
+    size_t live = 0;
+    size_t peak = 0;
+    for (int id : order) {
+        std::shared_ptr<Node> node = graph->nodes_[id];
+        if (!_resident(node)) {
+            live += _bytes(node);
+            peak = std::max(peak, live);
+        }
+
+        for (auto& [name, child] : node->children_) {
+            if (--state.remaining_[child->getId()] == 0 && state.releasable_.count(child->getId())) {
+                live -= _bytes(child);
+            }
+        }
+    }
+
+    return peak;
+}
+
+Report run(std::shared_ptr<Graph> graph) {
+    Report report;
+
+    report.resident_bytes_ = 0;
+    for (auto& [id, node] : graph->nodes_) {
+        if (_resident(node)) {
+            report.resident_bytes_ += _bytes(node);
+        }
+    }
+
+    std::vector<int> fifo_order = fifo(graph);
+    std::vector<int> depth_first_order = depthFirst(graph);
+    std::vector<int> greedy_order = greedy(graph);
+
+    report.fifo_peak_bytes_ = peakBytes(graph, fifo_order);
+    report.depth_first_peak_bytes_ = peakBytes(graph, depth_first_order);
+    report.greedy_peak_bytes_ = peakBytes(graph, greedy_order);
+
+    report.chosen_ = "fifo";
+    report.chosen_peak_bytes_ = report.fifo_peak_bytes_;
+    std::vector<int> chosen = fifo_order;
+
+    if (report.depth_first_peak_bytes_ < report.chosen_peak_bytes_) {
+        report.chosen_ = "depth first";
+        report.chosen_peak_bytes_ = report.depth_first_peak_bytes_;
+        chosen = depth_first_order;
+    }
+
+    if (report.greedy_peak_bytes_ < report.chosen_peak_bytes_) {
+        report.chosen_ = "greedy";
+        report.chosen_peak_bytes_ = report.greedy_peak_bytes_;
+        chosen = greedy_order;
+    }
+
+    graph->setExecutionOrder(chosen);
+
+    return report;
+}
+
+void printReport(const Report& report) {
+    std::cout << strings::debug("Memory-aware ordering:") << std::endl;
+    std::cout << strings::debug("- resident bytes: ") << strings::info(std::to_string(report.resident_bytes_))
+              << std::endl;
+    std::cout << strings::debug("- fifo peak bytes: ") << strings::info(std::to_string(report.fifo_peak_bytes_))
+              << std::endl;
+    std::cout << strings::debug("- depth first peak bytes: ")
+              << strings::info(std::to_string(report.depth_first_peak_bytes_)) << std::endl;
+    std::cout << strings::debug("- greedy peak bytes: ") << strings::info(std::to_string(report.greedy_peak_bytes_))
+              << std::endl;
+    std::cout << strings::debug("- chosen: ") << strings::info(report.chosen_) << std::endl;
+}
+
+}  // namespace memory_order
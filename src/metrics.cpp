@@ -14,7 +14,7 @@ Mean::Mean() : sum_(0), count_(0) {
 float Mean::update(std::shared_ptr<Buffer> buffer) {
     float local_sum = 0;
     for (size_t i = 0; i < buffer->size(); i++) {
-        local_sum += buffer->getIndex<float>(i);
+        local_sum += buffer->getValue<float>(i);
     }
 
     sum_ += local_sum / buffer->size();
@@ -49,7 +49,7 @@ float MeanAbsoluteError::update(std::shared_ptr<Buffer> pred, std::shared_ptr<Bu
 
     float local_sum = 0;
     for (size_t i = 0; i < pred->size(); i++) {
-        local_sum += std::abs(pred->getIndex<float>(i) - truth->getIndex<float>(i));
+        local_sum += std::abs(pred->getValue<float>(i) - truth->getValue<float>(i));
     }
 
     local_sum /= pred->size();
@@ -0,0 +1,149 @@
+#include "mixed_precision.h"
+
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "buffer_ops.h"
+#include "graph.h"
+#include "packing.h"
+#include "string_utils.h"
+
+namespace mixed_precision {
+
+Trainer::Trainer(std::shared_ptr<Graph> graph, float initial_scale, int growth_interval)
+    : graph_(graph),
+      scale_(initial_scale),
+      growth_interval_(growth_interval),
+      good_steps_(0),
+      steps_(0),
+      skipped_(0),
+      batch_size_(1) {
+    if (initial_scale <= 0 || growth_interval < 1) {
+        std::cerr << strings::error("mixed_precision::Trainer error: ")
+                  << "the loss scale and growth interval must be positive, got "
+                  << strings::info(std::to_string(initial_scale)) << " and "
+                  << strings::info(std::to_string(growth_interval)) << std::endl;
+        exit(-1);
+    }
+
+    for (std::shared_ptr<Node> input : graph_->getInputs()) {
+        if (!input->shape_.empty()) {
+            batch_size_ = input->shape_[0];
+        }
+    }
+
+    for (auto& [id, node] : graph_->nodes_) {
+        if (!node->trainable_ || node->output_ == nullptr) {
+            continue;
+        }
+
+        std::shared_ptr<GraphBuffer> master(new GraphBuffer(node->output_->shape(), DTYPE::float32));
+        buffer_ops::copy(node->output_, master);
+
+        masters_[id] = master;
+    }
+}
+
+bool Trainer::_finite() {
+    for (auto& [id, master] : masters_) {
+        std::shared_ptr<GraphBuffer> gradient = graph_->nodes_[id]->gradient_;
+
+        bool finite = dtypes::dispatch(gradient->dtype(), [&]<typename T>() {
+            const T* data = (const T*)gradient->getData();
+            for (size_t i = 0; i < gradient->size(); i++) {
+                if (!std::isfinite((dtypes::Accumulate<T>)data[i])) {
+                    return false;
+                }
+            }
+
+            return true;
+        });
+
+        if (!finite) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+float Trainer::step(const std::unordered_map<std::string, std::vector<float>>& batch, float learning_rate) {
+    graph_->reset();
+    graph_->evaluate(batch);
+
+    float loss = graph_->getLoss();
+
+    // seeding the backward pass with the scale scales every gradient by it
+    buffer_ops::set(graph_->getLossNode()->gradient_, scale_);
+    graph_->calculateGradient();
+
+    steps_++;
+
+    if (!_finite()) {
+        scale_ /= 2;
+        good_steps_ = 0;
+        skipped_++;
+
+        return loss;
+    }
+
+    for (auto& [id, master] : masters_) {
+        std::shared_ptr<Node> node = graph_->nodes_[id];
+
+        std::shared_ptr<GraphBuffer> update(new GraphBuffer(master->shape(), DTYPE::float32));
+        buffer_ops::copy(node->gradient_, update);
+        buffer_ops::multiply(update, learning_rate / (batch_size_ * scale_), update);
+
+        buffer_ops::subtract(master, update, master);
+        buffer_ops::copy(master, node->output_);
+        packing::invalidate(node);
+    }
+
+    good_steps_++;
+    if (good_steps_ == growth_interval_) {
+        scale_ *= 2;
+        good_steps_ = 0;
+    }
+
+    return loss;
+}
+
+float Trainer::scale() {
+    return scale_;
+}
+
+Report Trainer::report() {
+    Report report;
+    report.steps_ = steps_;
+    report.skipped_ = skipped_;
+    report.scale_ = scale_;
+    report.parameter_bytes_ = 0;
+    report.master_bytes_ = 0;
+
+    for (auto& [id, master] : masters_) {
+        std::shared_ptr<GraphBuffer> output = graph_->nodes_[id]->output_;
+
+        report.parameter_bytes_ += output->size() * dtypes::dtypeSize(output->dtype());
+        report.master_bytes_ += master->size() * dtypes::dtypeSize(master->dtype());
+    }
+
+    return report;
+}
+
+void printReport(const Report& report) {
+    std::cout << strings::debug("Mixed precision:") << std::endl;
+    std::cout << strings::debug("- steps: ") << strings::info(std::to_string(report.steps_)) << std::endl;
+    std::cout << strings::debug("- skipped steps: ") << strings::info(std::to_string(report.skipped_)) << std::endl;
+    std::cout << strings::debug("- loss scale: ") << strings::info(std::to_string(report.scale_)) << std::endl;
+    std::cout << strings::debug("- parameter bytes: ") << strings::info(std::to_string(report.parameter_bytes_))
+              << std::endl;
+    std::cout << strings::debug("- master weight bytes: ") << strings::info(std::to_string(report.master_bytes_))
+              << std::endl;
+}
+
+}  // namespace mixed_precision
@@ -172,6 +172,12 @@ std::shared_ptr<Graph> NNParser::parse(const std::string& contents) {
             // definition
             registerVariableDefinition(graph, variable_name, contents, false, false, false);
             buffer_ = "";
+        } else if (buffer_ == checkpoint_declarator_) {
+            incrementAndAdd(contents);  // check if this is an isolated keyword or part of a variable name
+            if (buffer_.back() == ' ') {
+                registerCheckpoint(graph, contents);
+                buffer_ = "";
+            }
         } else if (buffer_ == function_declarator_) {
             // functions have 3 rules (for now):
             //   1. The only variables in the scope are those input as arguments
@@ -295,9 +301,12 @@ bool NNParser::isNumeric(const std::string& s) {
 std::string NNParser::strip(const std::string& s) {
     std::string stripped = "";
 
-    for (char c : s) {
-        if (isAlphanumeric(c)) {
-            stripped += c;
+    for (int i = 0; i < s.size(); i++) {
+        // a leading minus sign is kept for negative numbers, e.g. the axis in reduce_max(x, -1)
+        bool negative = s[i] == '-' && stripped.empty() && i + 1 < s.size() && std::isdigit(s[i + 1]);
+
+        if (isAlphanumeric(s[i]) || negative) {
+            stripped += s[i];
         }
     }
 
@@ -558,4 +567,29 @@ std::string NNParser::registerFunctionDefinition(std::string function_name, cons
     return "";
 }
 
+void NNParser::registerCheckpoint(std::shared_ptr<Graph> graph, const std::string& contents) {
+    // cursor_ is at the whitespace after the `t` of checkpoint when this function starts
+    while (inBounds() && at(contents) == ' ') {
+        incrementCursor();
+    }
+
+    std::string variable_name = "";
+    while (inBoundsNoError() && isAlphanumeric(at(contents))) {
+        variable_name += at(contents);
+        buffer_ += at(contents);
+        incrementCursor();
+    }
+
+    if (!graph->isVariable(variable_name)) {
+        std::cerr << strings::error("NNParser::registerCheckpoint error:") << " can't checkpoint "
+                  << strings::info("`" + variable_name + "`") << ", it isn't a declared variable" << std::endl;
+
+        showCursor(contents);
+        exit(-1);
+    }
+
+    // reassigned variables checkpoint whichever value they hold at this point
+    graph->markCheckpoint(variable_name);
+}
+
 }  // namespace nn_parser
@@ -0,0 +1,412 @@
+#include "normalization.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "buffer_ops.h"
+#include "dtypes.h"
+#include "ops.h"
+#include "parallel.h"
+#include "simd.h"
+#include "string_utils.h"
+
+namespace normalization {
+
+// added to the variance so a constant row doesn't divide by 0
+static const double EPSILON = 1e-5;
+
+// rows sharing one partial sum of the gamma and beta gradients, the partials are added up once at the end
+static const size_t ROW_BLOCK = 64;
+
+// a running count, mean and sum of squared deviations
+template <typename A>
+struct _Welford {
+    A count_ = 0;
+    A mean_ = 0;
+    A m2_ = 0;
+
+    void update(A x) {
+        count_ += 1;
+        A delta = x - mean_;
+        mean_ += delta / count_;
+        m2_ += delta * (x - mean_);
+    }
+
+    // Chan et al.'s combination of two sets of statistics
+    void merge(A count, A mean, A m2) {
+        if (count == 0) {
+            return;
+        }
+
+        A total = count_ + count;
+        A delta = mean - mean_;
+        mean_ += delta * count / total;
+        m2_ += m2 + delta * delta * count_ * count / total;
+        count_ = total;
+    }
+};
+
+// mean and rstd of the `n` elements of `x`, the mean being 0 for rms
+template <Norm norm, typename T, typename A = dtypes::Accumulate<T>>
+std::pair<A, A> _statistics(const T* x, size_t n) {
+    if constexpr (norm == Norm::rms) {
+        A squares = 0;
+        size_t i = 0;
+        if constexpr (std::is_same_v<T, float>) {
+            simd::vec acc = simd::zero();
+            for (; i + simd::WIDTH <= n; i += simd::WIDTH) {
+                simd::vec v = simd::load(x + i);
+                acc = simd::fmadd(v, v, acc);
+            }
+
+            squares = simd::sum(acc);
+        }
+
+        for (; i < n; i++) {
+            squares += (A)x[i] * (A)x[i];
+        }
+
+        return {0, 1 / std::sqrt(squares / n + (A)EPSILON)};
+    } else {
+        _Welford<A> welford;
+
+        size_t i = 0;
+        if constexpr (std::is_same_v<T, float>) {
+            // every lane sees the same count, so one reciprocal serves them all
+            simd::vec mean = simd::zero();
+            simd::vec m2 = simd::zero();
+
+            size_t count = 0;
+            for (; i + simd::WIDTH <= n; i += simd::WIDTH) {
+                count++;
+
+                simd::vec v = simd::load(x + i);
+                simd::vec delta = simd::sub(v, mean);
+                mean = simd::fmadd(delta, simd::broadcast(1.f / count), mean);
+                m2 = simd::fmadd(delta, simd::sub(v, mean), m2);
+            }
+
+            float means[simd::WIDTH];
+            float m2s[simd::WIDTH];
+            simd::store(means, mean);
+            simd::store(m2s, m2);
+
+            for (int w = 0; w < simd::WIDTH; w++) {
+                welford.merge(count, means[w], m2s[w]);
+            }
+        }
+
+        for (; i < n; i++) {
+            welford.update((A)x[i]);
+        }
+
+        return {welford.mean_, 1 / std::sqrt(welford.m2_ / n + (A)EPSILON)};
+    }
+}
+
+// (x - mean) * rstd * gamma + beta for each of the `n` elements of `x` into `out`, no shift for rms
+template <Norm norm, typename T, typename A>
+void _write(const T* x, const T* gamma, const T* beta, T* out, size_t n, A mean, A rstd) {
+    size_t i = 0;
+    if constexpr (std::is_same_v<T, float>) {
+        simd::vec m = simd::broadcast(mean);
+        simd::vec r = simd::broadcast(rstd);
+
+        for (; i + simd::WIDTH <= n; i += simd::WIDTH) {
+            simd::vec normalized = simd::mul(simd::sub(simd::load(x + i), m), r);
+            if constexpr (norm == Norm::layer) {
+                simd::store(out + i, simd::fmadd(normalized, simd::load(gamma + i), simd::load(beta + i)));
+            } else {
+                simd::store(out + i, simd::mul(normalized, simd::load(gamma + i)));
+            }
+        }
+    }
+
+    for (; i < n; i++) {
+        A y = ((A)x[i] - mean) * rstd * (A)gamma[i];
+        if constexpr (norm == Norm::layer) {
+            y += (A)beta[i];
+        }
+
+        out[i] = (T)y;
+    }
+}
+
+// one row of the backward pass, with n elements
+// the normalized row is xhat = (x - mean) * rstd and gamma scales it, so with dxhat = g * gamma
+//      dx = rstd * (dxhat - mean(dxhat) - xhat * mean(dxhat * xhat))
+// without the mean(dxhat) term for rms, while g * xhat and g are added to the gamma and beta partials
+template <Norm norm, typename T, typename A>
+void _backward_row(const T* x, const T* gamma, const T* g, T* dx, A* dgamma, A* dbeta, size_t n, A mean, A rstd) {
+    A sum = 0;
+    A dot = 0;
+
+    size_t i = 0;
+    if constexpr (std::is_same_v<T, float>) {
+        simd::vec m = simd::broadcast(mean);
+        simd::vec r = simd::broadcast(rstd);
+        simd::vec sums = simd::zero();
+        simd::vec dots = simd::zero();
+
+        for (; i + simd::WIDTH <= n; i += simd::WIDTH) {
+            simd::vec xhat = simd::mul(simd::sub(simd::load(x + i), m), r);
+            simd::vec upstream = simd::load(g + i);
+            simd::vec dxhat = simd::mul(upstream, simd::load(gamma + i));
+
+            sums = simd::add(sums, dxhat);
+            dots = simd::fmadd(dxhat, xhat, dots);
+
+            simd::store(dgamma + i, simd::fmadd(upstream, xhat, simd::load(dgamma + i)));
+            if constexpr (norm == Norm::layer) {
+                simd::store(dbeta + i, simd::add(simd::load(dbeta + i), upstream));
+            }
+        }
+
+        sum = simd::sum(sums);
+        dot = simd::sum(dots);
+    }
+
+    for (; i < n; i++) {
+        A xhat = ((A)x[i] - mean) * rstd;
+        A dxhat = (A)g[i] * (A)gamma[i];
+
+        sum += dxhat;
+        dot += dxhat * xhat;
+
+        dgamma[i] += (A)g[i] * xhat;
+        if constexpr (norm == Norm::layer) {
+            dbeta[i] += (A)g[i];
+        }
+    }
+
+    A shift = norm == Norm::layer ? sum / n : 0;
+    A scale = dot / n;
+
+    i = 0;
+    if constexpr (std::is_same_v<T, float>) {
+        simd::vec m = simd::broadcast(mean);
+        simd::vec r = simd::broadcast(rstd);
+        simd::vec s = simd::broadcast(shift);
+        simd::vec c = simd::broadcast(scale);
+
+        for (; i + simd::WIDTH <= n; i += simd::WIDTH) {
+            simd::vec xhat = simd::mul(simd::sub(simd::load(x + i), m), r);
+            simd::vec dxhat = simd::mul(simd::load(g + i), simd::load(gamma + i));
+
+            simd::store(dx + i, simd::mul(r, simd::sub(simd::sub(dxhat, s), simd::mul(xhat, c))));
+        }
+    }
+
+    for (; i < n; i++) {
+        A xhat = ((A)x[i] - mean) * rstd;
+        A dxhat = (A)g[i] * (A)gamma[i];
+
+        dx[i] = (T)(rstd * (dxhat - shift - xhat * scale));
+    }
+}
+
+size_t _columns(std::shared_ptr<Buffer> x) {
+    return x->shape().empty() ? 1 : x->shape().back();
+}
+
+DTYPE _stats_dtype(DTYPE dtype) {
+    return dtypes::isHalf(dtype) ? DTYPE::float32 : dtype;
+}
+
+void _assert_matching(const std::string& fn, const std::string& name, std::shared_ptr<Buffer> x,
+                      std::shared_ptr<Buffer> b, size_t size, DTYPE dtype) {
+    if (b->size() != size || b->dtype() != dtype) {
+        std::cerr << strings::error("normalization::" + fn + " error: ") << name << " of shape "
+                  << strings::info(strings::vecToString(b->shape())) << " doesn't go with input of shape "
+                  << strings::info(strings::vecToString(x->shape())) << ", expected "
+                  << strings::info(std::to_string(size)) << " elements" << std::endl;
+        exit(-1);
+    }
+}
+
+void normalize(Norm norm, std::shared_ptr<Buffer> x, std::shared_ptr<Buffer> gamma, std::shared_ptr<Buffer> beta,
+               std::shared_ptr<Buffer> out, std::shared_ptr<Buffer> stats) {
+    size_t columns = _columns(x);
+    size_t rows = x->size() / columns;
+
+    _assert_matching("normalize", "gamma", x, gamma, columns, x->dtype());
+    if (norm == Norm::layer) {
+        _assert_matching("normalize", "beta", x, beta, columns, x->dtype());
+    }
+    _assert_matching("normalize", "output", x, out, x->size(), x->dtype());
+    _assert_matching("normalize", "stats", x, stats, rows * 2, _stats_dtype(x->dtype()));
+
+    dtypes::dispatch(x->dtype(), [&]<typename T>() {
+        using A = dtypes::Accumulate<T>;
+        const T* data = (const T*)x->getData();
+        const T* g = (const T*)gamma->getData();
+        const T* b = norm == Norm::layer ? (const T*)beta->getData() : nullptr;
+        T* result = (T*)out->getData();
+        A* saved = (A*)stats->getData();
+
+        size_t grain = std::max((size_t)1, parallel::GRAIN / columns);
+        parallel::parallelFor(0, rows, grain, [&](size_t first, size_t last) {
+            for (size_t r = first; r < last; r++) {
+                const T* row = data + r * columns;
+
+                if (norm == Norm::layer) {
+                    auto [mean, rstd] = _statistics<Norm::layer>(row, columns);
+                    _write<Norm::layer>(row, g, b, result + r * columns, columns, mean, rstd);
+                    saved[2 * r] = mean;
+                    saved[2 * r + 1] = rstd;
+                } else {
+                    auto [mean, rstd] = _statistics<Norm::rms>(row, columns);
+                    _write<Norm::rms>(row, g, b, result + r * columns, columns, mean, rstd);
+                    saved[2 * r] = mean;
+                    saved[2 * r + 1] = rstd;
+                }
+            }
+        });
+    });
+}
+
+void normalizeGradient(Norm norm, std::shared_ptr<Buffer> x, std::shared_ptr<Buffer> gamma,
+                       std::shared_ptr<Buffer> stats, std::shared_ptr<Buffer> upstream,
+                       std::shared_ptr<Buffer> x_gradient, std::shared_ptr<Buffer> gamma_gradient,
+                       std::shared_ptr<Buffer> beta_gradient) {
+    size_t columns = _columns(x);
+    size_t rows = x->size() / columns;
+
+    _assert_matching("normalizeGradient", "gamma", x, gamma, columns, x->dtype());
+    _assert_matching("normalizeGradient", "stats", x, stats, rows * 2, _stats_dtype(x->dtype()));
+    _assert_matching("normalizeGradient", "upstream gradient", x, upstream, x->size(), x->dtype());
+    _assert_matching("normalizeGradient", "input gradient", x, x_gradient, x->size(), x->dtype());
+    _assert_matching("normalizeGradient", "gamma gradient", x, gamma_gradient, columns, x->dtype());
+    if (norm == Norm::layer) {
+        _assert_matching("normalizeGradient", "beta gradient", x, beta_gradient, columns, x->dtype());
+    }
+
+    dtypes::dispatch(x->dtype(), [&]<typename T>() {
+        using A = dtypes::Accumulate<T>;
+        const T* data = (const T*)x->getData();
+        const T* g = (const T*)gamma->getData();
+        const T* up = (const T*)upstream->getData();
+        const A* saved = (const A*)stats->getData();
+        T* dx = (T*)x_gradient->getData();
+
+        // every block of rows sums its own gamma and beta gradients, so no two threads write the same partial
+        size_t blocks = (rows + ROW_BLOCK - 1) / ROW_BLOCK;
+        std::vector<A> dgamma(blocks * columns, 0);
+        std::vector<A> dbeta(norm == Norm::layer ? blocks * columns : 0, 0);
+
+        size_t grain = std::max((size_t)1, parallel::GRAIN / (ROW_BLOCK * columns));
+        parallel::parallelFor(0, blocks, grain, [&](size_t first, size_t last) {
+            for (size_t block = first; block < last; block++) {
+                A* dg = dgamma.data() + block * columns;
+                A* db = norm == Norm::layer ? dbeta.data() + block * columns : nullptr;
+
+                for (size_t r = block * ROW_BLOCK; r < std::min(rows, (block + 1) * ROW_BLOCK); r++) {
+                    size_t offset = r * columns;
+                    if (norm == Norm::layer) {
+                        _backward_row<Norm::layer>(data + offset, g, up + offset, dx + offset, dg, db, columns,
+                                                   saved[2 * r], saved[2 * r + 1]);
+                    } else {
+                        _backward_row<Norm::rms>(data + offset, g, up + offset, dx + offset, dg, db, columns,
+                                                 saved[2 * r], saved[2 * r + 1]);
+                    }
+                }
+            }
+        });
+
+        auto total = [&](const std::vector<A>& partials, std::shared_ptr<Buffer> gradient) {
+            T* out = (T*)gradient->getData();
+            for (size_t j = 0; j < columns; j++) {
+                A sum = 0;
+                for (size_t block = 0; block < blocks; block++) {
+                    sum += partials[block * columns + j];
+                }
+
+                out[j] = (T)sum;
+            }
+        };
+
+        total(dgamma, gamma_gradient);
+        if (norm == Norm::layer) {
+            total(dbeta, beta_gradient);
+        }
+    });
+}
+
+Norm _norm(std::shared_ptr<Node> node) {
+    return node->operation_type_ == operations::rms_norm ? Norm::rms : Norm::layer;
+}
+
+std::shared_ptr<Node> _child(std::shared_ptr<Node> node, int i) {
+    return node->children_[node->arg_order_[i]];
+}
+
+void allocate(std::shared_ptr<Node> node) {
+    std::shared_ptr<Node> x = _child(node, 0);
+    size_t columns = x->shape_.empty() ? 1 : x->shape_.back();
+
+    size_t elements = 1;
+    for (int dim : x->shape_) {
+        elements *= dim;
+    }
+
+    for (int i = 1; i < node->arg_order_.size(); i++) {
+        std::shared_ptr<Node> parameter = _child(node, i);
+
+        size_t size = 1;
+        for (int dim : parameter->shape_) {
+            size *= dim;
+        }
+
+        if (size != columns) {
+            std::cerr << strings::error("normalization::allocate error: ") << "expected "
+                      << strings::info(std::to_string(columns)) << " values for "
+                      << strings::info(strings::vecToString(x->shape_)) << ", got "
+                      << strings::info(strings::vecToString(parameter->shape_)) << std::endl;
+            exit(-1);
+        }
+    }
+
+    node->shape_ = x->shape_;
+    node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
+    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
+    buffer_ops::set(node->gradient_, 1.0);
+
+    // each row's mean and rstd for the backward pass
+    int rows = elements / columns;
+    node->saved_ = std::shared_ptr<GraphBuffer>(new GraphBuffer({rows, 2}, _stats_dtype(node->dtype_)));
+}
+
+void forward(std::shared_ptr<Node> node) {
+    Norm norm = _norm(node);
+    normalize(norm, _child(node, 0)->output_, _child(node, 1)->output_,
+              norm == Norm::layer ? _child(node, 2)->output_ : nullptr, node->output_, node->saved_);
+}
+
+void backward(std::shared_ptr<Node> node) {
+    Norm norm = _norm(node);
+    std::shared_ptr<Node> x = _child(node, 0);
+    std::shared_ptr<Node> gamma = _child(node, 1);
+    std::shared_ptr<Node> beta = norm == Norm::layer ? _child(node, 2) : nullptr;
+
+    std::shared_ptr<GraphBuffer> x_gradient(new GraphBuffer(x->shape_, node->dtype_));
+    std::shared_ptr<GraphBuffer> gamma_gradient(new GraphBuffer(gamma->shape_, node->dtype_));
+    std::shared_ptr<GraphBuffer> beta_gradient =
+        beta == nullptr ? nullptr : std::shared_ptr<GraphBuffer>(new GraphBuffer(beta->shape_, node->dtype_));
+
+    normalizeGradient(norm, x->output_, gamma->output_, node->saved_, node->gradient_, x_gradient, gamma_gradient,
+                      beta_gradient);
+
+    for (auto [child, gradient] : {std::make_pair(x, x_gradient), std::make_pair(gamma, gamma_gradient),
+                                   std::make_pair(beta, beta_gradient)}) {
+        if (child != nullptr && child->operation_type_ != operations::constant) {
+            buffer_ops::multiply(gradient, child->gradient_, child->gradient_);
+        }
+    }
+}
+
+}  // namespace normalization
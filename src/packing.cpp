@@ -0,0 +1,60 @@
+#include "packing.h"
+
+#include <memory>
+#include <mutex>
+
+#include "gemm.h"
+#include "graph.h"
+
+namespace packing {
+
+bool packable(std::shared_ptr<Node> node) {
+    return node->isParameter() && node->output_ != nullptr && node->dtype_ == DTYPE::float32 &&
+           node->shape_.size() == 2;
+}
+
+std::shared_ptr<gemm::PackedB> get(std::shared_ptr<Node> node, bool transposed) {
+    Cache& cache = *node->packed_;
+
+    // held while packing so a node used by several products at once is only packed once
+    // packing never goes through the pool, so this thread can't pick up another product needing the lock meanwhile
+    std::lock_guard<std::mutex> lock(cache.mutex_);
+
+    // read without counting as a write, or the packs would never be reused
+    const float* data = (const float*)node->output_->readData();
+    size_t version = node->output_->version();
+    if (cache.source_ != data || cache.version_ != version) {
+        cache.source_ = data;
+        cache.version_ = version;
+        cache.b_ = nullptr;
+        cache.transposed_ = nullptr;
+    }
+
+    int rows = node->shape_[0];
+    int columns = node->shape_[1];
+
+    if (transposed) {
+        if (cache.transposed_ == nullptr) {
+            cache.transposed_ = gemm::pack(columns, rows, data, 1, columns);
+        }
+
+        return cache.transposed_;
+    }
+
+    if (cache.b_ == nullptr) {
+        cache.b_ = gemm::pack(rows, columns, data, columns, 1);
+    }
+
+    return cache.b_;
+}
+
+void invalidate(std::shared_ptr<Node> node) {
+    Cache& cache = *node->packed_;
+    std::lock_guard<std::mutex> lock(cache.mutex_);
+
+    cache.source_ = nullptr;
+    cache.b_ = nullptr;
+    cache.transposed_ = nullptr;
+}
+
+}  // namespace packing
@@ -0,0 +1,229 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace parallel {
+
+// chunks handed out per thread, a few so stragglers can be balanced out by stealing
+static const size_t CHUNKS_PER_THREAD = 4;
+
+// which pool and queue the current thread works for, if any
+static thread_local ThreadPool* _worker_pool = nullptr;
+static thread_local int _worker_index = -1;
+
+ThreadPool::ThreadPool(int threads) : threads_(std::max(1, threads)), next_queue_(0), queued_(0), stop_(false) {
+    int workers = threads_ - 1;
+    for (int i = 0; i < std::max(1, workers); i++) {
+        queues_.push_back(std::unique_ptr<_Queue>(new _Queue()));
+    }
+
+    for (int i = 0; i < workers; i++) {
+        workers_.push_back(std::thread(&ThreadPool::_work, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex_);
+        stop_ = true;
+    }
+
+    wake_.notify_all();
+    for (std::thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+int ThreadPool::size() {
+    return threads_;
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    size_t index = _worker_pool == this ? _worker_index : next_queue_++ % queues_.size();
+
+    {
+        std::lock_guard<std::mutex> lock(queues_[index]->mutex_);
+        queues_[index]->tasks_.push_back(std::move(task));
+    }
+
+    queued_++;
+
+    // taking the lock orders this with a worker's check of `queued_` before it sleeps
+    { std::lock_guard<std::mutex> lock(sleep_mutex_); }
+    wake_.notify_one();
+}
+
+bool ThreadPool::runPending() {
+    std::function<void()> task;
+    if (!_pop(_worker_pool == this ? _worker_index : -1, task)) {
+        return false;
+    }
+
+    task();
+    return true;
+}
+
+// own queue from the back first, then steal from the front of the others
+bool ThreadPool::_pop(int index, std::function<void()>& task) {
+    if (queued_.load() == 0) {
+        return false;
+    }
+
+    if (index >= 0) {
+        _Queue& queue = *queues_[index];
+        std::lock_guard<std::mutex> lock(queue.mutex_);
+        if (!queue.tasks_.empty()) {
+            task = std::move(queue.tasks_.back());
+            queue.tasks_.pop_back();
+            queued_--;
+
+            return true;
+        }
+    }
+
+    int n = queues_.size();
+    for (int i = 1; i <= n; i++) {
+        int victim = (std::max(index, 0) + i) % n;
+        if (victim == index) {
+            continue;
+        }
+
+        _Queue& queue = *queues_[victim];
+        std::lock_guard<std::mutex> lock(queue.mutex_);
+        if (!queue.tasks_.empty()) {
+            task = std::move(queue.tasks_.front());
+            queue.tasks_.pop_front();
+            queued_--;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::_work(int index) {
+    _worker_pool = this;
+    _worker_index = index;
+
+    std::function<void()> task;
+    while (true) {
+        if (_pop(index, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex_);
+        wake_.wait(lock, [&] { return stop_ || queued_.load() > 0; });
+
+        if (stop_ && queued_.load() == 0) {
+            return;
+        }
+    }
+}
+
+static thread_local int _serial_depth = 0;
+
+SerialScope::SerialScope() {
+    _serial_depth++;
+}
+
+SerialScope::~SerialScope() {
+    _serial_depth--;
+}
+
+bool serial() {
+    return _serial_depth > 0;
+}
+
+static std::mutex _pool_mutex;
+static std::unique_ptr<ThreadPool> _pool;
+static int _threads = 0;
+
+int _default_thread_count() {
+    const char* env = std::getenv("HIVE_THREADS");
+    if (env != nullptr && std::atoi(env) > 0) {
+        return std::atoi(env);
+    }
+
+    return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+void setThreadCount(int threads) {
+    std::lock_guard<std::mutex> lock(_pool_mutex);
+    _threads = std::max(1, threads);
+    _pool.reset();
+}
+
+int threadCount() {
+    std::lock_guard<std::mutex> lock(_pool_mutex);
+    if (_threads == 0) {
+        _threads = _default_thread_count();
+    }
+
+    return _threads;
+}
+
+ThreadPool& pool() {
+    std::lock_guard<std::mutex> lock(_pool_mutex);
+    if (_threads == 0) {
+        _threads = _default_thread_count();
+    }
+
+    if (_pool == nullptr) {
+        _pool.reset(new ThreadPool(_threads));
+    }
+
+    return *_pool;
+}
+
+size_t chunkSize(size_t size, size_t grain) {
+    int threads = threadCount();
+    size_t max_chunks = threads == 1 ? 1 : threads * CHUNKS_PER_THREAD;
+    size_t chunks = std::max((size_t)1, std::min(size / std::max(grain, (size_t)1), max_chunks));
+
+    return (size + chunks - 1) / chunks;
+}
+
+void parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body) {
+    if (end <= begin) {
+        return;
+    }
+
+    size_t size = end - begin;
+    size_t chunk = chunkSize(size, grain);
+    size_t chunks = (size + chunk - 1) / chunk;
+
+    if (chunks <= 1 || serial()) {
+        body(begin, end);
+        return;
+    }
+
+    ThreadPool& threads = pool();
+
+    std::atomic<size_t> remaining(chunks - 1);
+    for (size_t c = 1; c < chunks; c++) {
+        threads.submit([&, c] {
+            body(begin + c * chunk, std::min(end, begin + (c + 1) * chunk));
+            remaining--;
+        });
+    }
+
+    body(begin, std::min(end, begin + chunk));
+
+    // help out instead of blocking, whatever's queued may well be our own chunks
+    while (remaining.load() > 0) {
+        if (!threads.runPending()) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+}  // namespace parallel
@@ -0,0 +1,235 @@
+#include "quantize.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "allocation.h"
+#include "gemm.h"
+#include "graph.h"
+#include "ops.h"
+#include "parallel.h"
+#include "string_utils.h"
+
+namespace quantize {
+
+// elements per task when quantizing the input
+static const size_t GRAIN = 1 << 14;
+
+bool _is_dense(std::shared_ptr<Node> node) {
+    return node->operation_type_ == operations::dense || node->operation_type_ == operations::dense_relu ||
+           node->operation_type_ == operations::dense_sigmoid;
+}
+
+gemm::Activation _activation(std::shared_ptr<Node> node) {
+    if (node->operation_type_ == operations::dense_relu) {
+        return gemm::Activation::relu;
+    } else if (node->operation_type_ == operations::dense_sigmoid) {
+        return gemm::Activation::sigmoid;
+    }
+
+    return gemm::Activation::none;
+}
+
+// matmul and dense nodes multiplying a computed x by an allocated [k x n] parameter w, all float32
+std::vector<std::shared_ptr<Node>> _layers(std::shared_ptr<Graph> graph) {
+    std::vector<std::shared_ptr<Node>> layers;
+    for (auto& [id, node] : graph->nodes_) {
+        bool matmul = node->operation_type_ == operations::matmul && node->arg_order_.size() == 2;
+        bool dense = _is_dense(node) && node->arg_order_.size() == 3;
+        if ((!matmul && !dense) || node->dtype_ != DTYPE::float32) {
+            continue;
+        }
+
+        std::shared_ptr<Node> x = node->children_[node->arg_order_[0]];
+        std::shared_ptr<Node> w = node->children_[node->arg_order_[1]];
+        if (x->isParameter() || !w->isParameter() || w->output_ == nullptr || w->shape_.size() != 2 ||
+            w->dtype_ != DTYPE::float32) {
+            continue;
+        }
+
+        layers.push_back(node);
+    }
+
+    return layers;
+}
+
+Calibration calibrate(std::shared_ptr<Graph> graph,
+                      std::function<std::unordered_map<std::string, std::vector<float>>()> sample, int batches) {
+    Calibration calibration;
+    calibration.batches_ = batches;
+
+    // input node id -> the layers it feeds
+    std::map<int, std::vector<int>> layers;
+
+    // zero is always in range so it quantizes exactly, e.g. the zeros relu leaves behind
+    for (std::shared_ptr<Node> layer : _layers(graph)) {
+        layers[layer->children_[layer->arg_order_[0]]->getId()].push_back(layer->getId());
+        calibration.ranges_[layer->getId()] = {0, 0};
+    }
+
+    // ranges are taken as each input is computed, a checkpointing forward pass may free it before the pass is over
+    // the map is filled in up front, so each input only ever touches the entries of its own layers
+    std::function<void(std::shared_ptr<Node>)> record = [&](std::shared_ptr<Node> node) {
+        auto it = layers.find(node->getId());
+        if (it == layers.end()) {
+            return;
+        }
+
+        float min = 0;
+        float max = 0;
+        const float* data = (const float*)node->output_->getData();
+        for (size_t i = 0; i < node->output_->size(); i++) {
+            min = std::min(min, data[i]);
+            max = std::max(max, data[i]);
+        }
+
+        for (int layer : it->second) {
+            Range& range = calibration.ranges_[layer];
+            range.min_ = std::min(range.min_, min);
+            range.max_ = std::max(range.max_, max);
+        }
+    };
+
+    for (int batch = 0; batch < batches; batch++) {
+        graph->evaluateAsync(sample(), record).get();
+    }
+
+    return calibration;
+}
+
+std::shared_ptr<Weights> quantizeWeights(const float* w, int k, int n) {
+    std::shared_ptr<Weights> weights(new Weights());
+    weights->k_ = k;
+    weights->n_ = n;
+    weights->data_.resize((size_t)n * k);
+    weights->scales_.resize(n);
+    weights->sums_.resize(n);
+    weights->input_scale_ = 1;
+    weights->input_zero_point_ = 0;
+    weights->activation_ = gemm::Activation::none;
+
+    for (int j = 0; j < n; j++) {
+        float max_abs = 0;
+        for (int p = 0; p < k; p++) {
+            max_abs = std::max(max_abs, std::abs(w[(size_t)p * n + j]));
+        }
+
+        // symmetric, -128 is left out so the range is the same both ways
+        float scale = max_abs > 0 ? max_abs / 127 : 1;
+
+        int32_t sum = 0;
+        for (int p = 0; p < k; p++) {
+            int q = std::clamp((int)std::round(w[(size_t)p * n + j] / scale), -127, 127);
+            weights->data_[(size_t)j * k + p] = q;
+            sum += q;
+        }
+
+        weights->scales_[j] = scale;
+        weights->sums_[j] = sum;
+    }
+
+    return weights;
+}
+
+size_t bytes(const Weights& weights) {
+    return weights.data_.size() * sizeof(int8_t) + weights.scales_.size() * sizeof(float) +
+           weights.sums_.size() * sizeof(int32_t);
+}
+
+Report run(std::shared_ptr<Graph> graph, const Calibration& calibration) {
+    Report report = {0, 0, 0, 0};
+
+    for (std::shared_ptr<Node> layer : _layers(graph)) {
+        std::shared_ptr<Node> x = layer->children_[layer->arg_order_[0]];
+        std::shared_ptr<Node> w = layer->children_[layer->arg_order_[1]];
+
+        auto it = calibration.ranges_.find(layer->getId());
+        if (it == calibration.ranges_.end()) {
+            report.uncalibrated_++;
+            continue;
+        }
+
+        std::shared_ptr<Weights> weights =
+            quantizeWeights((const float*)w->output_->getData(), w->shape_[0], w->shape_[1]);
+
+        // asymmetric, the range is spread over all of [0, 255]
+        const Range& range = it->second;
+        float scale = (range.max_ - range.min_) / 255;
+        weights->input_scale_ = scale > 0 ? scale : 1;
+        weights->input_zero_point_ = std::clamp((int)std::round(-range.min_ / weights->input_scale_), 0, 255);
+        weights->activation_ = _activation(layer);
+
+        std::vector<std::shared_ptr<Node>> arguments = {x};
+        if (_is_dense(layer)) {
+            arguments.push_back(layer->children_[layer->arg_order_[2]]);
+        }
+
+        std::shared_ptr<Node> quantized = graph->createNode(layer->name_ + "_int8", operations::qmatmul, arguments);
+        quantized->quantized_ = weights;
+        if (layer->output_ != nullptr) {
+            allocation::allocateNode(quantized);
+        }
+
+        graph->replaceNode(layer, quantized);
+
+        report.layers_++;
+        report.float_bytes_ += w->output_->size() * sizeof(float);
+        report.quantized_bytes_ += bytes(*weights);
+
+        if (graph->useCounts()[w->getId()] == 0) {
+            graph->removeNode(w);
+        }
+    }
+
+    return report;
+}
+
+void printReport(const Report& report) {
+    std::cout << strings::debug("Quantization:") << std::endl;
+    std::cout << strings::debug("- int8 layers: ") << strings::info(std::to_string(report.layers_)) << std::endl;
+    std::cout << strings::debug("- uncalibrated layers: ") << strings::info(std::to_string(report.uncalibrated_))
+              << std::endl;
+    std::cout << strings::debug("- float32 weight bytes: ") << strings::info(std::to_string(report.float_bytes_))
+              << std::endl;
+    std::cout << strings::debug("- int8 weight bytes: ") << strings::info(std::to_string(report.quantized_bytes_))
+              << std::endl;
+}
+
+void forward(std::shared_ptr<Node> node) {
+    const Weights& weights = *node->quantized_;
+    std::shared_ptr<Node> x = node->children_[node->arg_order_[0]];
+
+    const float* in = (const float*)x->output_->getData();
+    size_t size = x->output_->size();
+    int m = size / weights.k_;
+
+    // not thread_local, the pool can run another qmatmul on this thread while it waits on the gemm below
+    std::vector<uint8_t> a(size);
+    float inverse = 1 / weights.input_scale_;
+    int zero_point = weights.input_zero_point_;
+
+    parallel::parallelFor(0, size, GRAIN, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            a[i] = std::clamp((int)std::nearbyint(in[i] * inverse) + zero_point, 0, 255);
+        }
+    });
+
+    gemm::Epilogue epilogue = gemm::none();
+    epilogue.scale_ = weights.input_scale_;
+    epilogue.activation_ = weights.activation_;
+    if (node->arg_order_.size() == 2) {
+        epilogue.bias_ = (const float*)node->children_[node->arg_order_[1]]->output_->getData();
+    }
+
+    gemm::qgemm(m, weights.n_, weights.k_, a.data(), weights.k_, weights.input_zero_point_, weights.data_.data(),
+                weights.k_, weights.sums_.data(), weights.scales_.data(), (float*)node->output_->getData(),
+                weights.n_, epilogue);
+}
+
+}  // namespace quantize
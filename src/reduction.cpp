@@ -0,0 +1,503 @@
+#include "reduction.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "buffer_ops.h"
+#include "dtypes.h"
+#include "kernel.h"
+#include "ops.h"
+#include "parallel.h"
+#include "simd.h"
+#include "string_utils.h"
+#include "views.h"
+
+namespace reduction {
+
+// lines longer than this are split in half and each half reduced on its own
+static const size_t PAIRWISE = 1024;
+
+// rows combined into a partial row before it's combined into the total
+static const size_t ROW_BLOCK = 64;
+
+// columns of a row reduction handed out at a time, their accumulators stay in L1
+static const size_t COLUMNS = 1024;
+
+// independent accumulators per line, so consecutive steps don't wait on each other
+static const int U = 4;
+
+template <Op op, typename A>
+A _identity() {
+    if constexpr (op == Op::max) {
+        return -std::numeric_limits<A>::infinity();
+    } else if constexpr (op == Op::min) {
+        return std::numeric_limits<A>::infinity();
+    } else {
+        return 0;
+    }
+}
+
+template <Op op, typename A>
+A _combine(A x, A y) {
+    if constexpr (op == Op::max) {
+        return std::max(x, y);
+    } else if constexpr (op == Op::min) {
+        return std::min(x, y);
+    } else {
+        return x + y;
+    }
+}
+
+// what's accumulated for each element, its square for the l2 norm
+template <Op op, typename A>
+A _map(A x) {
+    if constexpr (op == Op::l2) {
+        return x * x;
+    } else {
+        return x;
+    }
+}
+
+template <Op op, typename A>
+A _finish(A x, size_t count) {
+    if constexpr (op == Op::mean) {
+        return x / count;
+    } else if constexpr (op == Op::l2) {
+        return std::sqrt(x);
+    } else {
+        return x;
+    }
+}
+
+template <Op op>
+simd::vec _combine(simd::vec x, simd::vec y) {
+    if constexpr (op == Op::max) {
+        return simd::max(x, y);
+    } else if constexpr (op == Op::min) {
+        return simd::min(x, y);
+    } else {
+        return simd::add(x, y);
+    }
+}
+
+// `acc` with one more vector of elements accumulated
+template <Op op>
+simd::vec _step(simd::vec acc, simd::vec x) {
+    if constexpr (op == Op::l2) {
+        return simd::fmadd(x, x, acc);
+    } else {
+        return _combine<op>(acc, x);
+    }
+}
+
+// `n` consecutive elements accumulated, not yet finished
+template <Op op, typename T, typename A = dtypes::Accumulate<T>>
+A _line(const T* data, size_t n) {
+    if constexpr (op != Op::max && op != Op::min) {
+        if (n > PAIRWISE) {
+            size_t half = n / 2;
+            return _line<op, T>(data, half) + _line<op, T>(data + half, n - half);
+        }
+    }
+
+    A result = _identity<op, A>();
+    size_t i = 0;
+
+    if constexpr (std::is_same_v<T, float>) {
+        simd::vec acc[U];
+        for (int u = 0; u < U; u++) {
+            acc[u] = simd::broadcast(result);
+        }
+
+        for (; i + U * simd::WIDTH <= n; i += U * simd::WIDTH) {
+            for (int u = 0; u < U; u++) {
+                acc[u] = _step<op>(acc[u], simd::load(data + i + u * simd::WIDTH));
+            }
+        }
+
+        for (int u = 1; u < U; u++) {
+            acc[0] = _combine<op>(acc[0], acc[u]);
+        }
+
+        float lanes[simd::WIDTH];
+        simd::store(lanes, acc[0]);
+        for (int w = 0; w < simd::WIDTH; w++) {
+            result = _combine<op, A>(result, lanes[w]);
+        }
+    } else {
+        A acc[U];
+        for (int u = 0; u < U; u++) {
+            acc[u] = result;
+        }
+
+        for (; i + U <= n; i += U) {
+            for (int u = 0; u < U; u++) {
+                acc[u] = _combine<op, A>(acc[u], _map<op, A>((A)data[i + u]));
+            }
+        }
+
+        for (int u = 0; u < U; u++) {
+            result = _combine<op, A>(result, acc[u]);
+        }
+    }
+
+    for (; i < n; i++) {
+        result = _combine<op, A>(result, _map<op, A>((A)data[i]));
+    }
+
+    return result;
+}
+
+// `rows` rows of `width` (at most COLUMNS) elements, `stride` apart, accumulated column by column into `acc`
+// ROW_BLOCK rows at a time go into a partial row first, which is what's added to `acc`
+template <Op op, typename T, typename A>
+void _rows(const T* data, size_t rows, size_t stride, size_t width, A* acc) {
+    A partial[COLUMNS];
+
+    for (size_t first = 0; first < rows; first += ROW_BLOCK) {
+        size_t last = std::min(rows, first + ROW_BLOCK);
+        std::fill(partial, partial + width, _identity<op, A>());
+
+        for (size_t r = first; r < last; r++) {
+            const T* row = data + r * stride;
+
+            size_t j = 0;
+            if constexpr (std::is_same_v<T, float>) {
+                for (; j + simd::WIDTH <= width; j += simd::WIDTH) {
+                    simd::store(partial + j, _step<op>(simd::load(partial + j), simd::load(row + j)));
+                }
+            }
+
+            for (; j < width; j++) {
+                partial[j] = _combine<op, A>(partial[j], _map<op, A>((A)row[j]));
+            }
+        }
+
+        for (size_t j = 0; j < width; j++) {
+            acc[j] = _combine<op, A>(acc[j], partial[j]);
+        }
+    }
+}
+
+// all `n` elements, split along their length across threads
+template <Op op, typename T, typename A = dtypes::Accumulate<T>>
+A _total(const T* data, size_t n) {
+    return parallel::parallelReduce<A>(
+        0, n, std::max(parallel::GRAIN, PAIRWISE), _identity<op, A>(),
+        [&](size_t first, size_t last, A identity) {
+            return _combine<op, A>(identity, _line<op, T>(data + first, last - first));
+        },
+        [](A x, A y) { return _combine<op, A>(x, y); });
+}
+
+// offset of the `index`th combination of some runs of dimensions, given their sizes and strides
+size_t _offset(size_t index, const std::vector<size_t>& sizes, const std::vector<size_t>& strides) {
+    size_t offset = 0;
+    for (int i = sizes.size() - 1; i > -1; i--) {
+        offset += index % sizes[i] * strides[i];
+        index /= sizes[i];
+    }
+
+    return offset;
+}
+
+size_t _product(const std::vector<size_t>& sizes) {
+    size_t product = 1;
+    for (size_t size : sizes) {
+        product *= size;
+    }
+
+    return product;
+}
+
+// whether each dimension of `shape` is one of `axes`
+std::vector<bool> _reduced(const std::vector<int>& shape, const std::vector<int>& axes) {
+    std::vector<bool> reduced(shape.size(), false);
+    for (int axis : axes) {
+        int rank = shape.size();
+        if (axis < -rank || axis >= rank) {
+            std::cerr << strings::error("reduction::reduce error: ") << "axis " << strings::info(std::to_string(axis))
+                      << " out of range for shape " << strings::info(strings::vecToString(shape)) << std::endl;
+            exit(-1);
+        }
+
+        reduced[axis < 0 ? axis + rank : axis] = true;
+    }
+
+    return reduced;
+}
+
+template <Op op, typename T>
+void _reduce(const T* data, const std::vector<int>& shape, const std::vector<bool>& reduced, T* out,
+             bool accumulate) {
+    using A = dtypes::Accumulate<T>;
+
+    // merged runs of dimensions that are all reduced or all kept, dimensions of 1 are neither
+    std::vector<size_t> sizes;
+    std::vector<bool> kinds;
+    for (int i = 0; i < shape.size(); i++) {
+        if (shape[i] == 1) {
+            continue;
+        }
+
+        if (!sizes.empty() && kinds.back() == reduced[i]) {
+            sizes.back() *= shape[i];
+        } else {
+            sizes.push_back(shape[i]);
+            kinds.push_back(reduced[i]);
+        }
+    }
+
+    std::vector<size_t> strides(sizes.size());
+    size_t stride = 1;
+    for (int i = sizes.size() - 1; i > -1; i--) {
+        strides[i] = stride;
+        stride *= sizes[i];
+    }
+
+    // the innermost run is set apart, the rest are split by kind
+    bool inner_reduced = !kinds.empty() && kinds.back();
+    size_t inner = sizes.empty() ? 1 : sizes.back();
+
+    std::vector<size_t> kept_sizes, kept_strides, reduced_sizes, reduced_strides;
+    for (int i = 0; i + 1 < sizes.size(); i++) {
+        (kinds[i] ? reduced_sizes : kept_sizes).push_back(sizes[i]);
+        (kinds[i] ? reduced_strides : kept_strides).push_back(strides[i]);
+    }
+
+    size_t count = _product(reduced_sizes) * (inner_reduced ? inner : 1);
+
+    auto store = [&](size_t index, A value) {
+        value = _finish<op, A>(value, count);
+        if (accumulate) {
+            value += (A)out[index];
+        }
+
+        out[index] = (T)value;
+    };
+
+    if (inner_reduced) {
+        size_t outputs = _product(kept_sizes);
+        size_t lines = _product(reduced_sizes);
+
+        if (outputs == 1 && lines == 1) {
+            store(0, _total<op, T>(data, inner));
+            return;
+        }
+
+        size_t grain = std::max((size_t)1, parallel::GRAIN / (lines * inner));
+        parallel::parallelFor(0, outputs, grain, [&](size_t first, size_t last) {
+            for (size_t o = first; o < last; o++) {
+                const T* base = data + _offset(o, kept_sizes, kept_strides);
+
+                A acc = _identity<op, A>();
+                for (size_t line = 0; line < lines; line++) {
+                    acc = _combine<op, A>(acc, _line<op, T>(base + _offset(line, reduced_sizes, reduced_strides), inner));
+                }
+
+                store(o, acc);
+            }
+        });
+
+        return;
+    }
+
+    // the kept innermost run is contiguous in the output too, so every output row is reduced from whole input rows
+    // the last reduced run gives evenly strided rows, the ones before it are looped over
+    size_t rows = reduced_sizes.empty() ? 1 : reduced_sizes.back();
+    size_t row_stride = reduced_sizes.empty() ? 0 : reduced_strides.back();
+    if (!reduced_sizes.empty()) {
+        reduced_sizes.pop_back();
+        reduced_strides.pop_back();
+    }
+
+    size_t blocks = _product(reduced_sizes);
+    size_t outer = _product(kept_sizes);
+    size_t chunks = (inner + COLUMNS - 1) / COLUMNS;
+
+    size_t grain = std::max((size_t)1, parallel::GRAIN / (count * std::min(inner, COLUMNS)));
+    parallel::parallelFor(0, outer * chunks, grain, [&](size_t first, size_t last) {
+        A acc[COLUMNS];
+
+        for (size_t task = first; task < last; task++) {
+            size_t o = task / chunks;
+            size_t column = task % chunks * COLUMNS;
+            size_t width = std::min(COLUMNS, inner - column);
+
+            const T* base = data + _offset(o, kept_sizes, kept_strides) + column;
+
+            std::fill(acc, acc + width, _identity<op, A>());
+            for (size_t block = 0; block < blocks; block++) {
+                _rows<op>(base + _offset(block, reduced_sizes, reduced_strides), rows, row_stride, width, acc);
+            }
+
+            for (size_t j = 0; j < width; j++) {
+                store(o * inner + column + j, acc[j]);
+            }
+        }
+    });
+}
+
+template <typename F>
+decltype(auto) _dispatch(Op op, F&& f) {
+    switch (op) {
+        case Op::sum:
+            return f.template operator()<Op::sum>();
+        case Op::mean:
+            return f.template operator()<Op::mean>();
+        case Op::max:
+            return f.template operator()<Op::max>();
+        case Op::min:
+            return f.template operator()<Op::min>();
+        default:
+            return f.template operator()<Op::l2>();
+    }
+}
+
+// `a` itself if it's contiguous, otherwise a contiguous copy
+std::shared_ptr<Buffer> _contiguous(std::shared_ptr<Buffer> a) {
+    if (a->contiguous()) {
+        return a;
+    }
+
+    std::shared_ptr<GraphBuffer> copy(new GraphBuffer(a->shape(), a->dtype()));
+    views::copy(a, copy);
+
+    return copy;
+}
+
+void reduce(Op op, std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> out, const std::vector<int>& axes,
+            bool accumulate) {
+    std::vector<int> shape = a->shape();
+    std::vector<bool> reduced = _reduced(shape, axes);
+
+    size_t kept = 1;
+    for (int i = 0; i < shape.size(); i++) {
+        kept *= reduced[i] ? 1 : shape[i];
+    }
+
+    if (out->size() != kept || !out->contiguous() || out->dtype() != a->dtype()) {
+        std::cerr << strings::error("reduction::reduce error: ") << "can't reduce "
+                  << strings::info(strings::vecToString(shape)) << " over axes "
+                  << strings::info(strings::vecToString(axes)) << " into "
+                  << strings::info(strings::vecToString(out->shape())) << std::endl;
+        exit(-1);
+    }
+
+    a = _contiguous(a);
+    dtypes::dispatch(a->dtype(), [&]<typename T>() {
+        _dispatch(op, [&]<Op O>() {
+            _reduce<O, T>((const T*)a->getData(), shape, reduced, (T*)out->getData(), accumulate);
+        });
+    });
+}
+
+double reduce(Op op, std::shared_ptr<Buffer> a) {
+    a = _contiguous(a);
+
+    return dtypes::dispatch(a->dtype(), [&]<typename T>() {
+        return _dispatch(op, [&]<Op O>() {
+            using A = dtypes::Accumulate<T>;
+            return (double)_finish<O, A>(_total<O, T>((const T*)a->getData(), a->size()), a->size());
+        });
+    });
+}
+
+std::vector<int> reducedShape(const std::vector<int>& shape, const std::vector<int>& axes) {
+    std::vector<bool> reduced = _reduced(shape, axes);
+
+    std::vector<int> out = shape;
+    for (int i = 0; i < out.size(); i++) {
+        if (reduced[i]) {
+            out[i] = 1;
+        }
+    }
+
+    return out;
+}
+
+Op _op(std::shared_ptr<Node> node) {
+    if (node->operation_type_ == operations::reduce_mean) {
+        return Op::mean;
+    } else if (node->operation_type_ == operations::reduce_max) {
+        return Op::max;
+    }
+
+    return Op::sum;
+}
+
+// the axes given after the operand, every axis when there are none
+std::vector<int> _axes(std::shared_ptr<Node> node, int rank) {
+    std::vector<int> axes;
+    for (int i = 1; i < node->arg_order_.size(); i++) {
+        axes.push_back(std::stoi(node->arg_order_[i]));
+    }
+
+    if (node->arg_order_.size() == 1) {
+        for (int i = 0; i < rank; i++) {
+            axes.push_back(i);
+        }
+    }
+
+    return axes;
+}
+
+void allocate(std::shared_ptr<Node> node) {
+    std::shared_ptr<Node> child = node->children_[node->arg_order_[0]];
+
+    // a full reduction is a single value, whatever the rank it came from
+    node->shape_ = node->arg_order_.size() == 1 ? std::vector<int>{1}
+                                                : reducedShape(child->shape_, _axes(node, child->shape_.size()));
+
+    node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
+    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
+    buffer_ops::set(node->gradient_, 1.0);
+}
+
+void forward(std::shared_ptr<Node> node) {
+    std::shared_ptr<Node> child = node->children_[node->arg_order_[0]];
+    reduce(_op(node), child->output_, node->output_, _axes(node, child->shape_.size()), false);
+}
+
+void backward(std::shared_ptr<Node> node) {
+    std::shared_ptr<Node> child = node->children_[node->arg_order_[0]];
+    if (child->operation_type_ == operations::constant) {
+        return;
+    }
+
+    // the upstream gradient broadcasts back across the reduced axes
+    std::shared_ptr<GraphBuffer> upstream = node->gradient_;
+
+    Op op = _op(node);
+    if (op == Op::mean) {
+        std::shared_ptr<GraphBuffer> scaled(new GraphBuffer(node->shape_, node->dtype_));
+        buffer_ops::multiply(node->gradient_, (float)node->output_->size() / child->output_->size(), scaled);
+        upstream = scaled;
+    } else if (op == Op::max) {
+        // only the maxima reach the output, ties all get the full gradient
+        std::shared_ptr<GraphBuffer> mask(new GraphBuffer(child->gradient_->shape(), node->dtype_));
+        dtypes::dispatch(node->dtype_, [&]<typename T>() {
+            using A = dtypes::Accumulate<T>;
+            kernel::_element_wise(
+                [](std::shared_ptr<Buffer> x, std::shared_ptr<Buffer> max, std::shared_ptr<Buffer> out,
+                   const std::vector<int>& indices) {
+                    T value = (A)x->getIndex<T>(indices) == (A)max->getIndex<T>(indices) ? 1.f : 0.f;
+                    out->setIndex(indices, (void*)(&value));
+                },
+                child->output_, node->output_, mask);
+        });
+
+        buffer_ops::multiply(mask, node->gradient_, mask);
+        upstream = mask;
+    }
+
+    buffer_ops::multiply(upstream, child->gradient_, child->gradient_);
+}
+
+}  // namespace reduction
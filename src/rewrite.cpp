@@ -0,0 +1,220 @@
+#include "rewrite.h"
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "graph.h"
+#include "ops.h"
+#include "string_utils.h"
+
+namespace rewrite {
+
+std::shared_ptr<Node> _arg(std::shared_ptr<Node> node, int index) {
+    return node->children_[node->arg_order_[index]];
+}
+
+bool _is_constant(std::shared_ptr<Node> node, float value) {
+    return node->operation_type_ == operations::constant && std::stof(node->name_) == value;
+}
+
+bool _is_negation(std::shared_ptr<Node> node) {
+    return node->operation_type_ == operations::subtract && node->arg_order_.size() == 2 &&
+           _is_constant(_arg(node, 0), 0);
+}
+
+// pow(x, 2) -> multiply(x, x)
+//
+// forward skips std::pow
+// backward skips the ln(x) and the staging buffers in powGradient,
+// multiplyGradient handles multiply(x, x) as 2x
+bool _square_to_multiply(std::shared_ptr<Graph> graph, std::shared_ptr<Node> node) {
+    if (node->operation_type_ != operations::pow || !_is_constant(_arg(node, 1), 2)) {
+        return false;
+    }
+
+    const std::string base = node->arg_order_[0];
+    if (node->arg_order_[1] != base) {
+        node->children_.erase(node->arg_order_[1]);
+    }
+
+    node->operation_type_ = operations::multiply;
+    node->arg_order_ = {base, base};
+
+    return true;
+}
+
+// pow(x, 0.5) -> sqrt(x)
+bool _half_power_to_sqrt(std::shared_ptr<Graph> graph, std::shared_ptr<Node> node) {
+    if (node->operation_type_ != operations::pow || !_is_constant(_arg(node, 1), 0.5)) {
+        return false;
+    }
+
+    const std::string base = node->arg_order_[0];
+    node->children_.erase(node->arg_order_[1]);
+
+    node->operation_type_ = operations::sqrt;
+    node->arg_order_ = {base};
+
+    return true;
+}
+
+// multiply(x, 1), multiply(1, x), divide(x, 1) -> x
+bool _eliminate_multiplicative_identity(std::shared_ptr<Graph> graph, std::shared_ptr<Node> node) {
+    if (node->arg_order_.size() != 2) {
+        return false;
+    }
+
+    if (node->operation_type_ == operations::multiply || node->operation_type_ == operations::divide) {
+        if (_is_constant(_arg(node, 1), 1)) {
+            graph->replaceNode(node, _arg(node, 0));
+            return true;
+        }
+    }
+
+    if (node->operation_type_ == operations::multiply && _is_constant(_arg(node, 0), 1)) {
+        graph->replaceNode(node, _arg(node, 1));
+        return true;
+    }
+
+    return false;
+}
+
+// add(x, 0), add(0, x), subtract(x, 0) -> x
+bool _eliminate_additive_identity(std::shared_ptr<Graph> graph, std::shared_ptr<Node> node) {
+    if (node->arg_order_.size() != 2) {
+        return false;
+    }
+
+    if (node->operation_type_ == operations::add || node->operation_type_ == operations::subtract) {
+        if (_is_constant(_arg(node, 1), 0)) {
+            graph->replaceNode(node, _arg(node, 0));
+            return true;
+        }
+    }
+
+    if (node->operation_type_ == operations::add && _is_constant(_arg(node, 0), 0)) {
+        graph->replaceNode(node, _arg(node, 1));
+        return true;
+    }
+
+    return false;
+}
+
+// subtract(0, subtract(0, x)) -> x
+bool _cancel_double_negation(std::shared_ptr<Graph> graph, std::shared_ptr<Node> node) {
+    if (!_is_negation(node) || !_is_negation(_arg(node, 1))) {
+        return false;
+    }
+
+    graph->replaceNode(node, _arg(_arg(node, 1), 1));
+
+    return true;
+}
+
+// exp(ln(x)) -> x
+// ln(exp(x)) -> x
+bool _collapse_exp_ln(std::shared_ptr<Graph> graph, std::shared_ptr<Node> node) {
+    const std::string& op = node->operation_type_;
+    if ((op != operations::exp && op != operations::ln) || node->arg_order_.size() != 1) {
+        return false;
+    }
+
+    std::shared_ptr<Node> inner = _arg(node, 0);
+    const std::string& inverse = op == operations::exp ? operations::ln : operations::exp;
+    if (inner->operation_type_ != inverse) {
+        return false;
+    }
+
+    graph->replaceNode(node, _arg(inner, 0));
+
+    return true;
+}
+
+std::vector<Rule> defaultRules() {
+    return {
+        {"pow(x, 2) -> multiply(x, x)", _square_to_multiply},
+        {"pow(x, 0.5) -> sqrt(x)", _half_power_to_sqrt},
+        {"multiplicative identity", _eliminate_multiplicative_identity},
+        {"additive identity", _eliminate_additive_identity},
+        {"double negation", _cancel_double_negation},
+        {"exp/ln", _collapse_exp_ln},
+    };
+}
+
+Report run(std::shared_ptr<Graph> graph, const std::vector<Rule>& rules) {
+    Report report;
+
+    // anything consumed before the rewrite but not after only existed to feed a rewritten expression
+    // nodes that were never consumed are outputs and are left alone
+    std::set<int> consumed;
+    for (auto& [id, consumers] : graph->consumers()) {
+        consumed.insert(id);
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        // rules mutate nodes_, so work off of a snapshot
+        std::vector<std::shared_ptr<Node>> nodes;
+        for (auto& [id, node] : graph->nodes_) {
+            nodes.push_back(node);
+        }
+
+        for (std::shared_ptr<Node> node : nodes) {
+            if (!graph->isNode(node->getId())) {
+                continue;
+            }
+
+            for (const Rule& rule : rules) {
+                if (rule.apply_(graph, node)) {
+                    report[rule.name_]++;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    bool swept = true;
+    while (swept) {
+        swept = false;
+
+        std::map<int, std::vector<std::shared_ptr<Node>>> consumer_map = graph->consumers();
+
+        std::vector<std::shared_ptr<Node>> dead;
+        for (auto& [id, node] : graph->nodes_) {
+            if (consumed.find(id) != consumed.end() && consumer_map.find(id) == consumer_map.end()) {
+                dead.push_back(node);
+            }
+        }
+
+        for (std::shared_ptr<Node> node : dead) {
+            graph->removeNode(node);
+            swept = true;
+        }
+    }
+
+    return report;
+}
+
+Report run(std::shared_ptr<Graph> graph) {
+    return run(graph, defaultRules());
+}
+
+void printReport(const Report& report) {
+    std::cout << strings::debug("Rewrites:") << std::endl;
+    if (report.empty()) {
+        std::cout << strings::debug("- ") << strings::info("none") << std::endl;
+    }
+
+    for (auto& [name, count] : report) {
+        std::cout << strings::debug("- ") << strings::info(name) << strings::debug(" x") << count << std::endl;
+    }
+}
+
+}  // namespace rewrite
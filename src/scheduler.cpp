@@ -0,0 +1,243 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "fusion.h"
+#include "graph.h"
+#include "ops.h"
+#include "parallel.h"
+#include "views.h"
+
+namespace scheduler {
+
+// below this a node runs on the thread that readied it instead of being handed to the pool
+static const size_t INLINE_COST = 4096;
+
+// below this a node's kernel runs single threaded
+static const size_t INTRA_OP_COST = 1 << 16;
+
+struct _Task {
+    std::shared_ptr<Node> node_;
+    size_t cost_;
+
+    std::atomic<int> pending_;
+    std::vector<int> successors_;
+
+    // held while the node is visited, sorted so two tasks never wait on each other
+    std::vector<std::mutex*> locks_;
+};
+
+size_t _size(const std::vector<int>& shape) {
+    size_t size = 1;
+    for (int dim : shape) {
+        size *= dim;
+    }
+
+    return size;
+}
+
+size_t cost(std::shared_ptr<Node> node) {
+    size_t size = _size(node->shape_);
+
+    const std::string& op = node->operation_type_;
+    if ((op == operations::matmul || op == operations::dense || op == operations::dense_relu ||
+         op == operations::dense_sigmoid || op == operations::qmatmul) &&
+        !node->arg_order_.empty()) {
+        const std::vector<int>& left = node->children_[node->arg_order_[0]]->shape_;
+        return size * (left.empty() ? 1 : left.back());
+    } else if (op == operations::conv2d && node->arg_order_.size() == 2) {
+        return size * _size(node->children_[node->arg_order_[1]]->shape_);
+    } else if (op == operations::fused && node->program_ != nullptr) {
+        return size * node->program_->instructions_.size();
+    } else if ((op == operations::reduce_sum || op == operations::reduce_mean || op == operations::reduce_max ||
+                op == operations::softmax_cross_entropy) &&
+               !node->arg_order_.empty()) {
+        // the work is in the input, the output can be a single value
+        return _size(node->children_[node->arg_order_[0]]->shape_);
+    } else if (views::isView(node) && !node->materialize_) {
+        // metadata only, see views.h
+        return 1;
+    }
+
+    return size;
+}
+
+void _visit(_Task& task, const std::function<void(std::shared_ptr<Node>)>& visit) {
+    std::vector<std::unique_lock<std::mutex>> held;
+    for (std::mutex* lock : task.locks_) {
+        held.emplace_back(*lock);
+    }
+
+    // a thread holding locks mustn't go off running other nodes while its kernel waits,
+    // one of them could be after the same locks
+    if (task.cost_ < INTRA_OP_COST || !held.empty()) {
+        parallel::SerialScope serial;
+        visit(task.node_);
+    } else {
+        visit(task.node_);
+    }
+}
+
+void _execute(std::vector<std::unique_ptr<_Task>>& tasks, const std::function<void(std::shared_ptr<Node>)>& visit) {
+    std::vector<int> roots;
+    for (int i = 0; i < tasks.size(); i++) {
+        if (tasks[i]->pending_.load() == 0) {
+            roots.push_back(i);
+        }
+    }
+
+    // e.g. one of several graph replicas being run side by side, see data_parallel.h
+    if (parallel::threadCount() == 1 || parallel::serial()) {
+        std::queue<int> q;
+        for (int root : roots) {
+            q.push(root);
+        }
+
+        while (!q.empty()) {
+            _Task& task = *tasks[q.front()];
+            q.pop();
+
+            visit(task.node_);
+
+            for (int successor : task.successors_) {
+                if (--tasks[successor]->pending_ == 0) {
+                    q.push(successor);
+                }
+            }
+        }
+
+        return;
+    }
+
+    parallel::ThreadPool& pool = parallel::pool();
+    std::atomic<size_t> remaining(tasks.size());
+
+    // runs `ready` and whatever it readies that's worth keeping on this thread
+    std::function<void(std::vector<int>)> run = [&](std::vector<int> ready) {
+        while (!ready.empty()) {
+            _Task& task = *tasks[ready.back()];
+            ready.pop_back();
+
+            _visit(task, visit);
+
+            bool kept = false;
+            for (int successor : task.successors_) {
+                _Task& next = *tasks[successor];
+                if (--next.pending_ != 0) {
+                    continue;
+                }
+
+                if (next.cost_ < INLINE_COST) {
+                    ready.push_back(successor);
+                } else if (!kept) {
+                    ready.push_back(successor);
+                    kept = true;
+                } else {
+                    pool.submit([&run, successor] { run({successor}); });
+                }
+            }
+
+            remaining--;
+        }
+    };
+
+    std::vector<int> mine;
+    bool kept = false;
+    for (int root : roots) {
+        if (tasks[root]->cost_ < INLINE_COST || !kept) {
+            kept |= tasks[root]->cost_ >= INLINE_COST;
+            mine.push_back(root);
+        } else {
+            pool.submit([&run, root] { run({root}); });
+        }
+    }
+
+    run(mine);
+
+    while (remaining.load() > 0) {
+        if (!pool.runPending()) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+std::vector<std::unique_ptr<_Task>> _tasks(const std::vector<std::shared_ptr<Node>>& nodes,
+                                           std::map<int, int>& index) {
+    std::vector<std::unique_ptr<_Task>> tasks;
+    for (int i = 0; i < nodes.size(); i++) {
+        index[nodes[i]->getId()] = i;
+
+        tasks.push_back(std::unique_ptr<_Task>(new _Task()));
+        tasks.back()->node_ = nodes[i];
+        tasks.back()->cost_ = cost(nodes[i]);
+        tasks.back()->pending_ = 0;
+    }
+
+    return tasks;
+}
+
+void forward(const std::vector<std::shared_ptr<Node>>& nodes, std::function<void(std::shared_ptr<Node>)> visit) {
+    std::map<int, int> index;
+    std::vector<std::unique_ptr<_Task>> tasks = _tasks(nodes, index);
+
+    for (int i = 0; i < nodes.size(); i++) {
+        for (auto& [name, child] : nodes[i]->children_) {
+            auto it = index.find(child->getId());
+            if (it != index.end()) {
+                tasks[i]->pending_++;
+                tasks[it->second]->successors_.push_back(i);
+            }
+        }
+    }
+
+    _execute(tasks, visit);
+}
+
+void backward(const std::vector<std::shared_ptr<Node>>& nodes, std::function<void(std::shared_ptr<Node>)> visit) {
+    std::map<int, int> index;
+    std::vector<std::unique_ptr<_Task>> tasks = _tasks(nodes, index);
+
+    for (int i = 0; i < nodes.size(); i++) {
+        for (auto& [name, child] : nodes[i]->children_) {
+            auto it = index.find(child->getId());
+            if (it != index.end()) {
+                tasks[it->second]->pending_++;
+                tasks[i]->successors_.push_back(it->second);
+            }
+        }
+    }
+
+    // only children with more than one consumer can be written to concurrently
+    std::map<int, std::unique_ptr<std::mutex>> locks;
+    for (int i = 0; i < nodes.size(); i++) {
+        if (tasks[i]->pending_.load() > 1) {
+            locks[i] = std::unique_ptr<std::mutex>(new std::mutex());
+        }
+    }
+
+    for (int i = 0; i < nodes.size(); i++) {
+        std::vector<int> shared;
+        for (int child : tasks[i]->successors_) {
+            if (locks.find(child) != locks.end()) {
+                shared.push_back(child);
+            }
+        }
+
+        std::sort(shared.begin(), shared.end());
+        for (int child : shared) {
+            tasks[i]->locks_.push_back(locks[child].get());
+        }
+    }
+
+    _execute(tasks, visit);
+}
+
+}  // namespace scheduler
@@ -0,0 +1,312 @@
+#include "softmax.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "buffer_ops.h"
+#include "dtypes.h"
+#include "ops.h"
+#include "parallel.h"
+#include "simd.h"
+#include "string_utils.h"
+
+namespace softmax {
+
+// a row's max and sum of e^(x - max), and for the loss the labels' dot with the row and their sum
+// the dot is taken with the row less its first element, so large logits don't cancel out of the loss
+template <typename A>
+struct _Row {
+    A max_ = -std::numeric_limits<A>::infinity();
+    A sum_ = 0;
+
+    A origin_ = 0;
+    A dot_ = 0;
+    A labels_ = 0;
+
+    // adds `x` to the sum, rescaling what's there if it's the new max
+    void update(A x) {
+        if (x > max_) {
+            sum_ = sum_ * std::exp(max_ - x) + 1;
+            max_ = x;
+        } else {
+            sum_ += std::exp(x - max_);
+        }
+    }
+};
+
+// one pass over the `n` elements of `x`, and of `y` when there are labels
+template <bool labelled, typename T, typename A = dtypes::Accumulate<T>>
+_Row<A> _row(const T* x, const T* y, size_t n) {
+    _Row<A> row;
+    if constexpr (labelled) {
+        row.origin_ = n > 0 ? (A)x[0] : 0;
+    }
+
+    size_t i = 0;
+    if constexpr (std::is_same_v<T, float>) {
+        if (n >= simd::WIDTH) {
+            simd::vec max = simd::broadcast(row.max_);
+            simd::vec sum = simd::zero();
+            simd::vec dot = simd::zero();
+            simd::vec labels = simd::zero();
+            simd::vec origin = simd::broadcast(row.origin_);
+
+            for (; i + simd::WIDTH <= n; i += simd::WIDTH) {
+                simd::vec v = simd::load(x + i);
+                simd::vec moved = simd::max(max, v);
+
+                sum = simd::fmadd(sum, simd::exp(simd::sub(max, moved)), simd::exp(simd::sub(v, moved)));
+                max = moved;
+
+                if constexpr (labelled) {
+                    simd::vec l = simd::load(y + i);
+                    dot = simd::fmadd(l, simd::sub(v, origin), dot);
+                    labels = simd::add(labels, l);
+                }
+            }
+
+            // each lane kept its own max, their sums are brought to the overall one
+            float maxes[simd::WIDTH];
+            float sums[simd::WIDTH];
+            simd::store(maxes, max);
+            simd::store(sums, sum);
+
+            row.max_ = *std::max_element(maxes, maxes + simd::WIDTH);
+            for (int w = 0; w < simd::WIDTH; w++) {
+                row.sum_ += sums[w] * std::exp(maxes[w] - row.max_);
+            }
+
+            if constexpr (labelled) {
+                row.dot_ = simd::sum(dot);
+                row.labels_ = simd::sum(labels);
+            }
+        }
+    }
+
+    for (; i < n; i++) {
+        row.update((A)x[i]);
+
+        if constexpr (labelled) {
+            row.dot_ += (A)y[i] * ((A)x[i] - row.origin_);
+            row.labels_ += (A)y[i];
+        }
+    }
+
+    return row;
+}
+
+// e^(x - max) * scale - y * shift for each of the `n` elements of `x` (and `y` when there are labels) into `out`
+template <bool labelled, typename T, typename A>
+void _write(const T* x, const T* y, T* out, size_t n, A max, A scale, A shift) {
+    size_t i = 0;
+    if constexpr (std::is_same_v<T, float>) {
+        simd::vec m = simd::broadcast(max);
+        simd::vec s = simd::broadcast(scale);
+        simd::vec t = simd::broadcast(shift);
+
+        for (; i + simd::WIDTH <= n; i += simd::WIDTH) {
+            simd::vec p = simd::mul(simd::exp(simd::sub(simd::load(x + i), m)), s);
+            if constexpr (labelled) {
+                p = simd::sub(p, simd::mul(simd::load(y + i), t));
+            }
+
+            simd::store(out + i, p);
+        }
+    }
+
+    for (; i < n; i++) {
+        A p = std::exp((A)x[i] - max) * scale;
+        if constexpr (labelled) {
+            p -= (A)y[i] * shift;
+        }
+
+        out[i] = (T)p;
+    }
+}
+
+// `fn(row, first element)` for every row of `columns` elements, rows split across threads
+template <typename F>
+void _rows(size_t rows, size_t columns, F fn) {
+    size_t grain = std::max((size_t)1, parallel::GRAIN / std::max((size_t)1, columns));
+    parallel::parallelFor(0, rows, grain, [&](size_t first, size_t last) {
+        for (size_t r = first; r < last; r++) {
+            fn(r, r * columns);
+        }
+    });
+}
+
+size_t _columns(std::shared_ptr<Buffer> x) {
+    return x->shape().empty() ? 1 : x->shape().back();
+}
+
+void _assert_matching(const std::string& fn, std::shared_ptr<Buffer> a, std::shared_ptr<Buffer> b, size_t size) {
+    if (b->size() != size || a->dtype() != b->dtype()) {
+        std::cerr << strings::error("softmax::" + fn + " error: ") << "can't use "
+                  << strings::info(strings::vecToString(b->shape())) << " with "
+                  << strings::info(strings::vecToString(a->shape())) << ", expected "
+                  << strings::info(std::to_string(size)) << " elements of the same dtype" << std::endl;
+        exit(-1);
+    }
+}
+
+void softmax(std::shared_ptr<Buffer> x, std::shared_ptr<Buffer> out) {
+    _assert_matching("softmax", x, out, x->size());
+
+    size_t columns = _columns(x);
+    dtypes::dispatch(x->dtype(), [&]<typename T>() {
+        using A = dtypes::Accumulate<T>;
+        const T* data = (const T*)x->getData();
+        T* result = (T*)out->getData();
+
+        _rows(x->size() / columns, columns, [&](size_t r, size_t offset) {
+            _Row<A> row = _row<false>(data + offset, (const T*)nullptr, columns);
+            _write<false, T, A>(data + offset, nullptr, result + offset, columns, row.max_, 1 / row.sum_, 0);
+        });
+    });
+}
+
+void crossEntropy(std::shared_ptr<Buffer> logits, std::shared_ptr<Buffer> labels, std::shared_ptr<Buffer> out) {
+    size_t columns = _columns(logits);
+    _assert_matching("crossEntropy", logits, labels, logits->size());
+    _assert_matching("crossEntropy", logits, out, logits->size() / columns);
+
+    dtypes::dispatch(logits->dtype(), [&]<typename T>() {
+        using A = dtypes::Accumulate<T>;
+        const T* x = (const T*)logits->getData();
+        const T* y = (const T*)labels->getData();
+        T* result = (T*)out->getData();
+
+        // -sum(y * (x - logsumexp(x))) = sum(y) * logsumexp(x) - sum(y * x), both sides less sum(y) * origin
+        _rows(logits->size() / columns, columns, [&](size_t r, size_t offset) {
+            _Row<A> row = _row<true>(x + offset, y + offset, columns);
+            result[r] = (T)((row.max_ - row.origin_ + std::log(row.sum_)) * row.labels_ - row.dot_);
+        });
+    });
+}
+
+void crossEntropyGradient(std::shared_ptr<Buffer> logits, std::shared_ptr<Buffer> labels,
+                          std::shared_ptr<Buffer> upstream, std::shared_ptr<Buffer> out) {
+    size_t columns = _columns(logits);
+    _assert_matching("crossEntropyGradient", logits, labels, logits->size());
+    _assert_matching("crossEntropyGradient", logits, upstream, logits->size() / columns);
+    _assert_matching("crossEntropyGradient", logits, out, logits->size());
+
+    dtypes::dispatch(logits->dtype(), [&]<typename T>() {
+        using A = dtypes::Accumulate<T>;
+        const T* x = (const T*)logits->getData();
+        const T* y = (const T*)labels->getData();
+        const T* g = (const T*)upstream->getData();
+        T* result = (T*)out->getData();
+
+        // (softmax(x) * sum(y) - y) * upstream, which is softmax(x) - y for distributions
+        _rows(logits->size() / columns, columns, [&](size_t r, size_t offset) {
+            _Row<A> row = _row<true>(x + offset, y + offset, columns);
+            A scale = row.labels_ / row.sum_ * (A)g[r];
+            _write<true, T, A>(x + offset, y + offset, result + offset, columns, row.max_, scale, (A)g[r]);
+        });
+    });
+}
+
+// p * (g - sum(g * p)) for each row of the softmax's output `p` and its upstream gradient `g`, into `out`
+void _softmax_gradient(std::shared_ptr<Buffer> p, std::shared_ptr<Buffer> g, std::shared_ptr<Buffer> out) {
+    size_t columns = _columns(p);
+    dtypes::dispatch(p->dtype(), [&]<typename T>() {
+        using A = dtypes::Accumulate<T>;
+        const T* probabilities = (const T*)p->getData();
+        const T* upstream = (const T*)g->getData();
+        T* result = (T*)out->getData();
+
+        _rows(p->size() / columns, columns, [&](size_t r, size_t offset) {
+            const T* pr = probabilities + offset;
+            const T* gr = upstream + offset;
+            T* o = result + offset;
+
+            A dot = 0;
+            size_t i = 0;
+            if constexpr (std::is_same_v<T, float>) {
+                simd::vec acc = simd::zero();
+                for (; i + simd::WIDTH <= columns; i += simd::WIDTH) {
+                    acc = simd::fmadd(simd::load(pr + i), simd::load(gr + i), acc);
+                }
+
+                dot = simd::sum(acc);
+            }
+
+            for (; i < columns; i++) {
+                dot += (A)pr[i] * (A)gr[i];
+            }
+
+            i = 0;
+            if constexpr (std::is_same_v<T, float>) {
+                simd::vec d = simd::broadcast(dot);
+                for (; i + simd::WIDTH <= columns; i += simd::WIDTH) {
+                    simd::store(o + i, simd::mul(simd::load(pr + i), simd::sub(simd::load(gr + i), d)));
+                }
+            }
+
+            for (; i < columns; i++) {
+                o[i] = (T)((A)pr[i] * ((A)gr[i] - dot));
+            }
+        });
+    });
+}
+
+void allocate(std::shared_ptr<Node> node) {
+    std::shared_ptr<Node> logits = node->children_[node->arg_order_[0]];
+    node->shape_ = logits->shape_;
+
+    if (node->operation_type_ == operations::softmax_cross_entropy) {
+        std::shared_ptr<Node> labels = node->children_[node->arg_order_[1]];
+        if (labels->shape_ != logits->shape_) {
+            std::cerr << strings::error("softmax::allocate error: ") << "labels of shape "
+                      << strings::info(strings::vecToString(labels->shape_)) << " don't match logits of shape "
+                      << strings::info(strings::vecToString(logits->shape_)) << std::endl;
+            exit(-1);
+        }
+
+        // one loss per row
+        if (node->shape_.empty()) {
+            node->shape_ = {1};
+        }
+
+        node->shape_.back() = 1;
+    }
+
+    node->output_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
+    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
+    buffer_ops::set(node->gradient_, 1.0);
+}
+
+void forward(std::shared_ptr<Node> node) {
+    std::shared_ptr<Node> logits = node->children_[node->arg_order_[0]];
+
+    if (node->operation_type_ == operations::softmax_cross_entropy) {
+        crossEntropy(logits->output_, node->children_[node->arg_order_[1]]->output_, node->output_);
+    } else {
+        softmax(logits->output_, node->output_);
+    }
+}
+
+void backward(std::shared_ptr<Node> node) {
+    std::shared_ptr<Node> logits = node->children_[node->arg_order_[0]];
+    if (logits->operation_type_ == operations::constant) {
+        return;
+    }
+
+    std::shared_ptr<GraphBuffer> gradient(new GraphBuffer(logits->shape_, node->dtype_));
+    if (node->operation_type_ == operations::softmax_cross_entropy) {
+        crossEntropyGradient(logits->output_, node->children_[node->arg_order_[1]]->output_, node->gradient_,
+                             gradient);
+    } else {
+        _softmax_gradient(node->output_, node->gradient_, gradient);
+    }
+
+    buffer_ops::multiply(gradient, logits->gradient_, logits->gradient_);
+}
+
+}  // namespace softmax
@@ -0,0 +1,563 @@
+#include "views.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "broadcasting.h"
+#include "buffer.h"
+#include "buffer_ops.h"
+#include "graph.h"
+#include "iterators.h"
+#include "ops.h"
+#include "parallel.h"
+#include "simd.h"
+#include "string_utils.h"
+
+namespace views {
+
+// rows handed to a thread at a time when copying
+static const size_t GRAIN = 64;
+
+// transposed copies are done in tiles of at most this many rows and columns, so both sides of a tile stay in L1
+static const size_t TILE = 32;
+
+// rows of a transposed copy handed out at a time
+static const size_t PANEL = 64;
+
+// elements of a transposed copy handed to a thread at a time
+static const size_t TRANSPOSE_GRAIN = 1 << 14;
+
+bool _contiguous(const std::vector<int>& shape, const std::vector<int>& strides) {
+    size_t stride = 1;
+    for (int i = shape.size() - 1; i > -1; i--) {
+        if (shape[i] != 1 && strides[i] != stride) {
+            return false;
+        }
+
+        stride *= shape[i];
+    }
+
+    return true;
+}
+
+std::shared_ptr<GraphBuffer> transpose(std::shared_ptr<Buffer> a, const std::vector<int>& permutation) {
+    std::vector<int> seen(a->shape_.size(), 0);
+    for (int axis : permutation) {
+        if (axis < 0 || axis >= seen.size() || seen[axis]++) {
+            seen.clear();
+            break;
+        }
+    }
+
+    if (permutation.size() != a->shape_.size() || seen.empty()) {
+        std::cerr << strings::error("views::transpose error: ") << strings::info(strings::vecToString(permutation))
+                  << " isn't a permutation of the axes of " << strings::info(strings::vecToString(a->shape_))
+                  << std::endl;
+        exit(-1);
+    }
+
+    std::vector<int> shape;
+    std::vector<int> strides;
+    for (int axis : permutation) {
+        shape.push_back(a->shape_[axis]);
+        strides.push_back(a->strides_[axis]);
+    }
+
+    return std::shared_ptr<GraphBuffer>(new GraphBuffer(a, shape, strides, 0));
+}
+
+std::shared_ptr<GraphBuffer> reshape(std::shared_ptr<Buffer> a, const std::vector<int>& shape) {
+    size_t size = 1;
+    for (int dim : shape) {
+        size *= dim;
+    }
+
+    if (size != a->size()) {
+        std::cerr << strings::error("views::reshape error: ") << "can't reshape "
+                  << strings::info(strings::vecToString(a->shape_)) << " into "
+                  << strings::info(strings::vecToString(shape)) << std::endl;
+        exit(-1);
+    }
+
+    // a strided view would need strides that don't exist for most shapes, the elements are put in order first
+    if (!a->contiguous()) {
+        std::shared_ptr<GraphBuffer> packed(new GraphBuffer(a->shape_, a->dtype()));
+        copy(a, packed);
+        a = packed;
+    }
+
+    std::vector<int> strides(shape.size());
+    size_t stride = 1;
+    for (int i = shape.size() - 1; i > -1; i--) {
+        strides[i] = stride;
+        stride *= shape[i];
+    }
+
+    return std::shared_ptr<GraphBuffer>(new GraphBuffer(a, shape, strides, 0));
+}
+
+std::shared_ptr<GraphBuffer> slice(std::shared_ptr<Buffer> a, int axis, int begin, int end) {
+    if (axis < 0 || axis >= a->shape_.size() || begin < 0 || end <= begin || end > a->shape_[axis]) {
+        std::cerr << strings::error("views::slice error: ") << "can't take "
+                  << strings::info("[" + std::to_string(begin) + ", " + std::to_string(end) + ")") << " of axis "
+                  << strings::info(std::to_string(axis)) << " of " << strings::info(strings::vecToString(a->shape_))
+                  << std::endl;
+        exit(-1);
+    }
+
+    std::vector<int> shape = a->shape_;
+    shape[axis] = end - begin;
+
+    return std::shared_ptr<GraphBuffer>(new GraphBuffer(a, shape, a->strides_, (size_t)begin * a->strides_[axis]));
+}
+
+std::shared_ptr<GraphBuffer> expand(std::shared_ptr<Buffer> a, const std::vector<int>& shape) {
+    std::vector<int> padded = broadcasting::padVector(a->shape_, shape.size());
+    std::vector<int> strides = broadcasting::padVector(a->strides_, shape.size());
+
+    bool valid = a->shape_.size() <= shape.size();
+    for (int i = 0; valid && i < shape.size(); i++) {
+        valid = padded[i] == shape[i] || padded[i] == 1;
+
+        // leading dimensions were padded with 1s above, their strides are 0 like any other repeated dimension
+        if (padded[i] == 1) {
+            strides[i] = 0;
+        }
+    }
+
+    if (!valid) {
+        std::cerr << strings::error("views::expand error: ") << "can't expand "
+                  << strings::info(strings::vecToString(a->shape_)) << " to "
+                  << strings::info(strings::vecToString(shape)) << std::endl;
+        exit(-1);
+    }
+
+    return std::shared_ptr<GraphBuffer>(new GraphBuffer(a, shape, strides, 0));
+}
+
+std::shared_ptr<GraphBuffer> squeeze(std::shared_ptr<Buffer> a, int axis) {
+    if (axis >= (int)a->shape_.size() || axis < -1 || (axis > -1 && a->shape_[axis] != 1)) {
+        std::cerr << strings::error("views::squeeze error: ") << "axis " << strings::info(std::to_string(axis))
+                  << " of " << strings::info(strings::vecToString(a->shape_)) << " isn't a dimension of 1"
+                  << std::endl;
+        exit(-1);
+    }
+
+    std::vector<int> shape;
+    std::vector<int> strides;
+    for (int i = 0; i < a->shape_.size(); i++) {
+        if (i == axis || (axis == -1 && a->shape_[i] == 1)) {
+            continue;
+        }
+
+        shape.push_back(a->shape_[i]);
+        strides.push_back(a->strides_[i]);
+    }
+
+    return std::shared_ptr<GraphBuffer>(new GraphBuffer(a, shape, strides, 0));
+}
+
+bool transposed(std::shared_ptr<Buffer> a) {
+    int rank = a->shape_.size();
+    if (rank < 2) {
+        return false;
+    }
+
+    std::vector<int> shape = a->shape_;
+    std::vector<int> strides = a->strides_;
+    std::swap(shape[rank - 2], shape[rank - 1]);
+    std::swap(strides[rank - 2], strides[rank - 1]);
+
+    return _contiguous(shape, strides);
+}
+
+// `rows` x `columns` of `a`, rows `lda` apart, written as the columns of `b`, rows `ldb` apart
+// a WIDTH x WIDTH block at a time is turned in registers for 4 byte elements
+template <typename T>
+void _tile(const T* a, size_t lda, T* b, size_t ldb, size_t rows, size_t columns) {
+    const int W = simd::WIDTH;
+
+    size_t i = 0;
+    if constexpr (sizeof(T) == sizeof(float)) {
+        for (; i + W <= rows; i += W) {
+            size_t j = 0;
+            for (; j + W <= columns; j += W) {
+                simd::vec block[W];
+                for (int r = 0; r < W; r++) {
+                    block[r] = simd::load((const float*)(a + (i + r) * lda + j));
+                }
+
+                simd::transpose(block);
+
+                for (int r = 0; r < W; r++) {
+                    simd::store((float*)(b + (j + r) * ldb + i), block[r]);
+                }
+            }
+
+            for (; j < columns; j++) {
+                for (size_t r = i; r < i + W; r++) {
+                    b[j * ldb + r] = a[r * lda + j];
+                }
+            }
+        }
+    }
+
+    for (size_t j = 0; j < columns; j++) {
+        for (size_t r = i; r < rows; r++) {
+            b[j * ldb + r] = a[r * lda + j];
+        }
+    }
+}
+
+// the larger side is halved until a tile fits, so both sides stay in cache whatever the sizes
+template <typename T>
+void _transpose(const T* a, size_t lda, T* b, size_t ldb, size_t rows, size_t columns) {
+    if (rows <= TILE && columns <= TILE) {
+        _tile(a, lda, b, ldb, rows, columns);
+        return;
+    }
+
+    // halves are kept to whole register blocks
+    if (rows >= columns) {
+        size_t half = rows / 2 / simd::WIDTH * simd::WIDTH;
+        _transpose(a, lda, b, ldb, half, columns);
+        _transpose(a + half * lda, lda, b + half, ldb, rows - half, columns);
+    } else {
+        size_t half = columns / 2 / simd::WIDTH * simd::WIDTH;
+        _transpose(a, lda, b, ldb, rows, half);
+        _transpose(a + half, lda, b + half * ldb, ldb, rows, columns - half);
+    }
+}
+
+size_t _offset(const std::vector<int>& indices, const std::vector<int>& strides) {
+    size_t offset = 0;
+    for (int i = 0; i < indices.size(); i++) {
+        offset += (size_t)indices[i] * strides[i];
+    }
+
+    return offset;
+}
+
+template <typename T>
+void _copy(const T* from, T* to, const std::vector<int>& shape, const std::vector<int>& from_strides,
+           const std::vector<int>& to_strides) {
+    int rank = shape.size();
+
+    // the dimensions each side is contiguous along
+    int read = -1;
+    int written = -1;
+    for (int i = 0; i < rank; i++) {
+        read = from_strides[i] == 1 ? i : read;
+        written = to_strides[i] == 1 ? i : written;
+    }
+
+    // when they differ it's a batch of 2d transposes over the rest of the dimensions, split into panels of rows
+    if (read > -1 && written > -1 && read != written) {
+        std::vector<int> outer_shape;
+        std::vector<int> outer_from;
+        std::vector<int> outer_to;
+        for (int i = 0; i < rank; i++) {
+            if (i != read && i != written) {
+                outer_shape.push_back(shape[i]);
+                outer_from.push_back(from_strides[i]);
+                outer_to.push_back(to_strides[i]);
+            }
+        }
+
+        if (outer_shape.empty()) {
+            outer_shape = {1};
+            outer_from = {0};
+            outer_to = {0};
+        }
+
+        size_t rows = shape[written];
+        size_t columns = shape[read];
+        size_t panels = (rows + PANEL - 1) / PANEL;
+
+        size_t outer = 1;
+        for (int dim : outer_shape) {
+            outer *= dim;
+        }
+
+        size_t grain = std::max((size_t)1, TRANSPOSE_GRAIN / (PANEL * columns));
+        parallel::parallelFor(0, outer * panels, grain, [&](size_t first, size_t last) {
+            iterators::IndexIterator it(outer_shape);
+
+            for (size_t task = first; task < last; task++) {
+                it.seek(task / panels);
+                size_t row = task % panels * PANEL;
+
+                const T* a = from + _offset(it.current_, outer_from) + row * from_strides[written];
+                T* b = to + _offset(it.current_, outer_to) + row;
+
+                _transpose(a, from_strides[written], b, to_strides[read], std::min(PANEL, rows - row), columns);
+            }
+        });
+
+        return;
+    }
+
+    // otherwise a row at a time along the last dimension, each row walked with its own stride
+    size_t columns = shape.back();
+    int from_stride = from_strides.back();
+    int to_stride = to_strides.back();
+
+    std::vector<int> rows_shape(shape.begin(), shape.end() - 1);
+    std::vector<int> rows_from(from_strides.begin(), from_strides.end() - 1);
+    std::vector<int> rows_to(to_strides.begin(), to_strides.end() - 1);
+    if (rows_shape.empty()) {
+        rows_shape = {1};
+        rows_from = {0};
+        rows_to = {0};
+    }
+
+    size_t rows = 1;
+    for (int dim : rows_shape) {
+        rows *= dim;
+    }
+
+    parallel::parallelFor(0, rows, GRAIN, [&](size_t first, size_t last) {
+        iterators::IndexIterator it(rows_shape);
+        it.seek(first);
+
+        for (size_t row = first; row < last; row++) {
+            const T* a = from + _offset(it.current_, rows_from);
+            T* b = to + _offset(it.current_, rows_to);
+
+            if (from_stride == 1 && to_stride == 1) {
+                std::memcpy(b, a, columns * sizeof(T));
+            } else {
+                for (size_t j = 0; j < columns; j++) {
+                    b[j * to_stride] = a[j * from_stride];
+                }
+            }
+
+            it.increment();
+        }
+    });
+}
+
+void copy(std::shared_ptr<Buffer> from, std::shared_ptr<Buffer> to) {
+    if (from->shape_ != to->shape_ || from->dtype() != to->dtype()) {
+        std::cerr << strings::error("views::copy error: ") << "shapes and dtypes must match, got "
+                  << strings::info(strings::vecToString(from->shape_)) << " and "
+                  << strings::info(strings::vecToString(to->shape_)) << std::endl;
+        exit(-1);
+    }
+
+    size_t element = dtypes::dtypeSize(from->dtype());
+    if (from->contiguous() && to->contiguous()) {
+        std::memcpy(to->getData(), from->getData(), from->size() * element);
+        return;
+    }
+
+    if (from->size() == 0) {
+        return;
+    }
+
+    // dimensions of 1 are dropped and neighbours laid out back to back on both sides are merged,
+    // e.g. a slice of whole rows is a single run and a transposed batch of matrices is one transpose per matrix
+    std::vector<int> shape;
+    std::vector<int> from_strides;
+    std::vector<int> to_strides;
+    for (int i = 0; i < from->shape_.size(); i++) {
+        int dim = from->shape_[i];
+        if (dim == 1) {
+            continue;
+        }
+
+        if (!shape.empty() && from_strides.back() == from->strides_[i] * dim &&
+            to_strides.back() == to->strides_[i] * dim) {
+            shape.back() *= dim;
+            from_strides.back() = from->strides_[i];
+            to_strides.back() = to->strides_[i];
+        } else {
+            shape.push_back(dim);
+            from_strides.push_back(from->strides_[i]);
+            to_strides.push_back(to->strides_[i]);
+        }
+    }
+
+    if (shape.empty()) {
+        shape = {1};
+        from_strides = {0};
+        to_strides = {0};
+    }
+
+    // elements are only moved, so they're copied as integers of the same width
+    if (element == sizeof(uint16_t)) {
+        _copy((const uint16_t*)from->getData(), (uint16_t*)to->getData(), shape, from_strides, to_strides);
+    } else if (element == sizeof(uint32_t)) {
+        _copy((const uint32_t*)from->getData(), (uint32_t*)to->getData(), shape, from_strides, to_strides);
+    } else {
+        _copy((const uint64_t*)from->getData(), (uint64_t*)to->getData(), shape, from_strides, to_strides);
+    }
+}
+
+std::shared_ptr<GraphBuffer> contiguous(std::shared_ptr<GraphBuffer> a) {
+    if (a->contiguous()) {
+        return a;
+    }
+
+    std::shared_ptr<GraphBuffer> packed(new GraphBuffer(a->shape_, a->dtype()));
+    copy(a, packed);
+
+    return packed;
+}
+
+bool isView(std::shared_ptr<Node> node) {
+    const std::string& type = node->operation_type_;
+
+    return type == operations::transpose || type == operations::reshape || type == operations::slice ||
+           type == operations::expand || type == operations::squeeze;
+}
+
+bool accepts(std::shared_ptr<Node> consumer, std::shared_ptr<Node> child) {
+    if (!isView(child) || child->output_ == nullptr || child->output_->contiguous() || isView(consumer)) {
+        return true;
+    }
+
+    const std::string& type = consumer->operation_type_;
+
+    // the broadcasting element-wise kernels and their gradients read through `Buffer::strides_`,
+    // except for multiply(x, x) which is differentiated as a flat 2x
+    if (type == operations::add || type == operations::subtract) {
+        return true;
+    } else if (type == operations::multiply) {
+        return consumer->arg_order_[0] != consumer->arg_order_[1];
+    } else if (type == operations::matmul) {
+        return transposed(child->output_);
+    }
+
+    return false;
+}
+
+// the numeric arguments following the operand
+std::vector<int> _arguments(std::shared_ptr<Node> node) {
+    std::vector<int> arguments;
+    for (int i = 1; i < node->arg_order_.size(); i++) {
+        arguments.push_back(std::stoi(node->arg_order_[i]));
+    }
+
+    return arguments;
+}
+
+std::vector<int> _permutation(std::shared_ptr<Node> node, int rank) {
+    std::vector<int> permutation = _arguments(node);
+    if (permutation.empty()) {
+        for (int i = 0; i < rank; i++) {
+            permutation.push_back(i);
+        }
+
+        if (rank >= 2) {
+            std::swap(permutation[rank - 2], permutation[rank - 1]);
+        }
+    }
+
+    return permutation;
+}
+
+std::shared_ptr<GraphBuffer> _view(std::shared_ptr<Node> node, std::shared_ptr<GraphBuffer> a) {
+    const std::string& type = node->operation_type_;
+    std::vector<int> arguments = _arguments(node);
+
+    if (type == operations::transpose) {
+        return transpose(a, _permutation(node, a->shape_.size()));
+    } else if (type == operations::reshape) {
+        return reshape(a, arguments);
+    } else if (type == operations::slice) {
+        if (arguments.size() != 3) {
+            std::cerr << strings::error("views::slice error: ") << "expects an axis, a beginning and an end, e.g. "
+                      << strings::debug("slice(x, 0, 2, 4)") << std::endl;
+            exit(-1);
+        }
+
+        return slice(a, arguments[0], arguments[1], arguments[2]);
+    } else if (type == operations::expand) {
+        return expand(a, arguments);
+    }
+
+    if (arguments.size() > 1) {
+        std::cerr << strings::error("views::squeeze error: ") << "expects at most one axis, got "
+                  << strings::info(strings::vecToString(arguments)) << std::endl;
+        exit(-1);
+    }
+
+    return squeeze(a, arguments.empty() ? -1 : arguments[0]);
+}
+
+void materialize(std::shared_ptr<Node> node) {
+    node->materialize_ = true;
+    node->output_ = contiguous(node->output_);
+}
+
+void allocate(std::shared_ptr<Node> node) {
+    std::shared_ptr<Node> child = node->children_[node->arg_order_[0]];
+    std::shared_ptr<GraphBuffer> view = _view(node, child->output_);
+
+    node->shape_ = view->shape_;
+    node->output_ = node->materialize_ ? contiguous(view) : view;
+    node->gradient_ = std::shared_ptr<GraphBuffer>(new GraphBuffer(node->shape_, node->dtype_));
+    buffer_ops::set(node->gradient_, 1.);
+}
+
+// the view is taken again every pass, the child may have been given a new buffer since, e.g. by checkpointing
+void forward(std::shared_ptr<Node> node) {
+    std::shared_ptr<Node> child = node->children_[node->arg_order_[0]];
+    std::shared_ptr<GraphBuffer> view = _view(node, child->output_);
+
+    if (node->materialize_) {
+        copy(view, node->output_);
+    } else {
+        node->output_ = view;
+    }
+}
+
+// the child's gradient is multiplied by the node's, put back into the child's layout
+void backward(std::shared_ptr<Node> node) {
+    std::shared_ptr<Node> child = node->children_[node->arg_order_[0]];
+    const std::string& type = node->operation_type_;
+
+    std::shared_ptr<Buffer> upstream;
+    if (type == operations::transpose) {
+        std::vector<int> permutation = _permutation(node, child->gradient_->shape_.size());
+        std::vector<int> inverse(permutation.size());
+        for (int i = 0; i < permutation.size(); i++) {
+            inverse[permutation[i]] = i;
+        }
+
+        upstream = transpose(node->gradient_, inverse);
+    } else if (type == operations::reshape || type == operations::squeeze) {
+        upstream = reshape(node->gradient_, child->gradient_->shape_);
+    } else if (type == operations::slice) {
+        // nothing outside the slice reaches the output
+        std::vector<int> arguments = _arguments(node);
+        std::shared_ptr<GraphBuffer> scattered(new GraphBuffer(child->gradient_->shape_, node->dtype_));
+        copy(node->gradient_, slice(scattered, arguments[0], arguments[1], arguments[2]));
+
+        upstream = scattered;
+    } else {
+        // every repeat of an element contributes to its gradient
+        std::vector<int> child_shape = broadcasting::padVector(child->gradient_->shape_, node->shape_.size());
+        std::vector<int> reduction_indices;
+        for (int i = 0; i < child_shape.size(); i++) {
+            if (child_shape[i] == 1 && node->shape_[i] != 1) {
+                reduction_indices.push_back(i);
+            }
+        }
+
+        std::shared_ptr<GraphBuffer> reduced(new GraphBuffer(child_shape, node->dtype_));
+        buffer_ops::reduceSum(node->gradient_, reduced, reduction_indices);
+
+        upstream = reshape(reduced, child->gradient_->shape_);
+    }
+
+    buffer_ops::multiply(upstream, child->gradient_, child->gradient_);
+}
+
+}  // namespace views